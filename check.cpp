@@ -0,0 +1,1024 @@
+#include "spg.hpp"
+#include "compact_spg.hpp"
+#include "concurrent_spg.hpp"
+#include "persistent_spg.hpp"
+#include "spg_map.hpp"
+#include "spg_snapshot.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <map>
+#include <random>
+#include <ratio>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+/// Correctness checks of every container and option against std::set and
+/// std::map, next to the benchmark of test.cpp. Each check runs random
+/// operations and compares the whole content regularly; the first mismatch
+/// is reported and the driver exits with a failure.
+///
+/// Meant to be built with the sanitizers and run after every change:
+///   g++ -std=c++17 -O1 -g -fsanitize=address,undefined -pthread -I. check.cpp -o check
+///   ./check
+/// and once more with the AVX2 paths of FrozenSPG, where the CPU has them:
+///   g++ -std=c++17 -O1 -g -mavx2 -fsanitize=address,undefined -pthread -I. check.cpp -o check_avx2
+///   ./check_avx2
+///
+/// Usage: check [--seed 42] [--ops 100000]
+
+namespace
+{
+    std::uint64_t   g_Seed = 42;
+    std::size_t     g_Ops = 100000;
+
+    void Expect(bool p_Condition, char const* p_Check, char const* p_What)
+    {
+        if (p_Condition)
+            return;
+
+        std::fprintf(stderr, "FAILED %s: %s (seed %llu)\n", p_Check, p_What, static_cast<unsigned long long>(g_Seed));
+        std::exit(1);
+    }
+
+    template <typename Range, typename Reference>
+    bool SameKeys(Range const& p_Range, Reference const& p_Reference)
+    {
+        return std::equal(p_Range.begin(), p_Range.end(), p_Reference.begin(), p_Reference.end());
+    }
+
+    /// Compares the content of an SPG with the reference, both ways.
+    template <typename Tree>
+    void ExpectContent(Tree const& p_Tree, std::set<int> const& p_Reference, char const* p_Check)
+    {
+        Expect(p_Tree.size() == p_Reference.size(), p_Check, "size");
+        Expect(SameKeys(p_Tree, p_Reference), p_Check, "keys in order");
+        Expect(std::equal(p_Tree.crbegin(), p_Tree.crend(), p_Reference.rbegin(), p_Reference.rend()), p_Check, "keys in reverse order");
+    }
+
+    /// Random inserts, erases and lookups on an SPG.
+    template <typename Tree>
+    void CheckTree(char const* p_Check, float p_Alpha = 0.6f)
+    {
+        std::mt19937_64 l_Generator(g_Seed);
+        Tree l_Tree(p_Alpha);
+        std::set<int> l_Reference;
+        Expect(l_Tree.alpha() == p_Alpha, p_Check, "alpha");
+
+        int const l_Space = static_cast<int>(g_Ops / 4) + 1;
+        for (std::size_t i = 0; i < g_Ops; ++i)
+        {
+            int l_Key = static_cast<int>(l_Generator() % l_Space);
+            switch (l_Generator() % 8)
+            {
+                case 0:
+                case 1:
+                case 2:
+                    Expect(l_Tree.insert(l_Key) == l_Reference.insert(l_Key).second, p_Check, "insert");
+                    break;
+                case 3:
+                {
+                    /// Hinted insertions, near the key or at the end.
+                    auto l_Hint = l_Generator() & 1 ? l_Tree.cend() : typename Tree::const_iterator(l_Tree.lower_bound(l_Key));
+                    int l_Appended = static_cast<int>(l_Space + i);
+                    Expect(*l_Tree.insert(l_Hint, l_Key) == l_Key, p_Check, "hinted insert");
+                    Expect(*l_Tree.insert(l_Tree.cend(), l_Appended) == l_Appended, p_Check, "append");
+                    l_Reference.insert(l_Key);
+                    l_Reference.insert(l_Appended);
+                    break;
+                }
+                case 4:
+                case 5:
+                    Expect(l_Tree.erase(l_Key) == l_Reference.erase(l_Key), p_Check, "erase");
+                    break;
+                case 6:
+                {
+                    auto l_Bound = l_Reference.lower_bound(l_Key);
+                    auto l_Ours = l_Tree.lower_bound(l_Key);
+                    Expect(l_Bound == l_Reference.end() ? l_Ours == l_Tree.end() : *l_Ours == *l_Bound, p_Check, "lower_bound");
+
+                    auto l_Upper = l_Reference.upper_bound(l_Key);
+                    auto l_Ours2 = l_Tree.upper_bound(l_Key);
+                    Expect(l_Upper == l_Reference.end() ? l_Ours2 == l_Tree.end() : *l_Ours2 == *l_Upper, p_Check, "upper_bound");
+                    break;
+                }
+                default:
+                {
+                    auto l_Found = l_Tree.find(l_Key);
+                    Expect(l_Tree.contains(l_Key) == (l_Reference.count(l_Key) == 1), p_Check, "contains");
+                    Expect(l_Found == l_Tree.end() ? !l_Reference.count(l_Key) : *l_Found == l_Key, p_Check, "find");
+                    break;
+                }
+            }
+
+            if (i % (g_Ops / 8 + 1) == 0)
+                ExpectContent(l_Tree, l_Reference, p_Check);
+        }
+
+        ExpectContent(l_Tree, l_Reference, p_Check);
+
+        /// The ranges.
+        std::vector<int> l_Visited;
+        l_Tree.for_each_in_range(l_Space / 4, l_Space / 2, [&l_Visited](int p_Key) { l_Visited.push_back(p_Key); });
+        Expect(SameKeys(l_Visited, std::vector<int>(l_Reference.lower_bound(l_Space / 4), l_Reference.upper_bound(l_Space / 2))),
+               p_Check, "for_each_in_range");
+
+        /// The moves.
+        Tree l_Moved(std::move(l_Tree));
+        ExpectContent(l_Moved, l_Reference, p_Check);
+        Expect(l_Tree.empty(), p_Check, "moved from");
+        l_Tree = std::move(l_Moved);
+        ExpectContent(l_Tree, l_Reference, p_Check);
+
+        /// Everything is erased, through the deletion rebuilds.
+        for (int l_Key : std::vector<int>(l_Reference.begin(), l_Reference.end()))
+            Expect(l_Tree.erase(l_Key) == 1, p_Check, "drain");
+        Expect(l_Tree.empty() && l_Tree.begin() == l_Tree.end(), p_Check, "drained");
+    }
+
+    /// Range construction, insert_range and the batches.
+    template <typename Tree>
+    void CheckBulk(char const* p_Check)
+    {
+        std::mt19937_64 l_Generator(g_Seed + 1);
+        std::vector<int> l_Keys;
+        for (std::size_t i = 0; i < g_Ops / 4; ++i)
+            l_Keys.push_back(static_cast<int>(l_Generator() % (g_Ops / 2 + 1)));
+
+        std::set<int> l_Reference(l_Keys.begin(), l_Keys.end());
+
+        Tree l_Tree(l_Keys.begin(), l_Keys.end(), 0.7f);
+        ExpectContent(l_Tree, l_Reference, p_Check);
+
+        std::vector<int> l_Sorted(l_Reference.begin(), l_Reference.end());
+        Tree l_FromSorted(l_Sorted.begin(), l_Sorted.end(), 0.7f);
+        ExpectContent(l_FromSorted, l_Reference, p_Check);
+
+        std::vector<int> l_More;
+        for (std::size_t i = 0; i < g_Ops / 8; ++i)
+            l_More.push_back(static_cast<int>(l_Generator() % g_Ops));
+        l_Tree.insert_range(l_More.begin(), l_More.end());
+        l_Reference.insert(l_More.begin(), l_More.end());
+        ExpectContent(l_Tree, l_Reference, p_Check);
+
+        /// A sorted burst in a batch, then random keys with erases in the middle.
+        l_Tree.begin_batch();
+        for (int i = 0; i < static_cast<int>(g_Ops / 8); ++i)
+        {
+            int l_Key = static_cast<int>(g_Ops) + i;
+            Expect(l_Tree.insert(l_Key) == l_Reference.insert(l_Key).second, p_Check, "batch insert");
+            if (i % 100 == 99)
+                Expect(l_Tree.erase(i) == l_Reference.erase(i), p_Check, "batch erase");
+        }
+        l_Tree.end_batch();
+        ExpectContent(l_Tree, l_Reference, p_Check);
+
+        std::size_t l_New = 0;
+        for (int l_Key : l_More)
+            l_New += l_Reference.insert(l_Key + 1).second;
+        std::vector<int> l_Shifted;
+        for (int l_Key : l_More)
+            l_Shifted.push_back(l_Key + 1);
+        Expect(l_Tree.insert_batch(l_Shifted.begin(), l_Shifted.end()) == l_New, p_Check, "insert_batch count");
+        ExpectContent(l_Tree, l_Reference, p_Check);
+    }
+
+    /// merge, intersect_with, subtract, the free set operations, split and join.
+    template <typename Tree>
+    void CheckAlgebra(char const* p_Check)
+    {
+        std::mt19937_64 l_Generator(g_Seed + 2);
+        auto l_Random = [&l_Generator](std::set<int>& p_Reference, std::size_t p_N)
+        {
+            Tree l_Tree(0.6f);
+            for (std::size_t i = 0; i < p_N; ++i)
+            {
+                int l_Key = static_cast<int>(l_Generator() % (3 * p_N + 1));
+                l_Tree.insert(l_Key);
+                p_Reference.insert(l_Key);
+            }
+            return l_Tree;
+        };
+
+        std::set<int> l_A;
+        std::set<int> l_B;
+        Tree l_TreeA = l_Random(l_A, g_Ops / 10);
+        Tree l_TreeB = l_Random(l_B, g_Ops / 20);
+
+        std::set<int> l_Union;
+        std::set<int> l_Common;
+        std::set<int> l_Difference;
+        std::set_union(l_A.begin(), l_A.end(), l_B.begin(), l_B.end(), std::inserter(l_Union, l_Union.end()));
+        std::set_intersection(l_A.begin(), l_A.end(), l_B.begin(), l_B.end(), std::inserter(l_Common, l_Common.end()));
+        std::set_difference(l_A.begin(), l_A.end(), l_B.begin(), l_B.end(), std::inserter(l_Difference, l_Difference.end()));
+
+        ExpectContent(set_union(l_TreeA, l_TreeB), l_Union, p_Check);
+        ExpectContent(set_intersection(l_TreeA, l_TreeB), l_Common, p_Check);
+        ExpectContent(set_difference(l_TreeA, l_TreeB), l_Difference, p_Check);
+
+        Tree l_Copy(l_A.begin(), l_A.end(), 0.6f);
+        ExpectContent(set_union(std::move(l_Copy), l_TreeB), l_Union, p_Check);
+        Tree l_Copy2(l_A.begin(), l_A.end(), 0.6f);
+        Tree l_CopyB(l_B.begin(), l_B.end(), 0.6f);
+        ExpectContent(set_union(std::move(l_Copy2), std::move(l_CopyB)), l_Union, p_Check);
+        Tree l_Copy3(l_A.begin(), l_A.end(), 0.6f);
+        ExpectContent(set_intersection(std::move(l_Copy3), l_TreeB), l_Common, p_Check);
+        Tree l_Copy4(l_A.begin(), l_A.end(), 0.6f);
+        ExpectContent(set_difference(std::move(l_Copy4), l_TreeB), l_Difference, p_Check);
+
+        /// split then join gives the tree back.
+        int l_Pivot = *std::next(l_A.begin(), l_A.size() / 3);
+        Tree l_Right = l_TreeA.split(l_Pivot);
+        Expect(l_TreeA.size() + l_Right.size() == l_A.size(), p_Check, "split sizes");
+        Expect(l_Right.empty() || *l_Right.begin() == l_Pivot, p_Check, "split pivot");
+        Expect(l_TreeA.empty() || *l_TreeA.rbegin() < l_Pivot, p_Check, "split left part");
+        l_TreeA.join(std::move(l_Right));
+        ExpectContent(l_TreeA, l_A, p_Check);
+
+        l_TreeA.merge(std::move(l_TreeB));
+        ExpectContent(l_TreeA, l_Union, p_Check);
+        Expect(l_TreeB.empty(), p_Check, "merged from");
+    }
+
+    /// The set operations of spg_multiset, against the counts of the copies:
+    /// the union adds them, the intersection keeps the fewest and the
+    /// difference takes those of the right tree off.
+    template <typename Tree>
+    void CheckMultisetAlgebra(char const* p_Check)
+    {
+        using Counts = std::map<int, std::size_t>;
+
+        std::mt19937_64 l_Generator(g_Seed + 8);
+        auto l_Random = [&l_Generator](Counts& p_Counts, std::size_t p_N)
+        {
+            Tree l_Tree(0.6f);
+            for (std::size_t i = 0; i < p_N; ++i)
+            {
+                int l_Key = static_cast<int>(l_Generator() % (p_N / 3 + 1));
+                l_Tree.insert(l_Key);
+                ++p_Counts[l_Key];
+            }
+            return l_Tree;
+        };
+
+        auto l_Expect = [p_Check](Tree const& p_Tree, Counts const& p_Counts, char const* p_What)
+        {
+            Expect(p_Tree.size() == p_Counts.size(), p_Check, p_What);
+
+            std::vector<int> l_Copies(p_Tree.copies_begin(), p_Tree.copies_end());
+            std::vector<int> l_Expected;
+            for (auto const& l_Count : p_Counts)
+            {
+                Expect(p_Tree.count(l_Count.first) == l_Count.second, p_Check, p_What);
+                l_Expected.insert(l_Expected.end(), l_Count.second, l_Count.first);
+            }
+            Expect(l_Copies == l_Expected, p_Check, p_What);
+        };
+
+        Counts l_A;
+        Counts l_B;
+        Tree l_TreeA = l_Random(l_A, g_Ops / 10);
+        Tree l_TreeB = l_Random(l_B, g_Ops / 20);
+
+        Counts l_Union = l_A;
+        Counts l_Common;
+        Counts l_Difference;
+        for (auto const& l_Count : l_B)
+        {
+            l_Union[l_Count.first] += l_Count.second;
+
+            auto l_It = l_A.find(l_Count.first);
+            if (l_It != l_A.end())
+                l_Common[l_Count.first] = std::min(l_It->second, l_Count.second);
+        }
+        for (auto const& l_Count : l_A)
+        {
+            auto l_It = l_B.find(l_Count.first);
+            std::size_t l_Taken = l_It == l_B.end() ? 0 : l_It->second;
+            if (l_Count.second > l_Taken)
+                l_Difference[l_Count.first] = l_Count.second - l_Taken;
+        }
+
+        auto l_Copy = [](Tree const& p_Tree)
+        {
+            Tree l_Tree(0.6f);
+            l_Tree.merge(p_Tree);
+            return l_Tree;
+        };
+
+        l_Expect(l_Copy(l_TreeA), l_A, "merge of a const tree");
+
+        l_Expect(set_union(l_TreeA, l_TreeB), l_Union, "set_union");
+        l_Expect(set_union(l_Copy(l_TreeA), l_TreeB), l_Union, "set_union of an rvalue");
+        l_Expect(set_union(l_Copy(l_TreeA), l_Copy(l_TreeB)), l_Union, "set_union of two rvalues");
+        l_Expect(set_intersection(l_TreeA, l_TreeB), l_Common, "set_intersection");
+        l_Expect(set_intersection(l_TreeB, l_TreeA), l_Common, "set_intersection of the smaller tree");
+        l_Expect(set_intersection(l_Copy(l_TreeA), l_TreeB), l_Common, "set_intersection of an rvalue");
+        l_Expect(set_difference(l_TreeA, l_TreeB), l_Difference, "set_difference");
+        l_Expect(set_difference(l_Copy(l_TreeA), l_TreeB), l_Difference, "set_difference of an rvalue");
+
+        Tree l_Intersected = l_Copy(l_TreeA);
+        l_Intersected.intersect_with(l_TreeB);
+        l_Expect(l_Intersected, l_Common, "intersect_with");
+
+        Tree l_Subtracted = l_Copy(l_TreeA);
+        l_Subtracted.subtract(l_TreeB);
+        l_Expect(l_Subtracted, l_Difference, "subtract");
+
+        l_TreeA.merge(std::move(l_TreeB));
+        l_Expect(l_TreeA, l_Union, "merge");
+        Expect(l_TreeB.empty(), p_Check, "merged from");
+    }
+
+    /// nth, rank and count_between, spg_subtree_size only.
+    template <typename Tree>
+    void CheckOrderStatistics(char const* p_Check)
+    {
+        std::mt19937_64 l_Generator(g_Seed + 3);
+        Tree l_Tree(0.65f);
+        std::set<int> l_Reference;
+        for (std::size_t i = 0; i < g_Ops / 4; ++i)
+        {
+            int l_Key = static_cast<int>(l_Generator() % (g_Ops / 2 + 1));
+            l_Tree.insert(l_Key);
+            l_Reference.insert(l_Key);
+            if (i % 3 == 0)
+            {
+                l_Tree.erase(l_Key / 2);
+                l_Reference.erase(l_Key / 2);
+            }
+        }
+
+        std::vector<int> l_Keys(l_Reference.begin(), l_Reference.end());
+        for (std::size_t k = 0; k < l_Keys.size(); k += 1 + l_Keys.size() / 500)
+            Expect(*l_Tree.nth(k) == l_Keys[k], p_Check, "nth");
+        Expect(l_Tree.nth(l_Keys.size()) == l_Tree.end(), p_Check, "nth past the end");
+
+        for (int l_Key = 0; l_Key < static_cast<int>(g_Ops / 2); l_Key += 97)
+        {
+            std::size_t l_Rank = std::lower_bound(l_Keys.begin(), l_Keys.end(), l_Key) - l_Keys.begin();
+            Expect(l_Tree.rank(l_Key) == l_Rank, p_Check, "rank");
+
+            std::size_t l_Count = std::upper_bound(l_Keys.begin(), l_Keys.end(), l_Key + 1000) - l_Keys.begin() - l_Rank;
+            Expect(l_Tree.count_between(l_Key, l_Key + 1000) == l_Count, p_Check, "count_between");
+        }
+    }
+
+    void CheckMap()
+    {
+        char const* l_Check = "SPGMap";
+        std::mt19937_64 l_Generator(g_Seed + 5);
+        SPGMap<int, std::string> l_Map(0.7f);
+        std::map<int, std::string> l_Reference;
+
+        for (std::size_t i = 0; i < g_Ops / 4; ++i)
+        {
+            int l_Key = static_cast<int>(l_Generator() % 5000);
+            std::string l_Value = std::to_string(i);
+            switch (l_Generator() % 5)
+            {
+                case 0:
+                    Expect(l_Map.try_emplace(l_Key, l_Value).second == l_Reference.emplace(l_Key, l_Value).second, l_Check, "try_emplace");
+                    break;
+                case 1:
+                    l_Map[l_Key] += "x";
+                    l_Reference[l_Key] += "x";
+                    break;
+                case 2:
+                    l_Map.insert_or_assign(l_Key, l_Value);
+                    l_Reference.insert_or_assign(l_Key, l_Value);
+                    break;
+                case 3:
+                    Expect(l_Map.erase(l_Key) == l_Reference.erase(l_Key), l_Check, "erase");
+                    break;
+                default:
+                    Expect(l_Map.contains(l_Key) == (l_Reference.count(l_Key) == 1), l_Check, "contains");
+                    break;
+            }
+        }
+
+        Expect(l_Map.size() == l_Reference.size(), l_Check, "size");
+        Expect(SameKeys(l_Map, l_Reference), l_Check, "pairs in order");
+
+        bool l_Threw = false;
+        try
+        {
+            l_Map.at(-1);
+        }
+        catch (std::out_of_range const&)
+        {
+            l_Threw = true;
+        }
+        Expect(l_Threw, l_Check, "at on a missing key");
+    }
+
+    void CheckConcurrent()
+    {
+        char const* l_Check = "ConcurrentSPG";
+        ConcurrentSPG<int> l_Set(4, 0.7f, 256);
+
+        std::vector<std::thread> l_Threads;
+        for (int t = 0; t < 4; ++t)
+        {
+            l_Threads.emplace_back([&l_Set, t]
+            {
+                for (int i = t; i < 40000; i += 4)
+                    l_Set.insert(i);
+                for (int i = t; i < 40000; i += 8)
+                    l_Set.erase(i);
+            });
+        }
+        for (auto& l_Thread : l_Threads)
+            l_Thread.join();
+
+        std::set<int> l_Reference;
+        for (int i = 0; i < 40000; ++i)
+            if (i % 8 >= 4)
+                l_Reference.insert(i);
+
+        std::vector<int> l_Keys;
+        l_Set.for_each([&l_Keys](int p_Key) { l_Keys.push_back(p_Key); });
+        Expect(l_Set.size() == l_Reference.size(), l_Check, "size");
+        Expect(SameKeys(l_Keys, l_Reference), l_Check, "keys in order");
+        Expect(l_Set.shard_count() > 1 && l_Set.shard_count() <= 4, l_Check, "shard count");
+
+        l_Keys.clear();
+        l_Set.for_each_in_range(1000, 2000, [&l_Keys](int p_Key) { l_Keys.push_back(p_Key); });
+        Expect(SameKeys(l_Keys, std::set<int>(l_Reference.lower_bound(1000), l_Reference.upper_bound(2000))), l_Check, "range");
+
+        /// The callbacks run without the locks and may write to the set.
+        std::size_t l_Visited = 0;
+        l_Set.for_each([&l_Set, &l_Visited](int p_Key)
+        {
+            ++l_Visited;
+            if (p_Key % 8 == 4)
+                l_Set.erase(p_Key);
+        });
+        Expect(l_Visited == l_Reference.size(), l_Check, "for_each writing to the set");
+        Expect(l_Set.size() == l_Reference.size() - l_Reference.size() / 4, l_Check, "size after the writes");
+
+        l_Set.for_each_in_range(0, 40000, [&l_Set](int p_Key) { l_Set.insert(p_Key + 40000); });
+        Expect(l_Set.size() == 2 * (l_Reference.size() - l_Reference.size() / 4), l_Check, "for_each_in_range writing to the set");
+    }
+
+    /// The copies of spg_multiset keys survive the splits and merges.
+    void CheckConcurrentMultiset()
+    {
+        char const* l_Check = "ConcurrentSPG spg_multiset";
+        ConcurrentSPG<int, std::less<int>, std::allocator<int>, spg_multiset> l_Set(4, 0.7f, 256);
+
+        std::vector<std::thread> l_Threads;
+        for (int t = 0; t < 4; ++t)
+        {
+            l_Threads.emplace_back([&l_Set, t]
+            {
+                for (int l_Copy = 0; l_Copy < 3; ++l_Copy)
+                    for (int i = t; i < 20000; i += 4)
+                        l_Set.insert(i);
+            });
+        }
+        for (auto& l_Thread : l_Threads)
+            l_Thread.join();
+
+        Expect(l_Set.size() == 60000, l_Check, "size");
+        Expect(l_Set.shard_count() > 1, l_Check, "shard count");
+        for (int i = 0; i < 20000; ++i)
+            Expect(l_Set.erase(i) == 3, l_Check, "copies");
+        Expect(l_Set.empty(), l_Check, "drained");
+
+        /// The copies of the smallest key fill the first half: the shard
+        /// is cut after them.
+        ConcurrentSPG<int, std::less<int>, std::allocator<int>, spg_multiset> l_Heavy(4, 0.7f, 256);
+        for (int i = 0; i < 16000; ++i)
+            l_Heavy.insert(0);
+        for (int i = 1; i <= 5000; ++i)
+            l_Heavy.insert(i);
+        Expect(l_Heavy.size() == 21000 && l_Heavy.shard_count() > 1, l_Check, "split after the copies of the first key");
+        Expect(l_Heavy.erase(0) == 16000, l_Check, "copies of the first key");
+    }
+
+    /// parallel_build, parallel_for_each and parallel_reduce.
+    template <typename Tree>
+    void CheckParallel(char const* p_Check)
+    {
+        std::mt19937_64 l_Generator(g_Seed + 4);
+        std::vector<int> l_Keys;
+        for (std::size_t i = 0; i < g_Ops; ++i)
+            l_Keys.push_back(static_cast<int>(l_Generator() % (2 * g_Ops)));
+        std::set<int> l_Reference(l_Keys.begin(), l_Keys.end());
+
+        Tree l_Tree(0.7f);
+        l_Tree.insert(-1);
+        l_Tree.parallel_build(l_Keys.begin(), l_Keys.end(), 4);
+        ExpectContent(l_Tree, l_Reference, p_Check);
+
+        std::atomic<long long> l_Sum(0);
+        l_Tree.parallel_for_each([&l_Sum](int p_Key) { l_Sum += p_Key; }, 4);
+
+        long long l_Expected = 0;
+        for (int l_Key : l_Reference)
+            l_Expected += l_Key;
+        Expect(l_Sum == l_Expected, p_Check, "parallel_for_each");
+
+        /// The keys come back in order through the reduction.
+        auto l_Ordered = l_Tree.parallel_reduce(std::vector<int>(),
+                                                [](std::vector<int> p_Keys, int p_Key) { p_Keys.push_back(p_Key); return p_Keys; },
+                                                [](std::vector<int> p_Lhs, std::vector<int> const& p_Rhs)
+                                                {
+                                                    p_Lhs.insert(p_Lhs.end(), p_Rhs.begin(), p_Rhs.end());
+                                                    return p_Lhs;
+                                                }, 4);
+        Expect(SameKeys(l_Ordered, l_Reference), p_Check, "parallel_reduce");
+
+        /// A throwing callback leaves the tree and the pool usable.
+        bool l_Thrown = false;
+        try
+        {
+            l_Tree.parallel_for_each([](int p_Key) { if (p_Key % 7 == 0) throw std::runtime_error("callback"); }, 4);
+        }
+        catch (std::runtime_error const&)
+        {
+            l_Thrown = true;
+        }
+        Expect(l_Thrown || l_Reference.empty(), p_Check, "parallel_for_each throw");
+
+        l_Sum = 0;
+        l_Tree.parallel_for_each([&l_Sum](int p_Key) { l_Sum += p_Key; }, 4);
+        Expect(l_Sum == l_Expected, p_Check, "parallel_for_each after a throw");
+    }
+
+    /// Tasks throwing on the workers and on the caller: every task still
+    /// runs to its end before Run rethrows the first exception.
+    void CheckPoolThrow()
+    {
+        char const* l_Check = "ThreadPool throw";
+        details::ThreadPool l_Pool(2);
+        for (int l_Round = 0; l_Round < 50; ++l_Round)
+        {
+            std::atomic<int> l_Done(0);
+            std::vector<std::function<void()>> l_Tasks;
+            for (int i = 0; i < 64; ++i)
+            {
+                l_Tasks.emplace_back([&l_Done, i]
+                {
+                    ++l_Done;
+                    if (i % 5 == 0)
+                        throw std::runtime_error("task");
+                });
+            }
+
+            bool l_Thrown = false;
+            try
+            {
+                l_Pool.Run(l_Tasks);
+            }
+            catch (std::runtime_error const&)
+            {
+                l_Thrown = true;
+            }
+            Expect(l_Thrown && l_Done == 64, l_Check, "every task done before the rethrow");
+        }
+    }
+
+    /// Probe of PrefixLess, equivalent to every key starting with it.
+    struct Prefix
+    {
+        std::string Value;
+    };
+
+    /// Orders the strings, and compares a Prefix with their beginning.
+    struct PrefixLess
+    {
+        using is_transparent = void;
+
+        bool operator()(std::string const& p_Lhs, std::string const& p_Rhs) const
+        {
+            return p_Lhs < p_Rhs;
+        }
+
+        bool operator()(Prefix const& p_Lhs, std::string const& p_Rhs) const
+        {
+            return p_Rhs.compare(0, p_Lhs.Value.size(), p_Lhs.Value) > 0;
+        }
+
+        bool operator()(std::string const& p_Lhs, Prefix const& p_Rhs) const
+        {
+            return p_Lhs.compare(0, p_Rhs.Value.size(), p_Rhs.Value) < 0;
+        }
+    };
+
+    void CheckTransparent()
+    {
+        char const* l_Check = "transparent comparator";
+        SPG<std::string, std::less<>> l_Tree(0.7f);
+        std::set<std::string> l_Reference;
+        for (int i = 0; i < 2000; ++i)
+        {
+            std::string l_Key = "key" + std::to_string(i * 7 % 2003);
+            l_Tree.insert(l_Key);
+            l_Reference.insert(l_Key);
+        }
+
+        Expect(l_Tree.contains("key14") && !l_Tree.contains("nokey"), l_Check, "contains");
+        Expect(*l_Tree.find("key21") == "key21", l_Check, "find");
+        Expect(*l_Tree.lower_bound("key2") == *l_Reference.lower_bound("key2"), l_Check, "lower_bound");
+        Expect(l_Tree.erase("key14") == 1 && l_Tree.erase("key14") == 0, l_Check, "erase");
+        l_Reference.erase("key14");
+
+        /// A prefix is equivalent to every key starting with it.
+        SPG<std::string, PrefixLess> l_Prefixed(l_Tree.cbegin(), l_Tree.cend(), 0.7f);
+        std::set<std::string, PrefixLess> l_PrefixReference(l_Reference.begin(), l_Reference.end());
+        for (char const* l_Prefix : {"key1", "key20", "key199", "nokey"})
+        {
+            auto l_Range = l_Prefixed.equal_range(Prefix{l_Prefix});
+            auto l_Expected = l_PrefixReference.equal_range(Prefix{l_Prefix});
+            Expect(std::equal(l_Range.first, l_Range.second, l_Expected.first, l_Expected.second), l_Check, "equal_range of a prefix");
+            Expect(l_Prefixed.count(Prefix{l_Prefix}) == l_PrefixReference.count(Prefix{l_Prefix}), l_Check, "count of a prefix");
+            Expect(l_Range.second == l_Prefixed.upper_bound(Prefix{l_Prefix}), l_Check, "upper_bound of a prefix");
+
+            std::size_t l_Erased = l_PrefixReference.count(Prefix{l_Prefix});
+            l_PrefixReference.erase(l_Expected.first, l_Expected.second);
+            Expect(l_Prefixed.erase(Prefix{l_Prefix}) == l_Erased, l_Check, "erase of a prefix");
+            Expect(SameKeys(l_Prefixed, l_PrefixReference), l_Check, "keys after the erase of a prefix");
+        }
+
+        SPGMap<std::string, int, PrefixLess> l_Map(0.7f);
+        std::map<std::string, int, PrefixLess> l_MapReference;
+        for (auto const& l_Key : l_Reference)
+        {
+            l_Map.try_emplace(l_Key, 1);
+            l_MapReference.emplace(l_Key, 1);
+        }
+        auto l_MapRange = l_Map.equal_range(Prefix{"key3"});
+        auto l_MapExpected = l_MapReference.equal_range(Prefix{"key3"});
+        Expect(std::equal(l_MapRange.first, l_MapRange.second, l_MapExpected.first, l_MapExpected.second), l_Check, "map equal_range of a prefix");
+        std::size_t l_MapErased = l_MapReference.count(Prefix{"key3"});
+        Expect(l_Map.erase(Prefix{"key3"}) == l_MapErased && !l_Map.contains(Prefix{"key3"}), l_Check, "map erase of a prefix");
+        Expect(l_Map.size() == l_MapReference.size() - l_MapErased, l_Check, "map size after the erase of a prefix");
+    }
+
+    void CheckStats()
+    {
+        char const* l_Check = "spg_stats";
+        SPG<int, std::less<int>, std::allocator<int>, spg_stats> l_Tree(0.6f);
+        for (int i = 0; i < 10000; ++i)
+            l_Tree.insert(i);
+
+        spg_statistics l_Stats = l_Tree.stats();
+        Expect(l_Stats.Inserts == 10000, l_Check, "inserts");
+        Expect(l_Stats.Rebuilds == l_Tree.rebuild_count() && l_Stats.Rebuilds > 0, l_Check, "rebuilds");
+        Expect(l_Stats.RelinkedNodes >= l_Stats.Rebuilds, l_Check, "relinked nodes");
+
+        l_Tree.reset_stats();
+        Expect(l_Tree.stats().Inserts == 0, l_Check, "reset");
+    }
+
+    /// FrozenSPG of Key against std::set, the batches of the keys AVX2
+    /// handles take its path when the driver is built with -mavx2.
+    template <typename Key>
+    void CheckFrozen(char const* p_Check)
+    {
+        std::set<Key> l_Reference;
+        SPG<Key> l_Tree(0.7f);
+        for (int i = 0; i < 10000; ++i)
+        {
+            l_Tree.insert(static_cast<Key>(i * 3));
+            l_Reference.insert(static_cast<Key>(i * 3));
+        }
+
+        auto l_Frozen = l_Tree.freeze();
+        Expect(SameKeys(l_Frozen, l_Reference), p_Check, "keys in order");
+
+        std::vector<Key> l_Scanned;
+        l_Frozen.for_each([&l_Scanned](Key const& p_Key) { l_Scanned.push_back(p_Key); });
+        Expect(SameKeys(l_Scanned, l_Reference), p_Check, "for_each");
+
+        std::vector<Key> l_Queries;
+        for (int i = -5; i < 30010; i += 7)
+            l_Queries.push_back(static_cast<Key>(i));
+
+        std::vector<char> l_Found(l_Queries.size());
+        l_Frozen.contains_batch(l_Queries.data(), l_Queries.size(), reinterpret_cast<bool*>(l_Found.data()));
+
+        std::vector<typename FrozenSPG<Key>::const_iterator> l_Bounds(l_Queries.size());
+        l_Frozen.lower_bound_batch(l_Queries.data(), l_Queries.size(), l_Bounds.data());
+
+        for (std::size_t i = 0; i < l_Queries.size(); ++i)
+        {
+            Key l_Key = l_Queries[i];
+            auto l_Bound = l_Reference.lower_bound(l_Key);
+            auto l_Ours = l_Frozen.lower_bound(l_Key);
+            Expect(l_Bound == l_Reference.end() ? l_Ours == l_Frozen.end() : *l_Ours == *l_Bound, p_Check, "lower_bound");
+            Expect(l_Bounds[i] == l_Ours, p_Check, "lower_bound_batch");
+            Expect(l_Frozen.contains(l_Key) == (l_Reference.count(l_Key) == 1), p_Check, "contains");
+            Expect(static_cast<bool>(l_Found[i]) == (l_Reference.count(l_Key) == 1), p_Check, "contains_batch");
+        }
+    }
+
+    void CheckSnapshots()
+    {
+        char const* l_Check = "save/load";
+        char l_Path[] = "/tmp/spg_check_XXXXXX";
+        int l_Fd = mkstemp(l_Path);
+        Expect(l_Fd >= 0, l_Check, "temporary file");
+        close(l_Fd);
+
+        SPG<std::int64_t> l_Tree(0.7f);
+        std::set<std::int64_t> l_Reference;
+        for (std::int64_t i = 0; i < 20000; ++i)
+        {
+            l_Tree.insert(i * i);
+            l_Reference.insert(i * i);
+        }
+
+        Expect(l_Tree.save(l_Path), l_Check, "save");
+
+        SPG<std::int64_t> l_Loaded(0.6f);
+        l_Loaded.insert(-1);
+        Expect(l_Loaded.load(l_Path), l_Check, "load");
+        Expect(l_Loaded.size() == l_Reference.size() && SameKeys(l_Loaded, l_Reference), l_Check, "loaded keys");
+
+        /// Keys of another size are refused and the tree is left as it was.
+        SPG<int> l_Other(0.6f);
+        l_Other.insert(7);
+        Expect(!l_Other.load(l_Path), l_Check, "load of another key type");
+        Expect(l_Other.size() == 1 && *l_Other.begin() == 7, l_Check, "untouched after a refused load");
+        Expect(!l_Other.load("/nonexistent/spg"), l_Check, "load of a missing file");
+
+        std::remove(l_Path);
+    }
+
+    void CheckCompact()
+    {
+        char const* l_Check = "CompactSPG";
+        std::mt19937_64 l_Generator(g_Seed + 6);
+        CompactSPG<int> l_Tree(0.6f);
+        std::set<int> l_Reference;
+
+        for (std::size_t i = 0; i < g_Ops; ++i)
+        {
+            int l_Key = static_cast<int>(l_Generator() % (g_Ops / 4 + 1));
+            switch (l_Generator() % 4)
+            {
+                case 0:
+                case 1:
+                    Expect(l_Tree.insert(l_Key) == l_Reference.insert(l_Key).second, l_Check, "insert");
+                    break;
+                case 2:
+                    Expect(l_Tree.erase(l_Key) == l_Reference.erase(l_Key), l_Check, "erase");
+                    break;
+                default:
+                {
+                    auto l_Bound = l_Reference.lower_bound(l_Key);
+                    auto l_Ours = l_Tree.lower_bound(l_Key);
+                    Expect(l_Bound == l_Reference.end() ? l_Ours == l_Tree.end() : *l_Ours == *l_Bound, l_Check, "lower_bound");
+                    Expect(l_Tree.contains(l_Key) == (l_Reference.count(l_Key) == 1), l_Check, "contains");
+                    break;
+                }
+            }
+        }
+
+        Expect(l_Tree.size() == l_Reference.size() && SameKeys(l_Tree, l_Reference), l_Check, "keys in order");
+
+        std::vector<int> l_Visited;
+        l_Tree.for_each_in_range(100, 5000, [&l_Visited](int p_Key) { l_Visited.push_back(p_Key); });
+        Expect(SameKeys(l_Visited, std::vector<int>(l_Reference.lower_bound(100), l_Reference.upper_bound(5000))), l_Check, "range");
+
+        l_Tree.shrink_to_fit();
+        Expect(SameKeys(l_Tree, l_Reference), l_Check, "shrink_to_fit");
+
+        for (int l_Key : std::vector<int>(l_Reference.begin(), l_Reference.end()))
+            Expect(l_Tree.erase(l_Key) == 1, l_Check, "drain");
+        Expect(l_Tree.empty(), l_Check, "drained");
+    }
+
+    /// Appends under spg_veb_layout: the rebuilds of the right spine move
+    /// the nodes too. The nodes of an append-only tree are allocated in
+    /// key order, they only leave it once relocated.
+    void CheckVebAppend()
+    {
+        char const* l_Check = "spg_veb_layout appends";
+        SPG<int, std::less<int>, std::allocator<int>, spg_veb_layout> l_Tree(0.7f);
+        for (int i = 0; i < 20000; ++i)
+        {
+            if (i & 1)
+                Expect(*l_Tree.insert(l_Tree.cend(), i) == i, l_Check, "append");
+            else
+                Expect(l_Tree.insert(i), l_Check, "insert");
+        }
+
+        std::vector<int const*> l_Addresses;
+        for (int const& l_Key : l_Tree)
+            l_Addresses.push_back(&l_Key);
+        Expect(l_Addresses.size() == 20000 && std::is_sorted(l_Tree.begin(), l_Tree.end()), l_Check, "keys in order");
+
+        std::size_t l_Moved = 0;
+        for (std::size_t i = 1; i < l_Addresses.size(); ++i)
+            l_Moved += std::less<int const*>()(l_Addresses[i], l_Addresses[i - 1]);
+        Expect(l_Moved > l_Addresses.size() / 8, l_Check, "nodes relocated");
+    }
+
+    /// The right part of a split shares the pool of the tree: once dropped,
+    /// its nodes go back to the pool and the next insertions reuse them.
+    void CheckPoolSplit()
+    {
+        char const* l_Check = "spg_pool_allocator split";
+        SPG<int, std::less<int>, spg_pool_allocator<int>> l_Tree(0.7f);
+        for (int i = 0; i < 10000; ++i)
+            l_Tree.insert(i);
+
+        for (int l_Round = 0; l_Round < 10; ++l_Round)
+        {
+            std::set<int const*> l_Freed;
+            {
+                auto l_Right = l_Tree.split(5000);
+                for (int const& l_Key : l_Right)
+                    l_Freed.insert(&l_Key);
+            }
+
+            for (int i = 5000; i < 10000; ++i)
+                l_Tree.insert(i);
+
+            for (int const& l_Key : l_Tree)
+                l_Freed.erase(&l_Key);
+            Expect(l_Freed.empty(), l_Check, "nodes of the dropped part reused");
+        }
+
+        Expect(l_Tree.size() == 10000, l_Check, "size");
+    }
+
+    /// The rebound copies of spg_pool_allocator share its pools, as the
+    /// std containers rebinding it expect.
+    void CheckPoolRebind()
+    {
+        char const* l_Check = "spg_pool_allocator rebind";
+        spg_pool_allocator<int> l_Ints;
+        spg_pool_allocator<double> l_Doubles(l_Ints);
+        Expect(spg_pool_allocator<int>(l_Doubles) == l_Ints && l_Doubles == l_Ints, l_Check, "A(B(a)) == a");
+        Expect(spg_pool_allocator<int>() != l_Ints, l_Check, "other pools");
+
+        /// Memory of the pool given back through a rebound copy.
+        int* l_Int = l_Ints.allocate(1);
+        spg_pool_allocator<int>(l_Doubles).deallocate(l_Int, 1);
+        Expect(l_Ints.allocate(1) == l_Int, l_Check, "slot reused");
+
+        /// splice needs equal allocators, the lists rebind ours to their nodes.
+        std::list<int, spg_pool_allocator<int>> l_Lhs(l_Ints);
+        std::list<int, spg_pool_allocator<int>> l_Rhs(l_Lhs.get_allocator());
+        for (int i = 0; i < 1000; ++i)
+            (i & 1 ? l_Lhs : l_Rhs).push_back(i);
+        Expect(l_Lhs.get_allocator() == l_Ints, l_Check, "get_allocator");
+        l_Lhs.splice(l_Lhs.end(), l_Rhs);
+        Expect(l_Lhs.size() == 1000 && l_Rhs.empty(), l_Check, "splice");
+    }
+
+    /// Old versions stay intact, a reader checks snapshots under a writer.
+    void CheckPersistent()
+    {
+        char const* l_Check = "PersistentSPG";
+        std::mt19937_64 l_Generator(g_Seed + 7);
+        PersistentSPG<int> l_Tree(0.6f);
+        std::set<int> l_Reference;
+
+        using snapshot_type = PersistentSPG<int>::snapshot_type;
+        std::vector<std::pair<snapshot_type, std::set<int>>> l_Versions;
+
+        auto l_Keys = [](snapshot_type const& p_Snapshot)
+        {
+            std::vector<int> l_Result;
+            p_Snapshot.for_each([&l_Result](int p_Key) { l_Result.push_back(p_Key); });
+            return l_Result;
+        };
+
+        for (std::size_t i = 0; i < g_Ops / 2; ++i)
+        {
+            int l_Key = static_cast<int>(l_Generator() % (g_Ops / 8 + 1));
+            if (l_Generator() % 3)
+                Expect(l_Tree.insert(l_Key) == l_Reference.insert(l_Key).second, l_Check, "insert");
+            else
+                Expect(l_Tree.erase(l_Key) == l_Reference.erase(l_Key), l_Check, "erase");
+
+            if (i % (g_Ops / 20 + 1) == 0)
+                l_Versions.emplace_back(l_Tree.snapshot(), l_Reference);
+        }
+
+        /// The old versions did not change.
+        for (auto const& l_Version : l_Versions)
+        {
+            Expect(l_Version.first.size() == l_Version.second.size(), l_Check, "old version size");
+            Expect(SameKeys(l_Keys(l_Version.first), l_Version.second), l_Check, "old version keys");
+        }
+
+        snapshot_type l_Snapshot = l_Tree.snapshot();
+        Expect(SameKeys(l_Keys(l_Snapshot), l_Reference), l_Check, "current keys");
+        for (int l_Key = 0; l_Key < 1000; ++l_Key)
+        {
+            int const* l_Found = l_Snapshot.find(l_Key);
+            Expect(l_Found ? *l_Found == l_Key && l_Reference.count(l_Key) : !l_Reference.count(l_Key), l_Check, "find");
+        }
+
+        /// Readers keep checking their snapshots while the writer goes on.
+        std::atomic<bool> l_Stop(false);
+        std::vector<std::thread> l_Readers;
+        for (int t = 0; t < 3; ++t)
+        {
+            l_Readers.emplace_back([&]
+            {
+                while (!l_Stop)
+                {
+                    snapshot_type l_View = l_Tree.snapshot();
+                    std::vector<int> l_Seen = l_Keys(l_View);
+                    Expect(l_Seen.size() == l_View.size() && std::is_sorted(l_Seen.begin(), l_Seen.end()), l_Check, "concurrent snapshot");
+                    Expect(l_Tree.version() >= l_View.version(), l_Check, "versions only grow");
+                }
+            });
+        }
+
+        for (int i = 0; i < 20000; ++i)
+        {
+            l_Tree.insert(i);
+            l_Tree.erase(i / 2);
+        }
+        l_Stop = true;
+        for (auto& l_Reader : l_Readers)
+            l_Reader.join();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string l_Arg = argv[i];
+        if (l_Arg == "--seed")
+            g_Seed = std::strtoull(argv[i + 1], nullptr, 10);
+        else if (l_Arg == "--ops")
+            g_Ops = std::strtoul(argv[i + 1], nullptr, 10);
+        else
+        {
+            std::fprintf(stderr, "unknown option %s\n", l_Arg.c_str());
+            return 1;
+        }
+    }
+
+    using Less = std::less<int>;
+    using Alloc = std::allocator<int>;
+
+    CheckTree<SPG<int>>("SPG");
+    CheckTree<SPG<int, Less, Alloc, spg_subtree_size>>("spg_subtree_size");
+    CheckTree<SPG<int, Less, spg_pool_allocator<int>>>("spg_pool_allocator");
+    CheckTree<SPG<int, Less, Alloc, spg_buffer_rebuild>>("spg_buffer_rebuild");
+    CheckTree<SPG<int, Less, Alloc, spg_stats>>("spg_stats");
+    CheckTree<SPG<int, Less, Alloc, spg_parallel_rebuild>>("spg_parallel_rebuild");
+    CheckTree<SPG<int, Less, Alloc, spg_veb_layout>>("spg_veb_layout");
+    CheckTree<SPG<int, Less, Alloc, spg_veb_layout, spg_subtree_size, spg_buffer_rebuild>>("spg_veb_layout sized");
+    CheckTree<SPG<int, Less, Alloc, std::ratio<3, 5>>>("std::ratio", 0.6f);
+    CheckTree<SPG<int, Less, Alloc, std::ratio<99, 100>>>("std::ratio 99/100", 0.99f);
+    Expect(SPG<int, Less, Alloc, std::ratio<3, 5>>().alpha() == 0.6f, "std::ratio", "alpha of SPG()");
+
+    CheckBulk<SPG<int>>("bulk");
+    CheckBulk<SPG<int, Less, Alloc, spg_subtree_size, spg_buffer_rebuild>>("bulk sized");
+    CheckBulk<SPG<int, Less, Alloc, spg_veb_layout>>("bulk spg_veb_layout");
+
+    CheckAlgebra<SPG<int>>("algebra");
+    CheckAlgebra<SPG<int, Less, Alloc, spg_subtree_size>>("algebra sized");
+
+    CheckMultisetAlgebra<SPG<int, Less, Alloc, spg_multiset>>("multiset algebra");
+    CheckMultisetAlgebra<SPG<int, Less, Alloc, spg_multiset, spg_subtree_size, spg_veb_layout>>("multiset algebra sized");
+
+    CheckOrderStatistics<SPG<int, Less, Alloc, spg_subtree_size>>("order statistics");
+    CheckOrderStatistics<SPG<int, Less, Alloc, spg_subtree_size, spg_veb_layout>>("order statistics spg_veb_layout");
+
+    CheckParallel<SPG<int>>("parallel");
+    CheckParallel<SPG<int, Less, Alloc, spg_subtree_size>>("parallel sized");
+    CheckPoolThrow();
+
+    CheckTransparent();
+    CheckStats();
+    CheckMap();
+    CheckFrozen<int>("FrozenSPG");
+    CheckFrozen<std::int64_t>("FrozenSPG int64");
+    CheckFrozen<float>("FrozenSPG float");
+    CheckFrozen<double>("FrozenSPG double");
+    CheckFrozen<short>("FrozenSPG short");
+    CheckConcurrent();
+    CheckConcurrentMultiset();
+    CheckSnapshots();
+    CheckCompact();
+    CheckPoolSplit();
+    CheckPoolRebind();
+    CheckVebAppend();
+    CheckPersistent();
+
+    std::printf("all checks passed (seed %llu, %zu ops)\n", static_cast<unsigned long long>(g_Seed), g_Ops);
+    return 0;
+}
@@ -0,0 +1,635 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace details
+{
+    /// Node of CompactSPG: the children are indices in the arena, 0 is null.
+    /// There is no parent link, a Node<int> is 12 bytes instead of 32.
+    template <typename T>
+    struct CompactNode
+    {
+        template <typename Value>
+        CompactNode(Value&& p_Key)
+            : Left(0),
+            Right(0),
+            Key(std::forward<Value>(p_Key))
+        {
+        }
+
+        std::uint32_t   Left;
+        std::uint32_t   Right;
+        T               Key;
+    };
+}
+
+template <typename T, typename Comparator>
+class CompactSPG;
+
+/// Forward iterator of CompactSPG. The nodes have no parent, so the iterator
+/// keeps the ancestors where the walk will come back. The lookups don't
+/// stack them, the first increment does with one more descent.
+template <typename T, typename Comparator>
+class spg_compact_iterator
+{
+    friend class CompactSPG<T, Comparator>;
+
+    public:
+        using self_type = spg_compact_iterator<T, Comparator>;
+        using value_type = T;
+        using reference = value_type const&;
+        using pointer = value_type const*;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::forward_iterator_tag;
+
+        spg_compact_iterator()
+            : m_Tree(nullptr),
+            m_Node(0),
+            m_Stacked(true)
+        {
+        }
+
+        reference operator*() const
+        {
+            return m_Tree->GetNode(m_Node).Key;
+        }
+
+        pointer operator->() const
+        {
+            return &(operator*());
+        }
+
+        self_type& operator++()
+        {
+            if (!m_Stacked)
+                StackAncestors();
+
+            /// The successor is the leftmost node of the right subtree, or
+            /// the ancestor where we went left for the last time.
+            std::uint32_t l_Right = m_Tree->GetNode(m_Node).Right;
+            if (l_Right)
+                m_Node = DescendLeft(l_Right);
+            else if (!m_Path.empty())
+            {
+                m_Node = m_Path.back();
+                m_Path.pop_back();
+            }
+            else
+                m_Node = 0;
+
+            return *this;
+        }
+
+        self_type operator++(int)
+        {
+            auto l_Tmp = *this;
+            operator++();
+            return l_Tmp;
+        }
+
+        bool operator==(self_type const& p_Rhs) const
+        {
+            return m_Node == p_Rhs.m_Node;
+        }
+
+        bool operator!=(self_type const& p_Rhs) const
+        {
+            return !(operator==(p_Rhs));
+        }
+
+    private:
+        spg_compact_iterator(CompactSPG<T, Comparator> const* p_Tree, std::uint32_t p_Node, bool p_Stacked)
+            : m_Tree(p_Tree),
+            m_Node(p_Node),
+            m_Stacked(p_Stacked)
+        {
+        }
+
+        /// Goes down the left branch of p_Index, stacks the nodes above
+        /// the last one and returns it.
+        std::uint32_t DescendLeft(std::uint32_t p_Index)
+        {
+            for (std::uint32_t l_Left; (l_Left = m_Tree->GetNode(p_Index).Left); p_Index = l_Left)
+                m_Path.push_back(p_Index);
+            return p_Index;
+        }
+
+        /// Stacks the ancestors of m_Node where its search goes left.
+        void StackAncestors()
+        {
+            T const& l_Key = m_Tree->GetNode(m_Node).Key;
+            for (std::uint32_t l_Index = m_Tree->m_Root; l_Index != m_Node;)
+            {
+                auto const& l_Node = m_Tree->GetNode(l_Index);
+                if (m_Tree->m_Comparator(l_Key, l_Node.Key))
+                {
+                    m_Path.push_back(l_Index);
+                    l_Index = l_Node.Left;
+                }
+                else
+                    l_Index = l_Node.Right;
+            }
+
+            m_Stacked = true;
+        }
+
+        CompactSPG<T, Comparator> const*    m_Tree;
+        std::uint32_t                       m_Node;     ///< 0 is the end.
+        std::vector<std::uint32_t>          m_Path;     ///< Ancestors where we went left, the nearest on top.
+        bool                                m_Stacked;  ///< False until m_Path is filled.
+};
+
+/// ScapeGoat tree whose nodes live in one arena, linked by 32 bits indices
+/// and without parent: for small keys, the nodes take less than half the
+/// memory of SPG and more of them share a cache line. The insertions and
+/// the rebuilds are those of SPG, the parents being kept on the way down.
+///
+/// The erased nodes are reused by the next insertions, shrink_to_fit gives
+/// their memory back. Erasing a node with two children moves the key of its
+/// successor into it, so T must be move assignable. The tree holds at most
+/// 2^32 - 1 keys.
+template <typename T,
+          typename Comparator = std::less<T>>
+class CompactSPG
+{
+    friend class spg_compact_iterator<T, Comparator>;
+
+    using node_type = details::CompactNode<T>;
+    using index_type = std::uint32_t;
+
+    public:
+        using value_type = T;
+        using key_compare = Comparator;
+        using const_iterator = spg_compact_iterator<T, Comparator>;
+        using iterator = const_iterator;
+
+        /// Constructs an empty tree.
+        /// @p_Alpha : unbalance factor of the tree, MUST be in the interval [0.5, 1.0].
+        CompactSPG(float p_Alpha, Comparator const& p_Comparator = Comparator())
+            : m_Alpha(-std::log(p_Alpha)),
+            m_AlphaRatio(p_Alpha),
+            m_Root(0),
+            m_Free(0),
+            m_Size(0),
+            m_MaxSize(0),
+            m_Rebuilds(0),
+            m_Comparator(p_Comparator)
+        {
+            assert(p_Alpha >= 0.5f && p_Alpha <= 1.0f);
+        }
+
+        /// Returns the number of keys.
+        std::size_t size() const { return m_Size; }
+
+        /// Returns true if the tree is empty.
+        bool empty() const { return m_Size == 0; }
+
+        /// Returns the alpha of the tree.
+        float alpha() const { return m_AlphaRatio; }
+
+        /// Returns the number of subtree rebuilds since construction.
+        std::size_t rebuild_count() const { return m_Rebuilds; }
+
+        /// Returns the number of nodes the arena holds without growing.
+        std::size_t capacity() const { return m_Nodes.capacity(); }
+
+        /// Makes room for p_N nodes, the arena then grows without copies.
+        void reserve(std::size_t p_N)
+        {
+            m_Nodes.reserve(p_N);
+        }
+
+        /// Removes every key and frees the arena.
+        void clear()
+        {
+            std::vector<node_type>().swap(m_Nodes);
+            std::vector<index_type>().swap(m_Buffer);
+            m_Root = 0;
+            m_Free = 0;
+            m_Size = 0;
+            m_MaxSize = 0;
+        }
+
+        /// Inserts p_Key, returns true if it was not in the tree.
+        bool insert(value_type const& p_Key)
+        {
+            return Insert(p_Key);
+        }
+
+        bool insert(value_type&& p_Key)
+        {
+            return Insert(std::move(p_Key));
+        }
+
+        /// Erases p_Key, returns the number of keys erased.
+        /// The whole tree is rebuilt once its size drops under alpha * max size.
+        std::size_t erase(value_type const& p_Key)
+        {
+            /// We keep the adress of the link to the current node, the arena
+            /// does not move while erasing.
+            index_type* l_Link = &m_Root;
+
+            while (*l_Link)
+            {
+                node_type& l_Node = GetNode(*l_Link);
+                if (m_Comparator(p_Key, l_Node.Key))
+                    l_Link = &l_Node.Left;
+                else if (m_Comparator(l_Node.Key, p_Key))
+                    l_Link = &l_Node.Right;
+                else
+                    break;
+            }
+
+            if (!*l_Link)
+                return 0;
+
+            index_type l_Index = *l_Link;
+            node_type& l_Node = GetNode(l_Index);
+
+            if (!l_Node.Left)
+                *l_Link = l_Node.Right;
+            else if (!l_Node.Right)
+                *l_Link = l_Node.Left;
+            else
+            {
+                /// The node has two children, it takes the key of its
+                /// successor, which is unlinked instead.
+                index_type* l_MinLink = &l_Node.Right;
+                while (GetNode(*l_MinLink).Left)
+                    l_MinLink = &GetNode(*l_MinLink).Left;
+
+                l_Index = *l_MinLink;
+                *l_MinLink = GetNode(l_Index).Right;
+                l_Node.Key = std::move(GetNode(l_Index).Key);
+            }
+
+            FreeNode(l_Index);
+            --m_Size;
+
+            /// Once the tree got too small compared to its maximum size,
+            /// we rebuild it entirely (Galperin/Rivest deletion).
+            if (m_Size < m_AlphaRatio * m_MaxSize)
+            {
+                /// The buffer still holds the last insertion, the nodes
+                /// would be appended after it.
+                m_Buffer.clear();
+                if (m_Root)
+                    m_Root = RebuildTree(m_Root, m_Size);
+
+                m_MaxSize = m_Size;
+            }
+
+            return 1;
+        }
+
+        /// Returns the iterator on the first key not less than p_Key.
+        const_iterator lower_bound(value_type const& p_Key) const
+        {
+            index_type l_Bound = 0;
+
+            for (index_type l_Index = m_Root; l_Index;)
+            {
+                node_type const& l_Node = GetNode(l_Index);
+                if (m_Comparator(l_Node.Key, p_Key))
+                    l_Index = l_Node.Right;
+                else
+                {
+                    l_Bound = l_Index;
+                    l_Index = l_Node.Left;
+                }
+            }
+
+            return const_iterator(this, l_Bound, false);
+        }
+
+        /// Returns the iterator on p_Key, end() if it is not in the tree.
+        const_iterator find(value_type const& p_Key) const
+        {
+            return const_iterator(this, FindIndex(p_Key), false);
+        }
+
+        /// Returns true if p_Key is in the tree.
+        bool contains(value_type const& p_Key) const
+        {
+            return FindIndex(p_Key) != 0;
+        }
+
+        /// Calls p_Function on every key in [p_Lo, p_Hi], in order.
+        template <typename Function>
+        void for_each_in_range(value_type const& p_Lo, value_type const& p_Hi, Function p_Function) const
+        {
+            ForEachInRange(m_Root, p_Lo, p_Hi, p_Function);
+        }
+
+        /// Moves the nodes to a new arena of the exact size, in the order of
+        /// the keys, and rebuilds the tree perfectly balanced. The erased
+        /// nodes are released and the in-order walks become sequential.
+        void shrink_to_fit()
+        {
+            m_Buffer.clear();
+            m_Buffer.reserve(m_Size);
+            Flatten(m_Root);
+
+            std::vector<node_type> l_Nodes;
+            l_Nodes.reserve(m_Size);
+            for (index_type l_Index : m_Buffer)
+                l_Nodes.emplace_back(std::move(GetNode(l_Index).Key));
+
+            m_Nodes.swap(l_Nodes);
+            std::vector<index_type>().swap(m_Buffer);
+            m_Free = 0;
+            m_MaxSize = m_Size;
+
+            /// The index of the i-th key is now i + 1.
+            m_Root = LinkSequence(1, m_Size);
+        }
+
+        ////////////////////////
+        ///     Iterators.
+        ////////////////////////
+
+        const_iterator begin() const
+        {
+            const_iterator l_It(this, 0, true);
+            if (m_Root)
+                l_It.m_Node = l_It.DescendLeft(m_Root);
+            return l_It;
+        }
+
+        const_iterator end() const
+        {
+            return const_iterator(this, 0, true);
+        }
+
+        const_iterator cbegin() const
+        {
+            return begin();
+        }
+
+        const_iterator cend() const
+        {
+            return end();
+        }
+
+    private:
+        /// The node of p_Index is stored at p_Index - 1, 0 being null.
+        node_type& GetNode(index_type p_Index)
+        {
+            return m_Nodes[p_Index - 1];
+        }
+
+        node_type const& GetNode(index_type p_Index) const
+        {
+            return m_Nodes[p_Index - 1];
+        }
+
+        /// Returns the alpha height of a tree of p_N nodes.
+        float HeightAlpha(std::size_t p_N) const
+        {
+            return std::log(p_N) / m_Alpha;
+        }
+
+        /// Returns the index of p_Key, 0 if it is not in the tree.
+        index_type FindIndex(value_type const& p_Key) const
+        {
+            index_type l_Index = m_Root;
+
+            while (l_Index)
+            {
+                node_type const& l_Node = GetNode(l_Index);
+                if (m_Comparator(p_Key, l_Node.Key))
+                    l_Index = l_Node.Left;
+                else if (m_Comparator(l_Node.Key, p_Key))
+                    l_Index = l_Node.Right;
+                else
+                    return l_Index;
+            }
+
+            return 0;
+        }
+
+        /// Takes a free node or appends one to the arena, returns its index.
+        template <typename Key>
+        index_type NewNode(Key&& p_Key)
+        {
+            if (m_Free)
+            {
+                index_type l_Index = m_Free;
+                node_type& l_Node = GetNode(l_Index);
+
+                l_Node.Key = std::forward<Key>(p_Key);
+                m_Free = l_Node.Left;
+                l_Node.Left = 0;
+                l_Node.Right = 0;
+
+                return l_Index;
+            }
+
+            if (m_Nodes.size() >= static_cast<index_type>(-1))
+                throw std::length_error("CompactSPG: too many nodes");
+
+            m_Nodes.emplace_back(std::forward<Key>(p_Key));
+            return static_cast<index_type>(m_Nodes.size());
+        }
+
+        /// Puts p_Index in the free list, which is linked by Left.
+        void FreeNode(index_type p_Index)
+        {
+            GetNode(p_Index).Left = m_Free;
+            m_Free = p_Index;
+        }
+
+        template <typename Key>
+        bool Insert(Key&& p_Key)
+        {
+            if (!m_Root)
+            {
+                m_Root = NewNode(std::forward<Key>(p_Key));
+                m_Size = 1;
+                m_MaxSize = std::max<std::size_t>(m_MaxSize, 1);
+                return true;
+            }
+
+            /// We keep the parents on the way down, they are needed to
+            /// find the scapegoat. The buffer is reused between insertions.
+            std::vector<index_type>& l_Parents = m_Buffer;
+            l_Parents.clear();
+
+            index_type l_Index = m_Root;
+            bool l_Left = false;
+
+            while (l_Index)
+            {
+                node_type const& l_Node = GetNode(l_Index);
+                l_Parents.push_back(l_Index);
+
+                if (m_Comparator(p_Key, l_Node.Key))
+                {
+                    l_Left = true;
+                    l_Index = l_Node.Left;
+                }
+                else if (m_Comparator(l_Node.Key, p_Key))
+                {
+                    l_Left = false;
+                    l_Index = l_Node.Right;
+                }
+                else
+                    return false;
+            }
+
+            /// The arena may move, the parent is looked up after.
+            index_type l_NewNode = NewNode(std::forward<Key>(p_Key));
+            if (l_Left)
+                GetNode(l_Parents.back()).Left = l_NewNode;
+            else
+                GetNode(l_Parents.back()).Right = l_NewNode;
+
+            ++m_Size;
+            m_MaxSize = std::max(m_MaxSize, m_Size);
+
+            /// If the height is greater than the alpha height, we rebalance the tree.
+            std::size_t l_Height = l_Parents.size();
+            if (l_Height > HeightAlpha(m_Size))
+            {
+                /// We look for the deepest unbalanced ancestor, only the
+                /// sibling subtrees are counted.
+                std::size_t l_SubTreeSize = 1;
+                std::size_t l_Ind = l_Parents.size();
+                index_type l_Child = l_NewNode;
+                index_type l_ScapeGoat = 0;
+
+                for (std::size_t h = 0; h <= HeightAlpha(l_SubTreeSize); ++h)
+                {
+                    l_ScapeGoat = l_Parents[--l_Ind];
+
+                    node_type const& l_Node = GetNode(l_ScapeGoat);
+                    l_SubTreeSize += 1 + Size(l_Node.Left == l_Child ? l_Node.Right : l_Node.Left);
+                    l_Child = l_ScapeGoat;
+                }
+
+                index_type l_NewRoot = RebuildTree(l_ScapeGoat, l_SubTreeSize);
+
+                /// We link back the new subtree to the current tree.
+                if (l_Ind)
+                {
+                    node_type& l_Parent = GetNode(l_Parents[l_Ind - 1]);
+                    if (l_Parent.Left == l_ScapeGoat)
+                        l_Parent.Left = l_NewRoot;
+                    else
+                        l_Parent.Right = l_NewRoot;
+                }
+                else
+                {
+                    /// The whole tree has been rebuilt, so we reset the watermark.
+                    m_Root = l_NewRoot;
+                    m_MaxSize = m_Size;
+                }
+            }
+
+            return true;
+        }
+
+        /// Returns the number of nodes in the subtree of p_Index.
+        std::size_t Size(index_type p_Index) const
+        {
+            if (!p_Index)
+                return 0;
+
+            node_type const& l_Node = GetNode(p_Index);
+            return 1 + Size(l_Node.Left) + Size(l_Node.Right);
+        }
+
+        /// Appends the nodes of the subtree of p_Index to m_Buffer, in order.
+        void Flatten(index_type p_Index)
+        {
+            while (p_Index)
+            {
+                node_type const& l_Node = GetNode(p_Index);
+                Flatten(l_Node.Left);
+                m_Buffer.push_back(p_Index);
+                p_Index = l_Node.Right;
+            }
+        }
+
+        /// Rebuilds perfectly balanced the subtree of p_Root and returns its new root.
+        /// @p_N : The size of the subtree.
+        index_type RebuildTree(index_type p_Root, std::size_t p_N)
+        {
+            ++m_Rebuilds;
+
+            /// m_Buffer may hold the parents of the insertion, the nodes go after.
+            std::size_t l_Offset = m_Buffer.size();
+            m_Buffer.reserve(l_Offset + p_N);
+            Flatten(p_Root);
+
+            return LinkBalanced(m_Buffer.data() + l_Offset, p_N);
+        }
+
+        /// Links p_N nodes given in order and returns the root.
+        index_type LinkBalanced(index_type const* p_Nodes, std::size_t p_N)
+        {
+            if (!p_N)
+                return 0;
+
+            std::size_t l_Middle = p_N / 2;
+            node_type& l_Node = GetNode(p_Nodes[l_Middle]);
+
+            l_Node.Left = LinkBalanced(p_Nodes, l_Middle);
+            l_Node.Right = LinkBalanced(p_Nodes + l_Middle + 1, p_N - l_Middle - 1);
+
+            return p_Nodes[l_Middle];
+        }
+
+        /// Links the nodes of the indices [p_First, p_Last], which are in order.
+        index_type LinkSequence(std::size_t p_First, std::size_t p_Last)
+        {
+            if (p_First > p_Last)
+                return 0;
+
+            std::size_t l_Middle = p_First + (p_Last - p_First) / 2;
+            node_type& l_Node = GetNode(static_cast<index_type>(l_Middle));
+
+            l_Node.Left = LinkSequence(p_First, l_Middle - 1);
+            l_Node.Right = LinkSequence(l_Middle + 1, p_Last);
+
+            return static_cast<index_type>(l_Middle);
+        }
+
+        template <typename Function>
+        void ForEachInRange(index_type p_Index, value_type const& p_Lo, value_type const& p_Hi, Function& p_Function) const
+        {
+            while (p_Index)
+            {
+                node_type const& l_Node = GetNode(p_Index);
+                if (m_Comparator(l_Node.Key, p_Lo))
+                    p_Index = l_Node.Right;
+                else if (m_Comparator(p_Hi, l_Node.Key))
+                    p_Index = l_Node.Left;
+                else
+                {
+                    ForEachInRange(l_Node.Left, p_Lo, p_Hi, p_Function);
+                    p_Function(l_Node.Key);
+                    p_Index = l_Node.Right;
+                }
+            }
+        }
+
+        float                       m_Alpha;        ///< -log(alpha), see HeightAlpha.
+        float                       m_AlphaRatio;   ///< The alpha of the tree.
+        std::vector<node_type>      m_Nodes;        ///< The arena, the index i is at i - 1.
+        std::vector<index_type>     m_Buffer;       ///< Parents of the insertion, then the rebuilt nodes.
+        index_type                  m_Root;
+        index_type                  m_Free;         ///< Head of the free nodes, linked by Left.
+        std::size_t                 m_Size;
+        std::size_t                 m_MaxSize;
+        std::size_t                 m_Rebuilds;
+        Comparator                  m_Comparator;
+};
@@ -0,0 +1,399 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "spg.hpp"
+
+/// Thread safe set splitting the key space into ranges, each range (shard)
+/// being a ScapeGoat tree with its own reader-writer lock. Point operations
+/// on different shards run in parallel.
+///
+/// The shards start as one and are split in two once they get bigger than
+/// twice the average shard size (and p_MinShardSize); past p_Shards shards,
+/// the two smallest neighbours are merged back. Both cost O(n / p_Shards)
+/// with the linear range construction of SPG, and only lock the shards they
+/// rebuild while they copy the keys.
+///
+/// The table of the shards is guarded by a lock striped by thread: a point
+/// operation shares the stripe of its thread, on its own cache line, just
+/// long enough to find its shard, then only locks that shard. Changing the
+/// table takes every stripe, only to swap the shards. A shard replaced by a
+/// split or a merge is retired, the operations which were waiting on it
+/// look their shard up again.
+///
+/// Ordered traversals visit the shards one after the other, each shard is
+/// consistent but writers may change the shards not visited yet. The keys
+/// of a shard are copied out and the callback runs without any lock held,
+/// so it may write to the set.
+template <typename T,
+          typename Comparator = std::less<T>,
+          typename Alloc = std::allocator<T>,
+          typename... Options>
+class ConcurrentSPG
+{
+    using tree_type = SPG<T, Comparator, Alloc, Options...>;
+
+    struct Shard
+    {
+        mutable std::shared_mutex   Lock;
+        std::unique_ptr<tree_type>  Tree;
+        bool                        Retired;    ///< Replaced in the table, guarded by Lock.
+        std::size_t                 SplitAt;    ///< Size under which this shard can't be split, guarded by Lock.
+        std::atomic<std::size_t>    Keys;       ///< Keys of Tree, every copy with spg_multiset, read without Lock by the merges.
+
+        /// The keys are sorted, the copies of a key are kept with spg_multiset.
+        template <typename ForwardIt>
+        Shard(ForwardIt p_First, ForwardIt p_Last, float p_Alpha)
+            : Tree(new tree_type(p_First, p_Last, p_Alpha)),
+            Retired(false),
+            SplitAt(0),
+            Keys(static_cast<std::size_t>(std::distance(p_First, p_Last)))
+        {
+        }
+    };
+
+    using shard_ptr = std::shared_ptr<Shard>;
+
+    /// A shard and its lock, the shard outlives the lock.
+    template <typename Lock>
+    struct LockedShard
+    {
+        shard_ptr   Ptr;
+        Lock        Guard;
+    };
+
+    /// One stripe of the table lock, with the size changes of its threads.
+    struct alignas(64) Stripe
+    {
+        std::shared_mutex               Lock;
+        std::atomic<std::ptrdiff_t>     Size{0};
+    };
+
+    /// Takes every stripe: the table of the shards then belongs to us.
+    class ExclusiveTable
+    {
+        public:
+            explicit ExclusiveTable(ConcurrentSPG const& p_Set)
+                : m_Set(p_Set)
+            {
+                for (std::size_t i = 0; i < m_Set.m_StripeCount; ++i)
+                    m_Set.m_Stripes[i].Lock.lock();
+            }
+
+            ExclusiveTable(ExclusiveTable const&) = delete;
+            ExclusiveTable& operator=(ExclusiveTable const&) = delete;
+
+            ~ExclusiveTable()
+            {
+                for (std::size_t i = m_Set.m_StripeCount; i-- > 0;)
+                    m_Set.m_Stripes[i].Lock.unlock();
+            }
+
+        private:
+            ConcurrentSPG const& m_Set;
+    };
+
+    public:
+        using value_type = T;
+
+        /// Constructs an empty set.
+        /// @p_Shards : The maximum number of shards, typically the number of cores.
+        /// @p_Alpha : unbalance factor of the trees, MUST be in the interval [0.5, 1.0].
+        /// @p_MinShardSize : The size under which a shard is never split.
+        ConcurrentSPG(std::size_t p_Shards, float p_Alpha, std::size_t p_MinShardSize = 4096)
+            : m_StripeCount(std::max<std::size_t>({p_Shards, std::thread::hardware_concurrency(), 1})),
+            m_Stripes(new Stripe[m_StripeCount]),
+            m_MaxShards(std::max<std::size_t>(p_Shards, 1)),
+            m_MinShardSize(p_MinShardSize),
+            m_Alpha(p_Alpha),
+            m_SplitAt(p_MinShardSize)
+        {
+            m_Shards.push_back(std::make_shared<Shard>(static_cast<T const*>(nullptr), static_cast<T const*>(nullptr), m_Alpha));
+        }
+
+        /// Returns the number of keys, every copy with spg_multiset.
+        std::size_t size() const
+        {
+            std::ptrdiff_t l_Size = 0;
+            for (std::size_t i = 0; i < m_StripeCount; ++i)
+                l_Size += m_Stripes[i].Size.load(std::memory_order_relaxed);
+
+            /// An erase may be counted before the insertion it follows.
+            return l_Size > 0 ? static_cast<std::size_t>(l_Size) : 0;
+        }
+
+        /// Returns true if the set is empty.
+        bool empty() const { return size() == 0; }
+
+        /// Returns the current number of shards.
+        std::size_t shard_count() const
+        {
+            std::shared_lock<std::shared_mutex> l_Table(ThreadStripe().Lock);
+            return m_Shards.size();
+        }
+
+        /// Inserts p_Key, returns true if the key was not in the set.
+        bool insert(value_type const& p_Key)
+        {
+            shard_ptr l_Split;
+            bool l_Inserted;
+
+            {
+                auto l_Shard = LockShardOf<std::unique_lock<std::shared_mutex>>(p_Key);
+                l_Inserted = l_Shard.Ptr->Tree->insert(p_Key);
+
+                if (l_Inserted)
+                {
+                    ThreadStripe().Size.fetch_add(1, std::memory_order_relaxed);
+
+                    std::size_t l_Keys = l_Shard.Ptr->Keys.load(std::memory_order_relaxed) + 1;
+                    l_Shard.Ptr->Keys.store(l_Keys, std::memory_order_relaxed);
+                    if (l_Keys > std::max(m_SplitAt.load(std::memory_order_relaxed), l_Shard.Ptr->SplitAt))
+                        l_Split = l_Shard.Ptr;
+                }
+            }
+
+            /// The shard lock is released, the split takes it again.
+            if (l_Split)
+                Split(l_Split);
+
+            return l_Inserted;
+        }
+
+        /// Erases p_Key, returns the number of keys erased.
+        std::size_t erase(value_type const& p_Key)
+        {
+            auto l_Shard = LockShardOf<std::unique_lock<std::shared_mutex>>(p_Key);
+            std::size_t l_Erased = l_Shard.Ptr->Tree->erase(p_Key);
+
+            if (l_Erased)
+            {
+                ThreadStripe().Size.fetch_sub(static_cast<std::ptrdiff_t>(l_Erased), std::memory_order_relaxed);
+                l_Shard.Ptr->Keys.fetch_sub(l_Erased, std::memory_order_relaxed);
+            }
+
+            return l_Erased;
+        }
+
+        /// Returns true if p_Key is in the set.
+        bool contains(value_type const& p_Key) const
+        {
+            auto l_Shard = LockShardOf<std::shared_lock<std::shared_mutex>>(p_Key);
+            return l_Shard.Ptr->Tree->contains(p_Key);
+        }
+
+        /// Calls p_Function on every key, in order.
+        template <typename Function>
+        void for_each(Function p_Function) const
+        {
+            std::vector<value_type> l_Keys;
+            for (std::optional<value_type> l_Next = CopyShard(nullptr, nullptr, l_Keys);;
+                 l_Next = CopyShard(&*l_Next, nullptr, l_Keys))
+            {
+                for (auto const& l_Key : l_Keys)
+                    p_Function(l_Key);
+
+                if (!l_Next)
+                    return;
+            }
+        }
+
+        /// Calls p_Function on every key in [p_Lo, p_Hi], in order.
+        /// Only the shards overlapping the range are visited.
+        template <typename Function>
+        void for_each_in_range(value_type const& p_Lo, value_type const& p_Hi, Function p_Function) const
+        {
+            if (m_Comparator(p_Hi, p_Lo))
+                return;
+
+            std::vector<value_type> l_Keys;
+            for (std::optional<value_type> l_Next = CopyShard(&p_Lo, &p_Hi, l_Keys);;
+                 l_Next = CopyShard(&*l_Next, &p_Hi, l_Keys))
+            {
+                for (auto const& l_Key : l_Keys)
+                    p_Function(l_Key);
+
+                if (!l_Next || m_Comparator(p_Hi, *l_Next))
+                    return;
+            }
+        }
+
+    private:
+        /// Returns the stripe of the table lock of the calling thread.
+        Stripe& ThreadStripe() const
+        {
+            static std::atomic<std::size_t> s_Threads(0);
+            thread_local std::size_t t_Stripe = s_Threads.fetch_add(1, std::memory_order_relaxed);
+            return m_Stripes[t_Stripe % m_StripeCount];
+        }
+
+        /// Returns the index of the shard holding the range of p_Key.
+        /// The table lock must be held.
+        std::size_t ShardOf(value_type const& p_Key) const
+        {
+            return std::upper_bound(m_Bounds.begin(), m_Bounds.end(), p_Key, m_Comparator) - m_Bounds.begin();
+        }
+
+        /// Returns the shard holding the range of p_Key, locked with a Lock.
+        /// The table is only held to find the shard, never while waiting
+        /// for it: a split holds the shard when it takes the table.
+        template <typename Lock>
+        LockedShard<Lock> LockShardOf(value_type const& p_Key) const
+        {
+            for (;;)
+            {
+                LockedShard<Lock> l_Shard;
+                {
+                    std::shared_lock<std::shared_mutex> l_Table(ThreadStripe().Lock);
+                    l_Shard.Ptr = m_Shards[ShardOf(p_Key)];
+                }
+
+                l_Shard.Guard = Lock(l_Shard.Ptr->Lock);
+                if (!l_Shard.Ptr->Retired)
+                    return l_Shard;
+            }
+        }
+
+        /// Copies into p_Keys the keys of the shard holding p_Lo, from p_Lo to
+        /// p_Hi. A null p_Lo stands for the first shard, a null p_Hi for no limit.
+        /// Returns the first key of the next shard, none for the last one: the
+        /// traversal goes on from there even if the shards changed meanwhile.
+        std::optional<value_type> CopyShard(value_type const* p_Lo, value_type const* p_Hi,
+                                            std::vector<value_type>& p_Keys) const
+        {
+            for (;;)
+            {
+                shard_ptr l_Shard;
+                std::optional<value_type> l_Next;
+                {
+                    std::shared_lock<std::shared_mutex> l_Table(ThreadStripe().Lock);
+                    std::size_t l_Index = p_Lo ? ShardOf(*p_Lo) : 0;
+                    l_Shard = m_Shards[l_Index];
+                    if (l_Index != m_Bounds.size())
+                        l_Next = m_Bounds[l_Index];
+                }
+
+                /// The range of a shard never changes, it is retired instead.
+                std::shared_lock<std::shared_mutex> l_Lock(l_Shard->Lock);
+                if (l_Shard->Retired)
+                    continue;
+
+                tree_type const& l_Tree = *l_Shard->Tree;
+                p_Keys.assign(p_Lo ? l_Tree.lower_bound(*p_Lo) : l_Tree.cbegin(),
+                              p_Hi ? l_Tree.upper_bound(*p_Hi) : l_Tree.cend());
+                return l_Next;
+            }
+        }
+
+        /// Returns the size over which a shard is split.
+        std::size_t SplitThreshold() const
+        {
+            return std::max(m_MinShardSize, 2 * size() / m_MaxShards);
+        }
+
+        /// Splits p_Shard in two halves, then merges the two smallest
+        /// neighbours if there are too many shards. The copies of a key
+        /// stay in the same half: the halves are cut before the copies of
+        /// the median key, or after them if they start the shard. A shard
+        /// holding the copies of a single key can't be split, it is not
+        /// tried again before it doubles.
+        void Split(shard_ptr const& p_Shard)
+        {
+            std::lock_guard<std::mutex> l_Reshape(m_Reshape);
+            m_SplitAt.store(SplitThreshold(), std::memory_order_relaxed);
+
+            {
+                std::unique_lock<std::shared_mutex> l_Lock(p_Shard->Lock);
+
+                /// Another thread may have split it meanwhile.
+                std::size_t l_Size = p_Shard->Keys.load(std::memory_order_relaxed);
+                if (p_Shard->Retired || l_Size <= std::max(m_SplitAt.load(std::memory_order_relaxed), p_Shard->SplitAt))
+                    return;
+
+                tree_type const& l_Tree = *p_Shard->Tree;
+                std::vector<value_type> l_Keys(l_Tree.copies_begin(), l_Tree.copies_end());
+                value_type const& l_Median = l_Keys[l_Keys.size() / 2];
+                auto l_Middle = std::lower_bound(l_Keys.begin(), l_Keys.end(), l_Median, m_Comparator);
+                if (l_Middle == l_Keys.begin())
+                    l_Middle = std::upper_bound(l_Keys.begin(), l_Keys.end(), l_Median, m_Comparator);
+
+                if (l_Middle == l_Keys.end())
+                {
+                    p_Shard->SplitAt = 2 * l_Size;
+                    return;
+                }
+
+                shard_ptr l_Left = std::make_shared<Shard>(l_Keys.begin(), l_Middle, m_Alpha);
+                shard_ptr l_Right = std::make_shared<Shard>(l_Middle, l_Keys.end(), m_Alpha);
+
+                ExclusiveTable l_Table(*this);
+                std::size_t l_Index = std::find(m_Shards.begin(), m_Shards.end(), p_Shard) - m_Shards.begin();
+
+                m_Shards.reserve(m_Shards.size() + 1);
+                m_Bounds.insert(m_Bounds.begin() + l_Index, *l_Middle);
+                m_Shards[l_Index] = std::move(l_Left);
+                m_Shards.insert(m_Shards.begin() + l_Index + 1, std::move(l_Right));
+                p_Shard->Retired = true;
+            }
+
+            if (m_Shards.size() > m_MaxShards)
+                MergeSmallestNeighbours();
+        }
+
+        /// Merges the two neighbour shards having the fewest keys.
+        /// m_Reshape must be held, the table can then be read without its lock.
+        void MergeSmallestNeighbours()
+        {
+            std::size_t l_Best = 0;
+            std::size_t l_BestSize = static_cast<std::size_t>(-1);
+
+            for (std::size_t i = 0; i + 1 < m_Shards.size(); ++i)
+            {
+                std::size_t l_Size = m_Shards[i]->Keys.load(std::memory_order_relaxed) +
+                                     m_Shards[i + 1]->Keys.load(std::memory_order_relaxed);
+                if (l_Size < l_BestSize)
+                {
+                    l_Best = i;
+                    l_BestSize = l_Size;
+                }
+            }
+
+            shard_ptr l_Left = m_Shards[l_Best];
+            shard_ptr l_Right = m_Shards[l_Best + 1];
+            std::unique_lock<std::shared_mutex> l_LeftLock(l_Left->Lock);
+            std::unique_lock<std::shared_mutex> l_RightLock(l_Right->Lock);
+
+            /// The ranges are ordered, so are the concatenated keys.
+            std::vector<value_type> l_Keys;
+            l_Keys.reserve(l_BestSize);
+            l_Keys.insert(l_Keys.end(), l_Left->Tree->copies_begin(), l_Left->Tree->copies_end());
+            l_Keys.insert(l_Keys.end(), l_Right->Tree->copies_begin(), l_Right->Tree->copies_end());
+
+            shard_ptr l_Merged = std::make_shared<Shard>(l_Keys.begin(), l_Keys.end(), m_Alpha);
+
+            ExclusiveTable l_Table(*this);
+            m_Shards[l_Best] = std::move(l_Merged);
+            m_Shards.erase(m_Shards.begin() + l_Best + 1);
+            m_Bounds.erase(m_Bounds.begin() + l_Best);
+            l_Left->Retired = true;
+            l_Right->Retired = true;
+        }
+
+        std::size_t                 m_StripeCount;  ///< Stripes of the table lock.
+        std::unique_ptr<Stripe[]>   m_Stripes;      ///< Shared by the operations, all taken to change the table.
+        std::mutex                  m_Reshape;      ///< Held by the splits and merges, one at a time.
+        std::vector<shard_ptr>      m_Shards;       ///< Shards, ordered by range.
+        std::vector<value_type>     m_Bounds;       ///< The shard i holds the keys in [m_Bounds[i - 1], m_Bounds[i]).
+        Comparator                  m_Comparator;
+        std::size_t                 m_MaxShards;    ///< Maximum number of shards.
+        std::size_t                 m_MinShardSize; ///< Size under which a shard is never split.
+        float                       m_Alpha;        ///< Alpha of the trees.
+        std::atomic<std::size_t>    m_SplitAt;      ///< SplitThreshold at the last split, checked by the insertions.
+};
@@ -0,0 +1,580 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace details
+{
+    /// Goes up from an Eytzinger index to the ancestor where the search
+    /// went left for the last time: removes the trailing ones and the zero
+    /// above them. Returns 0 if the search never went left.
+    inline std::size_t EytzingerUp(std::size_t p_K)
+    {
+#if defined(__GNUC__)
+        return p_K >> __builtin_ffsll(static_cast<long long>(~p_K));
+#else
+        while (p_K & 1)
+            p_K >>= 1;
+        return p_K >> 1;
+#endif
+    }
+
+    /// Goes up from an Eytzinger index to the ancestor where the search
+    /// went right for the last time, 0 if it never went right.
+    inline std::size_t EytzingerUpLeft(std::size_t p_K)
+    {
+        while (p_K && !(p_K & 1))
+            p_K >>= 1;
+        return p_K >> 1;
+    }
+
+    inline void Prefetch(void const* p_Adress)
+    {
+#if defined(__GNUC__)
+        __builtin_prefetch(p_Adress);
+#else
+        (void)p_Adress;
+#endif
+    }
+
+    /// Batched descents of FrozenSPG, Lanes keys go down the tree together
+    /// so their cache misses overlap. Returns the number of keys processed,
+    /// the indices are the ones before going up with EytzingerUp.
+    template <typename T, typename Comparator>
+    struct FrozenBatch
+    {
+        static const std::size_t Lanes = 8;
+
+        static std::size_t Run(T const* p_Keys, std::size_t p_N, T const* p_Tree, std::size_t p_Size,
+                               std::size_t p_Levels, Comparator const& p_Comp, std::size_t* p_Out)
+        {
+            std::size_t i = 0;
+            for (; i + Lanes <= p_N; i += Lanes)
+            {
+                std::size_t l_K[Lanes];
+                for (std::size_t l = 0; l < Lanes; ++l)
+                    l_K[l] = 1;
+
+                /// The first levels are complete, no lane can get out of the tree.
+                for (std::size_t l_Level = 1; l_Level < p_Levels; ++l_Level)
+                    for (std::size_t l = 0; l < Lanes; ++l)
+                        l_K[l] = 2 * l_K[l] + p_Comp(p_Tree[l_K[l]], p_Keys[i + l]);
+
+                /// The last level may be partial.
+                for (std::size_t l = 0; l < Lanes; ++l)
+                {
+                    std::size_t l_Next = 2 * l_K[l] + p_Comp(p_Tree[std::min(l_K[l], p_Size)], p_Keys[i + l]);
+                    p_Out[i + l] = l_K[l] <= p_Size ? l_Next : l_K[l];
+                }
+            }
+
+            return i;
+        }
+    };
+
+#if defined(__AVX2__)
+    /// AVX2 operations on 32 bits integer keys.
+    struct AVX2Int32
+    {
+        using key_type = std::int32_t;
+        using vector_type = __m256i;
+
+        static __m256i Load(std::int32_t const* p_Keys)
+        {
+            return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p_Keys));
+        }
+
+        static __m256i Gather(std::int32_t const* p_Tree, __m256i p_Indices)
+        {
+            return _mm256_i32gather_epi32(reinterpret_cast<int const*>(p_Tree), p_Indices, 4);
+        }
+
+        /// All ones where p_Node < p_Key.
+        static __m256i Less(__m256i p_Node, __m256i p_Key)
+        {
+            return _mm256_cmpgt_epi32(p_Key, p_Node);
+        }
+    };
+
+    /// AVX2 operations on float keys.
+    struct AVX2Float
+    {
+        using key_type = float;
+        using vector_type = __m256;
+
+        static __m256 Load(float const* p_Keys)
+        {
+            return _mm256_loadu_ps(p_Keys);
+        }
+
+        static __m256 Gather(float const* p_Tree, __m256i p_Indices)
+        {
+            return _mm256_i32gather_ps(p_Tree, p_Indices, 4);
+        }
+
+        static __m256i Less(__m256 p_Node, __m256 p_Key)
+        {
+            return _mm256_castps_si256(_mm256_cmp_ps(p_Node, p_Key, _CMP_LT_OQ));
+        }
+    };
+
+    /// AVX2 operations on 64 bits integer keys.
+    struct AVX2Int64
+    {
+        using key_type = std::int64_t;
+        using vector_type = __m256i;
+
+        static __m256i Load(std::int64_t const* p_Keys)
+        {
+            return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p_Keys));
+        }
+
+        static __m256i Gather(std::int64_t const* p_Tree, __m256i p_Indices)
+        {
+            return _mm256_i64gather_epi64(reinterpret_cast<long long const*>(p_Tree), p_Indices, 8);
+        }
+
+        static __m256i Less(__m256i p_Node, __m256i p_Key)
+        {
+            return _mm256_cmpgt_epi64(p_Key, p_Node);
+        }
+    };
+
+    /// AVX2 operations on double keys.
+    struct AVX2Double
+    {
+        using key_type = double;
+        using vector_type = __m256d;
+
+        static __m256d Load(double const* p_Keys)
+        {
+            return _mm256_loadu_pd(p_Keys);
+        }
+
+        static __m256d Gather(double const* p_Tree, __m256i p_Indices)
+        {
+            return _mm256_i64gather_pd(p_Tree, p_Indices, 8);
+        }
+
+        static __m256i Less(__m256d p_Node, __m256d p_Key)
+        {
+            return _mm256_castpd_si256(_mm256_cmp_pd(p_Node, p_Key, _CMP_LT_OQ));
+        }
+    };
+
+    /// AVX2 descents of 8 keys at once, for 32 bits keys in their natural order.
+    template <typename Ops>
+    struct FrozenBatchAVX2
+    {
+        using T = typename Ops::key_type;
+
+        static const std::size_t Lanes = 8;
+
+        static std::size_t Run(T const* p_Keys, std::size_t p_N, T const* p_Tree, std::size_t p_Size,
+                               std::size_t p_Levels, std::less<T> const&, std::size_t* p_Out)
+        {
+            /// The indices are gathered as 32 bits integers.
+            if (p_Size >= (std::size_t(1) << 30))
+                return 0;
+
+            __m256i const l_One = _mm256_set1_epi32(1);
+            __m256i const l_Size = _mm256_set1_epi32(static_cast<int>(p_Size));
+
+            std::size_t i = 0;
+            for (; i + Lanes <= p_N; i += Lanes)
+            {
+                typename Ops::vector_type l_Keys = Ops::Load(p_Keys + i);
+                __m256i l_K = l_One;
+
+                /// The first levels are complete, no lane can get out of the tree.
+                for (std::size_t l_Level = 1; l_Level < p_Levels; ++l_Level)
+                {
+                    __m256i l_Less = Ops::Less(Ops::Gather(p_Tree, l_K), l_Keys);
+                    l_K = _mm256_sub_epi32(_mm256_slli_epi32(l_K, 1), l_Less);
+                }
+
+                /// Lanes already out of the tree keep their index.
+                __m256i l_Inside = _mm256_cmpgt_epi32(_mm256_add_epi32(l_Size, l_One), l_K);
+                __m256i l_Less = Ops::Less(Ops::Gather(p_Tree, _mm256_min_epi32(l_K, l_Size)), l_Keys);
+                __m256i l_Next = _mm256_sub_epi32(_mm256_slli_epi32(l_K, 1), l_Less);
+                l_K = _mm256_blendv_epi8(l_K, l_Next, l_Inside);
+
+                alignas(32) std::int32_t l_Result[Lanes];
+                _mm256_store_si256(reinterpret_cast<__m256i*>(l_Result), l_K);
+                for (std::size_t l = 0; l < Lanes; ++l)
+                    p_Out[i + l] = static_cast<std::size_t>(l_Result[l]);
+            }
+
+            return i;
+        }
+    };
+
+    /// AVX2 descents of 4 keys at once, for 64 bits keys in their natural
+    /// order: a vector holds 4 of them, and 4 indices of 64 bits.
+    template <typename Ops>
+    struct FrozenBatchAVX2Wide
+    {
+        using T = typename Ops::key_type;
+
+        static const std::size_t Lanes = 4;
+
+        static std::size_t Run(T const* p_Keys, std::size_t p_N, T const* p_Tree, std::size_t p_Size,
+                               std::size_t p_Levels, std::less<T> const&, std::size_t* p_Out)
+        {
+            __m256i const l_One = _mm256_set1_epi64x(1);
+            __m256i const l_Size = _mm256_set1_epi64x(static_cast<long long>(p_Size));
+
+            std::size_t i = 0;
+            for (; i + Lanes <= p_N; i += Lanes)
+            {
+                typename Ops::vector_type l_Keys = Ops::Load(p_Keys + i);
+                __m256i l_K = l_One;
+
+                /// The first levels are complete, no lane can get out of the tree.
+                for (std::size_t l_Level = 1; l_Level < p_Levels; ++l_Level)
+                {
+                    __m256i l_Less = Ops::Less(Ops::Gather(p_Tree, l_K), l_Keys);
+                    l_K = _mm256_sub_epi64(_mm256_slli_epi64(l_K, 1), l_Less);
+                }
+
+                /// Lanes already out of the tree keep their index, AVX2 has
+                /// no 64 bits minimum: the gather reads the last key instead.
+                __m256i l_Inside = _mm256_cmpgt_epi64(_mm256_add_epi64(l_Size, l_One), l_K);
+                __m256i l_Less = Ops::Less(Ops::Gather(p_Tree, _mm256_blendv_epi8(l_Size, l_K, l_Inside)), l_Keys);
+                __m256i l_Next = _mm256_sub_epi64(_mm256_slli_epi64(l_K, 1), l_Less);
+                l_K = _mm256_blendv_epi8(l_K, l_Next, l_Inside);
+
+                alignas(32) std::int64_t l_Result[Lanes];
+                _mm256_store_si256(reinterpret_cast<__m256i*>(l_Result), l_K);
+                for (std::size_t l = 0; l < Lanes; ++l)
+                    p_Out[i + l] = static_cast<std::size_t>(l_Result[l]);
+            }
+
+            return i;
+        }
+    };
+
+    template <>
+    struct FrozenBatch<std::int32_t, std::less<std::int32_t>> : FrozenBatchAVX2<AVX2Int32>
+    {
+    };
+
+    template <>
+    struct FrozenBatch<float, std::less<float>> : FrozenBatchAVX2<AVX2Float>
+    {
+    };
+
+    template <>
+    struct FrozenBatch<std::int64_t, std::less<std::int64_t>> : FrozenBatchAVX2Wide<AVX2Int64>
+    {
+    };
+
+    template <>
+    struct FrozenBatch<double, std::less<double>> : FrozenBatchAVX2Wide<AVX2Double>
+    {
+    };
+#endif
+}
+
+template <typename T, typename Comparator>
+class FrozenSPG;
+
+template <typename T, typename Comparator>
+class spg_frozen_iterator
+{
+    public:
+        using self_type = spg_frozen_iterator<T, Comparator>;
+        using value_type = T;
+        using reference = value_type const&;
+        using pointer = value_type const*;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::bidirectional_iterator_tag;
+
+        FrozenSPG<T, Comparator> const* m_Tree;
+        std::size_t m_Index; ///< Eytzinger index, 0 is the end.
+
+        spg_frozen_iterator()
+            : m_Tree(nullptr),
+            m_Index(0)
+        {
+        }
+
+        spg_frozen_iterator(FrozenSPG<T, Comparator> const* p_Tree, std::size_t p_Index)
+            : m_Tree(p_Tree),
+            m_Index(p_Index)
+        {
+        }
+
+        reference operator*() const
+        {
+            return m_Tree->m_Keys[m_Index];
+        }
+
+        pointer operator->() const
+        {
+            return &(operator*());
+        }
+
+        self_type& operator++()
+        {
+            std::size_t l_Size = m_Tree->size();
+
+            /// The successor is the leftmost node of the right subtree, or
+            /// the ancestor where we went left for the last time.
+            if (2 * m_Index + 1 <= l_Size)
+            {
+                m_Index = 2 * m_Index + 1;
+                while (2 * m_Index <= l_Size)
+                    m_Index = 2 * m_Index;
+            }
+            else
+                m_Index = details::EytzingerUp(m_Index);
+
+            return *this;
+        }
+
+        self_type operator++(int)
+        {
+            auto l_Tmp = *this;
+            operator++();
+            return l_Tmp;
+        }
+
+        self_type& operator--()
+        {
+            std::size_t l_Size = m_Tree->size();
+
+            /// The predecessor of the end is the rightmost node.
+            if (!m_Index || 2 * m_Index <= l_Size)
+            {
+                m_Index = m_Index ? 2 * m_Index : 1;
+                while (2 * m_Index + 1 <= l_Size)
+                    m_Index = 2 * m_Index + 1;
+            }
+            else
+                m_Index = details::EytzingerUpLeft(m_Index);
+
+            return *this;
+        }
+
+        self_type operator--(int)
+        {
+            auto l_Tmp = *this;
+            operator--();
+            return l_Tmp;
+        }
+
+        bool operator==(self_type const& p_Rhs) const
+        {
+            return m_Index == p_Rhs.m_Index;
+        }
+
+        bool operator!=(self_type const& p_Rhs) const
+        {
+            return !(operator==(p_Rhs));
+        }
+};
+
+/// Immutable snapshot of a ScapeGoat tree, made by SPG::freeze().
+/// The keys are stored contiguously in Eytzinger (BFS) order: the children
+/// of the index k are 2k and 2k + 1, the index 0 is unused. The searches
+/// are branchless and prefetch the nodes a few levels ahead, so a lookup
+/// costs about one cache miss every four levels instead of one per level.
+/// The keys are also kept in order, for the scans of for_each: the snapshot
+/// holds them twice. T must be default constructible.
+template <typename T,
+          typename Comparator = std::less<T>>
+class FrozenSPG
+{
+    friend class spg_frozen_iterator<T, Comparator>;
+
+    using batch_type = details::FrozenBatch<T, Comparator>;
+
+    /// Number of keys in a cache line, the prefetch goes that far below.
+    static const std::size_t PrefetchStride = sizeof (T) < 64 ? 64 / sizeof (T) : 1;
+
+    public:
+        using value_type = T;
+        using const_iterator = spg_frozen_iterator<T, Comparator>;
+        using iterator = const_iterator;
+
+        /// Constructs an empty snapshot.
+        FrozenSPG(Comparator const& p_Comparator = Comparator())
+            : m_Keys(1),
+            m_Size(0),
+            m_Levels(0),
+            m_Comparator(p_Comparator)
+        {
+        }
+
+        /// Constructs a snapshot from sorted keys without duplicates.
+        /// @p_First : The first key, read in order.
+        /// @p_N : The number of keys.
+        template <typename InputIt>
+        FrozenSPG(InputIt p_First, std::size_t p_N, Comparator const& p_Comparator = Comparator())
+            : m_Keys(p_N + 1),
+            m_Sorted(p_N),
+            m_Size(p_N),
+            m_Levels(0),
+            m_Comparator(p_Comparator)
+        {
+            std::copy_n(p_First, p_N, m_Sorted.begin());
+
+            auto l_Next = m_Sorted.cbegin();
+            Fill(l_Next, 1);
+
+            for (std::size_t l_N = m_Size; l_N; l_N >>= 1)
+                ++m_Levels;
+        }
+
+        /// Returns the number of keys.
+        std::size_t size() const { return m_Size; }
+
+        /// Returns true if the snapshot is empty.
+        bool empty() const { return m_Size == 0; }
+
+        /// Returns the iterator on the first key not less than p_Key.
+        const_iterator lower_bound(value_type const& p_Key) const
+        {
+            return const_iterator(this, LowerBoundIndex(p_Key));
+        }
+
+        /// Returns the iterator on p_Key, end() if it is not in the snapshot.
+        const_iterator find(value_type const& p_Key) const
+        {
+            std::size_t l_Index = LowerBoundIndex(p_Key);
+            return const_iterator(this, IsKey(l_Index, p_Key) ? l_Index : 0);
+        }
+
+        /// Returns true if p_Key is in the snapshot.
+        bool contains(value_type const& p_Key) const
+        {
+            return IsKey(LowerBoundIndex(p_Key), p_Key);
+        }
+
+        /// Looks for p_N keys at once, their descents are interleaved
+        /// (with AVX2 for 32 and 64 bits integers, floats and doubles).
+        /// @p_Keys : The keys.
+        /// @p_N : The number of keys.
+        /// @p_Out : The p_N results, the first key not less than each key.
+        void lower_bound_batch(value_type const* p_Keys, std::size_t p_N, const_iterator* p_Out) const
+        {
+            std::vector<std::size_t> l_Indices(p_N);
+            LowerBoundBatch(p_Keys, p_N, l_Indices.data());
+
+            for (std::size_t i = 0; i < p_N; ++i)
+                p_Out[i] = const_iterator(this, l_Indices[i]);
+        }
+
+        /// Says for p_N keys at once if they are in the snapshot.
+        /// @p_Keys : The keys.
+        /// @p_N : The number of keys.
+        /// @p_Out : The p_N results.
+        void contains_batch(value_type const* p_Keys, std::size_t p_N, bool* p_Out) const
+        {
+            std::vector<std::size_t> l_Indices(p_N);
+            LowerBoundBatch(p_Keys, p_N, l_Indices.data());
+
+            for (std::size_t i = 0; i < p_N; ++i)
+                p_Out[i] = IsKey(l_Indices[i], p_Keys[i]);
+        }
+
+        /// Calls p_Function on every key, in order. A linear scan of the
+        /// sorted keys, the iterators go up and down the Eytzinger order.
+        template <typename Function>
+        void for_each(Function p_Function) const
+        {
+            for (auto const& l_Key : m_Sorted)
+                p_Function(l_Key);
+        }
+
+        ////////////////////////
+        ///     Iterators.
+        ////////////////////////
+
+        const_iterator begin() const
+        {
+            std::size_t l_Index = m_Size ? 1 : 0;
+            while (l_Index && 2 * l_Index <= m_Size)
+                l_Index = 2 * l_Index;
+
+            return const_iterator(this, l_Index);
+        }
+
+        const_iterator end() const
+        {
+            return const_iterator(this, 0);
+        }
+
+        const_iterator cbegin() const
+        {
+            return begin();
+        }
+
+        const_iterator cend() const
+        {
+            return end();
+        }
+
+    private:
+        /// Copies the keys in order to the subtree of p_Index.
+        template <typename ForwardIt>
+        void Fill(ForwardIt& p_First, std::size_t p_Index)
+        {
+            if (p_Index > m_Size)
+                return;
+
+            Fill(p_First, 2 * p_Index);
+            m_Keys[p_Index] = *p_First;
+            ++p_First;
+            Fill(p_First, 2 * p_Index + 1);
+        }
+
+        /// Returns the index of the first key not less than p_Key, 0 if none.
+        std::size_t LowerBoundIndex(value_type const& p_Key) const
+        {
+            std::size_t l_Index = 1;
+
+            while (l_Index <= m_Size)
+            {
+                details::Prefetch(m_Keys.data() + std::min(l_Index * PrefetchStride, m_Size));
+                l_Index = 2 * l_Index + m_Comparator(m_Keys[l_Index], p_Key);
+            }
+
+            return details::EytzingerUp(l_Index);
+        }
+
+        /// Fills p_Out with the indices of LowerBoundIndex for p_N keys.
+        void LowerBoundBatch(value_type const* p_Keys, std::size_t p_N, std::size_t* p_Out) const
+        {
+            std::size_t i = 0;
+            if (m_Size)
+                i = batch_type::Run(p_Keys, p_N, m_Keys.data(), m_Size, m_Levels, m_Comparator, p_Out);
+
+            for (std::size_t j = 0; j < i; ++j)
+                p_Out[j] = details::EytzingerUp(p_Out[j]);
+
+            for (; i < p_N; ++i)
+                p_Out[i] = LowerBoundIndex(p_Keys[i]);
+        }
+
+        /// Says if the key at p_Index is p_Key.
+        bool IsKey(std::size_t p_Index, value_type const& p_Key) const
+        {
+            return p_Index && !m_Comparator(p_Key, m_Keys[p_Index]);
+        }
+
+        std::vector<T>  m_Keys;         ///< Keys in Eytzinger order, from the index 1.
+        std::vector<T>  m_Sorted;       ///< Keys in order.
+        std::size_t     m_Size;         ///< Number of keys.
+        std::size_t     m_Levels;       ///< Number of levels of the implicit tree.
+        Comparator      m_Comparator;
+};
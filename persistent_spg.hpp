@@ -0,0 +1,609 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "spg_alpha.hpp"
+
+namespace details
+{
+    /// Node of a PersistentSPG. It may be shared by several versions, so it
+    /// has no parent and is never modified once published. It stores the
+    /// size of its subtree, which the scapegoat search reads instead of
+    /// counting the shared subtrees.
+    template <typename T>
+    struct PersistentNode
+    {
+        PersistentNode*             Left;
+        PersistentNode*             Right;
+        std::size_t                 Size;
+        std::atomic<std::size_t>    Refs;   ///< Parents and versions pointing to the node.
+        T                           Key;
+    };
+}
+
+/// Versioned ScapeGoat tree with path copying. A write copies the nodes from
+/// the root down to the place of its key, plus the subtree a rebuild relinks,
+/// and publishes the new root as a new version: the other nodes are shared
+/// with the previous versions. Readers take a snapshot(), a consistent view
+/// of the version current at that time, which the writes neither change nor
+/// wait for. The nodes only used by old versions are freed with their last
+/// snapshot, by reference counting.
+///
+/// The writes are serialized by a mutex, the readers never take it nor wait
+/// for anything: a reader counts itself in the counter of its thread, on its
+/// own cache line, copies the shared_ptr of the current version and leaves.
+/// A write publishes its version with a single pointer exchange, then waits
+/// for the readers which may still copy the previous shared_ptr before
+/// dropping it. The counters have two phases, as in RCU, so that the
+/// readers arriving meanwhile never hold a write back. The keys must be copy
+/// constructible. The last snapshot of a version frees its nodes on the
+/// thread dropping it, so the allocator must be usable from any thread, as
+/// std::allocator is.
+template <typename T,
+          typename Comparator = std::less<T>,
+          typename Alloc = std::allocator<T>>
+class PersistentSPG
+{
+    using node_type = details::PersistentNode<T>;
+    using link_type = node_type*;
+
+    using NodeAllocator = typename std::allocator_traits<Alloc>::template rebind_alloc<node_type>;
+    using NodeAllocTraits = std::allocator_traits<NodeAllocator>;
+
+    /// A published tree, which owns a reference to its root.
+    struct Version
+    {
+        Version(link_type p_Root, std::size_t p_Size, std::size_t p_Number, NodeAllocator const& p_Allocator)
+            : Root(p_Root),
+            Size(p_Size),
+            Number(p_Number),
+            Allocator(p_Allocator)
+        {
+        }
+
+        Version(Version const&) = delete;
+        Version& operator=(Version const&) = delete;
+
+        ~Version()
+        {
+            Release(Allocator, Root);
+        }
+
+        link_type       Root;
+        std::size_t     Size;       ///< Number of keys.
+        std::size_t     Number;     ///< 0 for the empty tree of the construction, then one more per write.
+        NodeAllocator   Allocator;
+    };
+
+    using version_ptr = std::shared_ptr<Version const>;
+
+    /// Readers in the middle of a Load, per phase, for the threads of a slot.
+    struct alignas(64) ReaderSlot
+    {
+        std::atomic<std::size_t> Active[2] = {};
+    };
+
+    public:
+        using value_type = T;
+        using key_compare = Comparator;
+        using allocator_type = Alloc;
+
+        /// Read only view of one version of the tree. It keeps the version
+        /// alive, the keys it gives stay valid as long as it exists.
+        class snapshot_type
+        {
+            public:
+                /// Returns the number of keys.
+                std::size_t size() const { return m_Version->Size; }
+
+                /// Returns true if the version has no key.
+                bool empty() const { return size() == 0; }
+
+                /// Returns the number of the version, one more per write.
+                std::size_t version() const { return m_Version->Number; }
+
+                /// Returns the key equivalent to p_Key, null if there is none.
+                value_type const* find(value_type const& p_Key) const
+                {
+                    link_type l_Node = m_Version->Root;
+                    while (l_Node)
+                    {
+                        if (m_Comparator(p_Key, l_Node->Key))
+                            l_Node = l_Node->Left;
+                        else if (m_Comparator(l_Node->Key, p_Key))
+                            l_Node = l_Node->Right;
+                        else
+                            return &l_Node->Key;
+                    }
+                    return nullptr;
+                }
+
+                /// Returns true if p_Key is in the version.
+                bool contains(value_type const& p_Key) const
+                {
+                    return find(p_Key) != nullptr;
+                }
+
+                /// Calls p_Function on every key, in order.
+                template <typename Function>
+                void for_each(Function p_Function) const
+                {
+                    ForEachIn(m_Version->Root, p_Function);
+                }
+
+                /// Calls p_Function on every key in [p_Lo, p_Hi], in order.
+                template <typename Function>
+                void for_each_in_range(value_type const& p_Lo, value_type const& p_Hi, Function p_Function) const
+                {
+                    ForEachIn(m_Version->Root, p_Lo, p_Hi, p_Function);
+                }
+
+            private:
+                friend class PersistentSPG;
+
+                snapshot_type(version_ptr p_Version, Comparator const& p_Comparator)
+                    : m_Version(std::move(p_Version)),
+                    m_Comparator(p_Comparator)
+                {
+                }
+
+                template <typename Function>
+                static void ForEachIn(link_type p_Node, Function& p_Function)
+                {
+                    for (; p_Node; p_Node = p_Node->Right)
+                    {
+                        ForEachIn(p_Node->Left, p_Function);
+                        p_Function(static_cast<value_type const&>(p_Node->Key));
+                    }
+                }
+
+                template <typename Function>
+                void ForEachIn(link_type p_Node, value_type const& p_Lo, value_type const& p_Hi, Function& p_Function) const
+                {
+                    while (p_Node)
+                    {
+                        if (m_Comparator(p_Node->Key, p_Lo))
+                            p_Node = p_Node->Right;
+                        else if (m_Comparator(p_Hi, p_Node->Key))
+                            p_Node = p_Node->Left;
+                        else
+                        {
+                            /// The keys on the left are below p_Hi, those on the right above p_Lo.
+                            ForEachIn(p_Node->Left, p_Lo, p_Hi, p_Function);
+                            p_Function(static_cast<value_type const&>(p_Node->Key));
+                            p_Node = p_Node->Right;
+                        }
+                    }
+                }
+
+                version_ptr m_Version;
+                Comparator  m_Comparator;
+        };
+
+        /// Constructs an empty tree, its version 0.
+        /// @p_Alpha : unbalance factor of the tree, MUST be in the interval [0.5, 1.0].
+        PersistentSPG(float p_Alpha, Comparator const& p_Comparator = Comparator(), Alloc const& p_Allocator = Alloc())
+            : m_Alpha(-std::log(p_Alpha)),
+            m_AlphaRatio(p_Alpha),
+            m_Comparator(p_Comparator),
+            m_Allocator(p_Allocator),
+            m_SlotCount(std::max<std::size_t>(std::thread::hardware_concurrency(), 1)),
+            m_Slots(new ReaderSlot[m_SlotCount]),
+            m_Current(nullptr),
+            m_Phase(0),
+            m_MaxSize(0),
+            m_Rebuilds(0)
+        {
+            Store(std::make_shared<Version>(nullptr, 0, 0, m_Allocator));
+        }
+
+        /// The snapshots refer to the versions, not to the tree: they may
+        /// outlive it but it can't be copied or moved.
+        PersistentSPG(PersistentSPG const&) = delete;
+        PersistentSPG& operator=(PersistentSPG const&) = delete;
+
+        /// The snapshots keep their versions.
+        ~PersistentSPG()
+        {
+            delete m_Current.load(std::memory_order_relaxed);
+        }
+
+        /// Returns a view of the current version. Never waits, for a write
+        /// or for another reader.
+        snapshot_type snapshot() const
+        {
+            return snapshot_type(Load(), m_Comparator);
+        }
+
+        /// Returns the number of keys of the current version.
+        std::size_t size() const { return Load()->Size; }
+
+        /// Returns true if the current version has no key.
+        bool empty() const { return size() == 0; }
+
+        /// Returns the number of the current version.
+        std::size_t version() const { return Load()->Number; }
+
+        /// Returns the number of subtree rebuilds, read by the writer.
+        std::size_t rebuild_count() const { return m_Rebuilds; }
+
+        /// Publishes a version with p_Key, if it is not in the tree.
+        /// The nodes above it are copied, the scapegoat subtree is rebuilt
+        /// into new nodes if the copy is too deep.
+        /// Returns true if the key was inserted, false otherwise.
+        bool insert(value_type const& p_Key)
+        {
+            return Insert(p_Key, p_Key);
+        }
+
+        bool insert(value_type&& p_Key)
+        {
+            return Insert(p_Key, std::move(p_Key));
+        }
+
+        /// Publishes a version without p_Key, if it is in the tree.
+        /// The whole tree is rebuilt once its size drops under alpha * max size.
+        /// Returns the number of keys erased.
+        std::size_t erase(value_type const& p_Key)
+        {
+            std::lock_guard<std::mutex> l_Lock(m_Writer);
+            version_ptr l_Current = Load();
+
+            link_type l_Node = Descend(l_Current->Root, p_Key);
+            if (!l_Node)
+                return 0;
+
+            link_type l_Replacement;
+            if (!l_Node->Left)
+                l_Replacement = Acquire(l_Node->Right);
+            else if (!l_Node->Right)
+                l_Replacement = Acquire(l_Node->Left);
+            else
+            {
+                /// The successor, the minimum of the right subtree, takes the
+                /// place of the node: the path to it is copied without it.
+                std::size_t l_Below = m_Path.size();
+                link_type l_Min = l_Node->Right;
+                for (; l_Min->Left; l_Min = l_Min->Left)
+                    m_Path.emplace_back(l_Min, true);
+
+                link_type l_Right = CopyPath(Acquire(l_Min->Right), l_Below);
+                m_Path.resize(l_Below);
+                l_Replacement = CreateNode(l_Min->Key, Acquire(l_Node->Left), l_Right);
+            }
+
+            link_type l_Root = CopyPath(l_Replacement);
+            std::size_t l_Size = l_Current->Size - 1;
+
+            /// Galperin/Rivest deletion, the rebuild copies every key.
+            if (l_Size < m_AlphaRatio * m_MaxSize)
+            {
+                if (l_Root)
+                    l_Root = RebuildOwned(l_Root);
+                m_MaxSize = l_Size;
+            }
+
+            Publish(l_Root, l_Size, l_Current->Number + 1);
+            return 1;
+        }
+
+        /// Publishes an empty version.
+        void clear()
+        {
+            std::lock_guard<std::mutex> l_Lock(m_Writer);
+            m_MaxSize = 0;
+            Publish(nullptr, 0, Load()->Number + 1);
+        }
+
+    private:
+        /// Returns the reader counters of the calling thread.
+        ReaderSlot& ThreadSlot() const
+        {
+            static std::atomic<std::size_t> s_Threads(0);
+            thread_local std::size_t t_Slot = s_Threads.fetch_add(1, std::memory_order_relaxed);
+            return m_Slots[t_Slot % m_SlotCount];
+        }
+
+        /// Returns the current version. The reader is counted in the phase
+        /// it read while it copies the shared_ptr, a fixed number of steps.
+        version_ptr Load() const
+        {
+            std::atomic<std::size_t>& l_Active = ThreadSlot().Active[m_Phase.load() & 1];
+            l_Active.fetch_add(1);
+            version_ptr l_Version = *m_Current.load();
+            l_Active.fetch_sub(1, std::memory_order_release);
+            return l_Version;
+        }
+
+        /// Makes p_Version the current version, by the writer. The previous
+        /// one is dropped once no reader can be copying it: a reader counted
+        /// in a phase after the wait for it loads the new pointer.
+        void Store(version_ptr p_Version)
+        {
+            std::unique_ptr<version_ptr const> l_Previous(m_Current.exchange(new version_ptr(std::move(p_Version))));
+            if (!l_Previous)
+                return;
+
+            /// A reader may have read the phase before the first flip but be
+            /// counted after its wait: the second phase waits for it.
+            for (int l_Flip = 0; l_Flip < 2; ++l_Flip)
+            {
+                std::size_t l_Phase = m_Phase.fetch_add(1) & 1;
+                for (std::size_t i = 0; i < m_SlotCount; ++i)
+                    while (m_Slots[i].Active[l_Phase].load(std::memory_order_acquire))
+                        std::this_thread::yield();
+            }
+        }
+
+        /// Publishes the tree of p_Root, whose reference goes to the version.
+        void Publish(link_type p_Root, std::size_t p_Size, std::size_t p_Number)
+        {
+            version_ptr l_Version;
+            try
+            {
+                l_Version = std::make_shared<Version>(p_Root, p_Size, p_Number, m_Allocator);
+            }
+            catch (...)
+            {
+                Release(m_Allocator, p_Root);
+                throw;
+            }
+
+            Store(std::move(l_Version));
+        }
+
+        /// Calculate the alpha height of the tree based on the size given.
+        float HeightAlpha(std::size_t p_N) const
+        {
+            return details::AlphaTraits<void>::Height(p_N, m_Alpha);
+        }
+
+        /// Takes one more reference to p_Node, which may be null.
+        static link_type Acquire(link_type p_Node)
+        {
+            if (p_Node)
+                p_Node->Refs.fetch_add(1, std::memory_order_relaxed);
+            return p_Node;
+        }
+
+        /// Drops a reference to p_Node, which is freed with its last one and
+        /// drops the references to its children.
+        static void Release(NodeAllocator& p_Allocator, link_type p_Node)
+        {
+            while (p_Node && p_Node->Refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                Release(p_Allocator, p_Node->Left);
+
+                link_type l_Right = p_Node->Right;
+                NodeAllocTraits::destroy(p_Allocator, &p_Node->Key);
+                NodeAllocTraits::deallocate(p_Allocator, p_Node, 1);
+                p_Node = l_Right;
+            }
+        }
+
+        /// Creates a node, not shared yet, with the references to its children.
+        /// They are dropped if the key constructor throws.
+        template <typename Key>
+        link_type CreateNode(Key&& p_Key, link_type p_Left, link_type p_Right)
+        {
+            link_type l_Node;
+            try
+            {
+                l_Node = NodeAllocTraits::allocate(m_Allocator, 1);
+                try
+                {
+                    NodeAllocTraits::construct(m_Allocator, &l_Node->Key, std::forward<Key>(p_Key));
+                }
+                catch (...)
+                {
+                    NodeAllocTraits::deallocate(m_Allocator, l_Node, 1);
+                    throw;
+                }
+            }
+            catch (...)
+            {
+                Release(m_Allocator, p_Left);
+                Release(m_Allocator, p_Right);
+                throw;
+            }
+
+            l_Node->Left = p_Left;
+            l_Node->Right = p_Right;
+            l_Node->Size = SizeOf(p_Left) + SizeOf(p_Right) + 1;
+            ::new (static_cast<void*>(&l_Node->Refs)) std::atomic<std::size_t>(1);
+            return l_Node;
+        }
+
+        static std::size_t SizeOf(link_type p_Node)
+        {
+            return p_Node ? p_Node->Size : 0;
+        }
+
+        /// Fills m_Path with the nodes above the place of p_Key and the side
+        /// taken below each of them.
+        /// Returns the node equivalent to p_Key, null if there is none.
+        link_type Descend(link_type p_Root, value_type const& p_Key)
+        {
+            m_Path.clear();
+            while (p_Root)
+            {
+                bool l_Left = m_Comparator(p_Key, p_Root->Key);
+                if (!l_Left && !m_Comparator(p_Root->Key, p_Key))
+                    return p_Root;
+
+                m_Path.emplace_back(p_Root, l_Left);
+                p_Root = l_Left ? p_Root->Left : p_Root->Right;
+            }
+            return nullptr;
+        }
+
+        /// Copies the nodes of m_Path from p_From, bottom up, with p_Child in
+        /// place of the subtree below the last one. The other children are shared.
+        /// Returns the copy of m_Path[p_From], p_Child if there is none.
+        link_type CopyPath(link_type p_Child, std::size_t p_From = 0)
+        {
+            for (std::size_t i = m_Path.size(); i > p_From; --i)
+            {
+                link_type l_Old = m_Path[i - 1].first;
+                if (m_Path[i - 1].second)
+                    p_Child = CreateNode(l_Old->Key, p_Child, Acquire(l_Old->Right));
+                else
+                    p_Child = CreateNode(l_Old->Key, Acquire(l_Old->Left), p_Child);
+            }
+            return p_Child;
+        }
+
+        template <typename Key>
+        bool Insert(value_type const& p_Key, Key&& p_Value)
+        {
+            std::lock_guard<std::mutex> l_Lock(m_Writer);
+            version_ptr l_Current = Load();
+
+            if (Descend(l_Current->Root, p_Key))
+                return false;
+
+            std::size_t l_Height = m_Path.size();
+            std::size_t l_Size = l_Current->Size + 1;
+            m_MaxSize = std::max(m_MaxSize, l_Size);
+
+            link_type l_Root = CopyPath(CreateNode(std::forward<Key>(p_Value), nullptr, nullptr));
+            if (l_Height > HeightAlpha(l_Size))
+                l_Root = RebuildScapeGoat(l_Root, l_Height);
+
+            Publish(l_Root, l_Size, l_Current->Number + 1);
+            return true;
+        }
+
+        /// Rebuilds the deepest ancestor of the new node whose subtree is
+        /// higher than its alpha height. Its nodes and those above it are
+        /// the copies of the path, which no other version shares yet.
+        /// @p_Root : The root of the new tree, owned.
+        /// @p_Height : The depth of the new node.
+        /// Returns the root of the tree.
+        link_type RebuildScapeGoat(link_type p_Root, std::size_t p_Height)
+        {
+            /// The copies of the path, the new node is the last child.
+            m_Copies.clear();
+            link_type l_Node = p_Root;
+            for (std::size_t i = 0; i < p_Height; ++i)
+            {
+                m_Copies.push_back(l_Node);
+                l_Node = m_Path[i].second ? l_Node->Left : l_Node->Right;
+            }
+
+            std::size_t i = p_Height;
+            while (i > 0 && p_Height - (i - 1) <= HeightAlpha(m_Copies[i - 1]->Size))
+                --i;
+
+            /// The root is always too high, as the new node is.
+            std::size_t l_ScapeGoat = i > 0 ? i - 1 : 0;
+            if (!l_ScapeGoat)
+            {
+                m_MaxSize = p_Root->Size;
+                return RebuildOwned(p_Root);
+            }
+
+            link_type l_Parent = m_Copies[l_ScapeGoat - 1];
+            link_type& l_Link = m_Path[l_ScapeGoat - 1].second ? l_Parent->Left : l_Parent->Right;
+
+            /// The rebuild drops the scapegoat even if it throws.
+            link_type l_ScapeGoatNode = l_Link;
+            l_Link = nullptr;
+            try
+            {
+                l_Link = RebuildOwned(l_ScapeGoatNode);
+            }
+            catch (...)
+            {
+                Release(m_Allocator, p_Root);
+                throw;
+            }
+
+            return p_Root;
+        }
+
+        /// Returns a perfectly balanced copy of the subtree of p_Node, whose
+        /// reference is dropped. If the copy throws, p_Node is dropped anyway.
+        link_type RebuildOwned(link_type p_Node)
+        {
+            ++m_Rebuilds;
+
+            link_type l_Root;
+            try
+            {
+                m_Nodes.clear();
+                Flatten(p_Node, m_Nodes);
+                l_Root = BuildBalanced(m_Nodes.data(), m_Nodes.size());
+            }
+            catch (...)
+            {
+                Release(m_Allocator, p_Node);
+                throw;
+            }
+
+            Release(m_Allocator, p_Node);
+            return l_Root;
+        }
+
+        /// Appends the nodes of a subtree, in order.
+        static void Flatten(link_type p_Node, std::vector<link_type>& p_Nodes)
+        {
+            for (; p_Node; p_Node = p_Node->Right)
+            {
+                Flatten(p_Node->Left, p_Nodes);
+                p_Nodes.push_back(p_Node);
+            }
+        }
+
+        /// Builds a perfectly balanced subtree of new nodes with the keys of
+        /// the given nodes, in order.
+        link_type BuildBalanced(link_type const* p_Nodes, std::size_t p_N)
+        {
+            if (!p_N)
+                return nullptr;
+
+            std::size_t l_LeftSize = (p_N - 1) / 2;
+            link_type l_Left = BuildBalanced(p_Nodes, l_LeftSize);
+
+            link_type l_Right;
+            try
+            {
+                l_Right = BuildBalanced(p_Nodes + l_LeftSize + 1, p_N - 1 - l_LeftSize);
+            }
+            catch (...)
+            {
+                Release(m_Allocator, l_Left);
+                throw;
+            }
+
+            return CreateNode(p_Nodes[l_LeftSize]->Key, l_Left, l_Right);
+        }
+
+        float           m_Alpha;        ///< -log(alpha).
+        float           m_AlphaRatio;   ///< Alpha as given to the constructor, used by the deletion watermark.
+        Comparator      m_Comparator;
+        NodeAllocator   m_Allocator;
+
+        std::size_t                         m_SlotCount;    ///< Slots of the reader counters.
+        std::unique_ptr<ReaderSlot[]>       m_Slots;        ///< Reader counters, the threads share the slots.
+        std::atomic<version_ptr const*>     m_Current;      ///< The version given to the new snapshots, owned.
+        std::atomic<std::size_t>            m_Phase;        ///< Phase of the new readers, its low bit.
+
+        /// The members below belong to the writer.
+        std::mutex      m_Writer;       ///< Serializes the writes.
+        std::size_t     m_MaxSize;      ///< Maximum size reached since the last full rebuild.
+        std::size_t     m_Rebuilds;     ///< Number of subtree rebuilds.
+
+        std::vector<std::pair<link_type, bool>> m_Path;     ///< Nodes above the place of a key, true if it is on their left.
+        std::vector<link_type>                  m_Copies;   ///< Copies of m_Path in the new tree.
+        std::vector<link_type>                  m_Nodes;    ///< Scratch array of the rebuilds.
+};
@@ -7,13 +7,72 @@
 namespace details
 {
     /// Returns the size of the subtree of p_Node.
-    std::size_t Size(NodeBase const* p_Node)
+    inline std::size_t Size(NodeBase const* p_Node)
     {
         if (p_Node)
             return Size(p_Node->Left) + Size(p_Node->Right) + 1;
 
         return 0;
     }
+
+    inline NodeBase* Leftmost(NodeBase* p_Node)
+    {
+        while (p_Node->Left)
+            p_Node = p_Node->Left;
+
+        return p_Node;
+    }
+
+    inline NodeBase* Rightmost(NodeBase* p_Node)
+    {
+        while (p_Node->Right)
+            p_Node = p_Node->Right;
+
+        return p_Node;
+    }
+
+    inline NodeBase* Increment(NodeBase* p_Node)
+    {
+        if (p_Node->Right)
+            return Leftmost(p_Node->Right);
+
+        /// The successor of the header is the first node.
+        if (!p_Node->Parent)
+            return Leftmost(p_Node);
+
+        /// We go up until we come from a left child. The root is the left
+        /// child of the header, so the last node goes up to the header.
+        NodeBase* l_Parent = p_Node->Parent;
+        while (p_Node == l_Parent->Right)
+        {
+            p_Node = l_Parent;
+            l_Parent = l_Parent->Parent;
+        }
+
+        return l_Parent;
+    }
+
+    inline NodeBase* Decrement(NodeBase* p_Node)
+    {
+        /// The predecessor of the header is the last node.
+        if (p_Node->Left)
+            return Rightmost(p_Node->Left);
+
+        /// The header of an empty tree.
+        if (!p_Node->Parent)
+            return p_Node;
+
+        /// We go up until we come from a right child, the first node
+        /// goes up to the header.
+        NodeBase* l_Parent = p_Node->Parent;
+        while (p_Node == l_Parent->Left && l_Parent->Parent)
+        {
+            p_Node = l_Parent;
+            l_Parent = l_Parent->Parent;
+        }
+
+        return l_Parent;
+    }
 }
 
 template <typename T>
@@ -49,279 +108,1966 @@ NodeBase::print(std::size_t p_Depth) const
 
 template <typename T,
           typename Comp,
-          typename Alloc>
-SPG<T, Comp, Alloc>::SPG(float p_Alpha)
+          typename Alloc,
+          typename... Options>
+SPG<T, Comp, Alloc, Options...>::SPG(float p_Alpha)
     :
-        m_Alpha(-std::log(p_Alpha)),
-        m_Size(0)
+        m_Alpha(-std::log(alpha_traits::Alpha(p_Alpha))),
+        m_Size(0),
+        m_AlphaRatio(alpha_traits::Alpha(p_Alpha)),
+        m_MaxSize(0),
+        m_Rebuilds(0),
+        m_InBatch(false),
+        m_Rightmost(nullptr),
+        m_RightmostDepth(0),
+        m_BatchDepth(0),
+        m_BatchDepthFrom(0),
+        m_BatchDepthUntil(0),
+        m_Relocated(0)
 {
 }
 
 template <typename T,
           typename Comp,
-          typename Alloc>
-SPG<T, Comp, Alloc>::~SPG()
+          typename Alloc,
+          typename... Options>
+SPG<T, Comp, Alloc, Options...>::SPG()
+    :
+        SPG(static_cast<float>(alpha_traits::ratio::num) / alpha_traits::ratio::den)
 {
-    /// Recursively destroy the tree.
-    if (m_Impl.m_Root)
-    {
-        DestroyRec(m_Impl.m_Root);
-        DestroyNode(static_cast<link_type>(m_Impl.m_Root));
-    }
+    static_assert(alpha_traits::IsStatic, "SPG() needs a std::ratio option, the alpha is given to the other constructors");
 }
 
 template <typename T,
           typename Comp,
-          typename Alloc>
-typename SPG<T, Comp, Alloc>::link_type
-SPG<T, Comp, Alloc>::find(value_type const& p_Key)
+          typename Alloc,
+          typename... Options>
+template <typename InputIt>
+SPG<T, Comp, Alloc, Options...>::SPG(InputIt p_First, InputIt p_Last, float p_Alpha)
+    :
+        SPG(p_Alpha)
 {
-    return InternalFind(m_Impl.m_Root, p_Key);
+    insert_range(p_First, p_Last);
 }
 
 template <typename T,
           typename Comp,
-          typename Alloc>
-bool
-SPG<T, Comp, Alloc>::insert(value_type const& p_Key)
+          typename Alloc,
+          typename... Options>
+SPG<T, Comp, Alloc, Options...>::SPG(SPG&& p_Other)
+    :
+        m_Alpha(p_Other.m_Alpha),
+        m_Impl(p_Other.GetNodeAllocator(), p_Other.m_Impl.m_KeyComparator),
+        m_Size(0),
+        m_AlphaRatio(p_Other.m_AlphaRatio),
+        m_MaxSize(0),
+        m_Rebuilds(p_Other.m_Rebuilds),
+        m_InBatch(p_Other.m_InBatch),
+        m_Rightmost(nullptr),
+        m_RightmostDepth(0),
+        m_BatchDepth(0),
+        m_BatchDepthFrom(0),
+        m_BatchDepthUntil(0),
+        m_RebuildBuffer(std::move(p_Other.m_RebuildBuffer)),
+        m_Relocated(0)
 {
-    /// If the tree has no elements, we put the new node as root.
-    if (!m_Impl.m_Root)
-    {
-        BuildRootNode(p_Key);
-        return true;
-    }
+    GetStats() = p_Other.GetStats();
+    StealNodes(p_Other);
+}
 
-    /// CALLGRIND_START_INSTRUMENTATION;
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+SPG<T, Comp, Alloc, Options...>&
+SPG<T, Comp, Alloc, Options...>::operator=(SPG&& p_Other)
+{
+    if (this == &p_Other)
+        return *this;
 
-    /// We allocate the array of the parents. Size is the maximum height of the tree.
-    std::size_t l_Size = static_cast<std::size_t>(HeightAlpha(m_Size++)) + 3;
+    clear();
 
-    /// We make a new array of parents that we will fill in InsertKey.
-    /// It will be used to find the scapegoat node. Normally, it
-    /// shouldn't be very large.
-    link_type l_Parents[l_Size];
-    l_Parents[0] = nullptr; ///< No need to set the other values because we will overwrite them.
+    m_Alpha = p_Other.m_Alpha;
+    m_AlphaRatio = p_Other.m_AlphaRatio;
+    m_BatchDepthUntil = 0;
+    GetNodeAllocator() = p_Other.GetNodeAllocator();
+    m_Impl.m_KeyComparator = p_Other.m_Impl.m_KeyComparator;
+    GetStats() = p_Other.GetStats();
+    m_Rebuilds = p_Other.m_Rebuilds;
+    m_InBatch = p_Other.m_InBatch;
 
-    /// Basically insert the key as in any binary search tree.
-    int l_Height = InsertKey(static_cast<link_type>(m_Impl.m_Root), p_Key, l_Parents);
+    StealNodes(p_Other);
+    return *this;
+}
 
-    /// It means that the insertion failed.
-    if (l_Height == -1)
-        return false;
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::StealNodes(SPG& p_Other)
+{
+    SetRoot(p_Other.GetRoot());
+    m_Size = p_Other.m_Size;
+    m_MaxSize = p_Other.m_MaxSize;
+    m_BatchNodes = std::move(p_Other.m_BatchNodes);
+    m_Relocated = p_Other.m_Relocated;
 
-    link_type l_NewNode = BuildNode(p_Key, l_Parents[l_Height]);
-    /// If the height is greater than the alpha height, we rebalance the tree.
-    if (l_Height > HeightAlpha(m_Size))
-    {
-        /// We find the node that is making the unbalance and rebuild
-        /// the sub-tree.
-        std::size_t l_SubTreeSize = 1;
-        auto&& l_Result = FindScapeGoatNode(l_NewNode, l_Parents, l_Height, l_SubTreeSize);
-        auto l_ScapeGoatNode = l_Result.first;
-        auto l_ParentSG = l_Result.second;
-        l_ScapeGoatNode = RebuildTree(l_SubTreeSize, l_ScapeGoatNode);
+    p_Other.SetRoot(nullptr);
+    p_Other.m_Size = 0;
+    p_Other.m_MaxSize = 0;
+    p_Other.m_BatchNodes.clear();
+    p_Other.m_Relocated = 0;
+}
 
-        /// We link back the new subtree to the current tree.
-        if (l_ParentSG)
-        {
-            if (m_Impl.m_KeyComparator(l_ScapeGoatNode->Key, l_ParentSG->Key))
-                l_ParentSG->Left = l_ScapeGoatNode;
-            else
-                l_ParentSG->Right = l_ScapeGoatNode;
-        }
-        else
-            m_Impl.m_Root = l_ScapeGoatNode;
-    }
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+SPG<T, Comp, Alloc, Options...>::~SPG()
+{
+    /// Allocators releasing their memory in bulk free the nodes when
+    /// m_Impl is destroyed, we only walk the tree if the keys need it.
+    /// A pool shared with another tree (split, moves) outlives us, our
+    /// nodes are then given back to it for the other tree to reuse.
+    /// The blocks of spg_veb_layout are not allocated one node at a time.
+    if (!details::ReleasesAlone(GetNodeAllocator(), details::ReleasesInBulk<NodeAllocator>()) ||
+        !std::is_trivially_destructible<value_type>::value ||
+        RelocatesNodes)
+        DestroyRec(GetRoot());
+}
 
-    /// CALLGRIND_STOP_INSTRUMENTATION;
-    return true;
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::clear()
+{
+    DestroyRec(GetRoot());
+    SetRoot(nullptr);
+    m_Size = 0;
+    m_MaxSize = 0;
+    m_BatchNodes.clear();
+    m_Relocated = 0;
 }
 
 template <typename T,
           typename Comp,
-          typename Alloc>
-std::size_t
-SPG<T, Comp, Alloc>::erase(value_type const& p_Key)
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::iterator
+SPG<T, Comp, Alloc, Options...>::find(value_type const& p_Key)
 {
-    if (!m_Impl.m_Root)
-        return 0;
+    link_base_type l_Node = InternalFind(p_Key);
+    return l_Node ? iterator(l_Node) : end();
+}
 
-    auto l_Link = find(p_Key);
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::const_iterator
+SPG<T, Comp, Alloc, Options...>::find(value_type const& p_Key) const
+{
+    link_base_type l_Node = InternalFind(p_Key);
+    return l_Node ? const_iterator(l_Node) : cend();
 }
 
 template <typename T,
           typename Comp,
-          typename Alloc>
-void
-SPG<T, Comp, Alloc>::print() const
+          typename Alloc,
+          typename... Options>
+bool
+SPG<T, Comp, Alloc, Options...>::contains(value_type const& p_Key) const
 {
-    m_Impl.m_Root->template print<T>(0);
-    std::cout << std::endl;
+    return InternalFind(p_Key) != nullptr;
 }
 
 template <typename T,
           typename Comp,
-          typename Alloc>
-inline std::pair<typename SPG<T, Comp, Alloc>::link_type, typename SPG<T, Comp, Alloc>::link_type>
-SPG<T, Comp, Alloc>::FindScapeGoatNode(
-        link_type p_Node,
-        link_type* p_Parents,
-        std::size_t p_Ind,
-        std::size_t& p_TotalSize) const
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::iterator
+SPG<T, Comp, Alloc, Options...>::lower_bound(value_type const& p_Key)
 {
-    assert(p_Node != nullptr);
+    return iterator(InternalBound(p_Key, false));
+}
 
-    link_type l_Parent;
-    link_base_type l_Sibling;
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::const_iterator
+SPG<T, Comp, Alloc, Options...>::lower_bound(value_type const& p_Key) const
+{
+    return const_iterator(InternalBound(p_Key, false));
+}
 
-    std::size_t l_Height = 0;
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::iterator
+SPG<T, Comp, Alloc, Options...>::upper_bound(value_type const& p_Key)
+{
+    return iterator(InternalBound(p_Key, true));
+}
 
-    /// We look for the deepest unbalanced ancestor.
-    while (l_Height <= HeightAlpha(p_TotalSize))
-    {
-        l_Parent = p_Parents[p_Ind--];
-        ++l_Height;
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::const_iterator
+SPG<T, Comp, Alloc, Options...>::upper_bound(value_type const& p_Key) const
+{
+    return const_iterator(InternalBound(p_Key, true));
+}
 
-        assert(l_Parent);
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+std::pair<typename SPG<T, Comp, Alloc, Options...>::iterator, typename SPG<T, Comp, Alloc, Options...>::iterator>
+SPG<T, Comp, Alloc, Options...>::equal_range(value_type const& p_Key)
+{
+    iterator l_First = lower_bound(p_Key);
 
-        /// We only recalculate the sibling subtree size.
-        l_Sibling = m_Impl.m_KeyComparator(GetKey(p_Node), GetKey(l_Parent)) ? l_Parent->Right : l_Parent->Left;
-        p_TotalSize = 1 + p_TotalSize + details::Size(l_Sibling);
+    /// The keys are unique, so the range holds at most the lower bound.
+    iterator l_Last = l_First;
+    if (l_Last != end() && !m_Impl.m_KeyComparator(p_Key, *l_Last))
+        ++l_Last;
 
-        p_Node = l_Parent;
+    return std::make_pair(l_First, l_Last);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+std::pair<typename SPG<T, Comp, Alloc, Options...>::const_iterator, typename SPG<T, Comp, Alloc, Options...>::const_iterator>
+SPG<T, Comp, Alloc, Options...>::equal_range(value_type const& p_Key) const
+{
+    const_iterator l_First = lower_bound(p_Key);
+
+    const_iterator l_Last = l_First;
+    if (l_Last != cend() && !m_Impl.m_KeyComparator(p_Key, *l_Last))
+        ++l_Last;
+
+    return std::make_pair(l_First, l_Last);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename Function>
+void
+SPG<T, Comp, Alloc, Options...>::for_each_in_range(value_type const& p_Lo, value_type const& p_Hi, Function p_Function) const
+{
+    link_base_type l_Header = GetHeader();
+
+    for (link_base_type l_Node = InternalBound(p_Lo, false);
+         l_Node != l_Header && !m_Impl.m_KeyComparator(p_Hi, GetKey(l_Node));
+         l_Node = details::Increment(l_Node))
+        p_Function(GetKey(l_Node));
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename Function>
+void
+SPG<T, Comp, Alloc, Options...>::parallel_for_each(Function p_Function, std::size_t p_Threads) const
+{
+    /// Small trees are not worth the threads.
+    std::size_t l_Threads = ParallelThreads(p_Threads);
+    if (l_Threads == 1)
+    {
+        ForEachIn(GetRoot(), p_Function);
+        return;
     }
 
-    return std::make_pair(l_Parent, p_Parents[p_Ind]);
+    std::vector<link_base_type> l_Top;
+    std::vector<link_base_type> l_Parts;
+    SplitTop(GetRoot(), details::Log2(l_Threads), l_Top, l_Parts);
+
+    std::vector<std::function<void()>> l_Tasks;
+    l_Tasks.reserve(l_Parts.size());
+    for (link_base_type l_Part : l_Parts)
+        l_Tasks.emplace_back([this, l_Part, &p_Function] { ForEachIn(l_Part, p_Function); });
+
+    details::ThreadPool::Shared().Run(l_Tasks);
+
+    for (link_base_type l_Node : l_Top)
+        if (l_Node)
+            p_Function(GetKey(l_Node));
 }
 
 template <typename T,
           typename Comp,
-          typename Alloc>
-inline int
-SPG<T, Comp, Alloc>::InsertKey(link_type p_Root, value_type const& p_Key, link_type* p_Parents) const
+          typename Alloc,
+          typename... Options>
+template <typename R, typename Accumulate, typename Reduce>
+R
+SPG<T, Comp, Alloc, Options...>::parallel_reduce(R p_Init, Accumulate p_Accumulate, Reduce p_Reduce, std::size_t p_Threads) const
 {
-    /// We begin to one, this way we won't have to check in FindScapeGoatNode
-    /// if the indice of the parent is greater than 0.
-    link_type* l_FirstParent = p_Parents++;
+    std::size_t l_Threads = ParallelThreads(p_Threads);
 
-    while (p_Root)
+    std::vector<link_base_type> l_Top;
+    std::vector<link_base_type> l_Parts;
+    SplitTop(GetRoot(), details::Log2(l_Threads), l_Top, l_Parts);
+
+    /// A result per part and per key above the parts, in key order.
+    std::vector<R> l_Results(l_Top.size(), p_Init);
+    std::vector<std::function<void()>> l_Tasks;
+    l_Tasks.reserve(l_Parts.size());
+
+    std::size_t l_Part = 0;
+    for (std::size_t i = 0; i < l_Top.size(); ++i)
     {
-        /// We save the parents.
-        *p_Parents++ = p_Root;
+        if (l_Top[i])
+        {
+            l_Results[i] = p_Accumulate(std::move(l_Results[i]), GetKey(l_Top[i]));
+            continue;
+        }
 
-        /// We look for a left/right place to put our new node.
-        if (m_Impl.m_KeyComparator(p_Key, p_Root->Key))
-            p_Root = (link_type)p_Root->Left;
-        else if (m_Impl.m_KeyComparator(p_Root->Key, p_Key))
-            p_Root = (link_type)p_Root->Right;
-        /// If the given key already exists, we return a negative height.
-        else
-            return -1;
+        l_Tasks.emplace_back([this, &l_Results, &l_Parts, &p_Accumulate, i, l_Part]
+        {
+            auto l_Fold = [&l_Results, &p_Accumulate, i](value_type const& p_Key)
+            {
+                l_Results[i] = p_Accumulate(std::move(l_Results[i]), p_Key);
+            };
+            ForEachIn(l_Parts[l_Part], l_Fold);
+        });
+        ++l_Part;
     }
 
-    return ((std::ptrdiff_t)p_Parents - (std::ptrdiff_t)l_FirstParent) / sizeof (link_type) - 1;
+    /// A single part is folded by the caller.
+    if (l_Tasks.size() == 1)
+        l_Tasks.front()();
+    else if (!l_Tasks.empty())
+        details::ThreadPool::Shared().Run(l_Tasks);
+
+    R l_Result = std::move(p_Init);
+    for (R& l_Partial : l_Results)
+        l_Result = p_Reduce(std::move(l_Result), std::move(l_Partial));
+    return l_Result;
 }
 
 template <typename T,
           typename Comp,
-          typename Alloc>
-void
-SPG<T, Comp, Alloc>::DestroyRec(link_base_type p_N)
+          typename Alloc,
+          typename... Options>
+bool
+SPG<T, Comp, Alloc, Options...>::insert(value_type const& p_Key)
 {
-    if (!p_N)
-        return;
+    return InsertUnique(p_Key, p_Key).second;
+}
 
-    DestroyRec(p_N->Left);
-    DestroyNode(static_cast<link_type>(p_N->Left));
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+bool
+SPG<T, Comp, Alloc, Options...>::insert(value_type&& p_Key)
+{
+    return InsertUnique(p_Key, std::move(p_Key)).second;
+}
 
-    DestroyRec(p_N->Right);
-    DestroyNode(static_cast<link_type>(p_N->Right));
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::iterator
+SPG<T, Comp, Alloc, Options...>::insert(const_iterator p_Hint, value_type const& p_Key)
+{
+    return iterator(InsertNear(const_cast<link_base_type>(p_Hint.m_Node), p_Key, p_Key).first);
 }
 
 template <typename T,
           typename Comp,
-          typename Alloc>
-typename SPG<T, Comp, Alloc>::link_type
-SPG<T, Comp, Alloc>::InternalFind(link_type p_Node, int p_Key)
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::iterator
+SPG<T, Comp, Alloc, Options...>::insert(const_iterator p_Hint, value_type&& p_Key)
 {
-    if (p_Node == nullptr)
-        return p_Node;
+    return iterator(InsertNear(const_cast<link_base_type>(p_Hint.m_Node), p_Key, std::move(p_Key)).first);
+}
 
-    else if (m_Impl.KeyComparator(p_Key, p_Node->Key))
-        return InternalFind(p_Node->Left, p_Key);
-    else if(m_Impl.m_KeyComparator(p_Node->Key, p_Key))
-        return InternalFind(p_Node->Right, p_Key);
-    else
-        return p_Node;
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename... Args>
+std::pair<typename SPG<T, Comp, Alloc, Options...>::iterator, bool>
+SPG<T, Comp, Alloc, Options...>::emplace(Args&&... p_Args)
+{
+    /// We need the key to look for it, it is moved in the node if it is new.
+    value_type l_Key(std::forward<Args>(p_Args)...);
+
+    auto l_Result = InsertUnique(l_Key, std::move(l_Key));
+    return std::make_pair(iterator(l_Result.first), l_Result.second);
 }
 
-/// Implementation is the Day/Stout/Warren algorithm for
-/// rebalancing trees.
 template <typename T,
           typename Comp,
-          typename Alloc>
-typename SPG<T, Comp, Alloc>::link_type
-SPG<T, Comp, Alloc>::RebuildTree(std::size_t p_N, link_base_type p_SPN)
+          typename Alloc,
+          typename... Options>
+template <typename Key, typename... Args>
+std::pair<typename SPG<T, Comp, Alloc, Options...>::link_type, bool>
+SPG<T, Comp, Alloc, Options...>::InsertNear(link_base_type p_Hint, Key const& p_Key, Args&&... p_Args)
 {
-    // Tree to Vine algorithm: a "pseudo-root" is passed ---
-    // comparable with a dummy header for a linked list.
-    auto tree_to_vine = [](link_base_type p_Root, std::size_t& p_Size)
+    if (m_InBatch)
+        return InsertDeferred(p_Key, std::forward<Args>(p_Args)...);
+
+    /// If the tree has no elements, we put the new node as root.
+    if (!GetRoot())
+        return std::make_pair(BuildRootNode(std::forward<Args>(p_Args)...), true);
+
+    /// CALLGRIND_START_INSTRUMENTATION;
+
+    /// The array of the parents that we will fill in InsertKey, it will be
+    /// used to find the scapegoat node. Its size is the maximum height of
+    /// the tree: with a compile-time alpha, the bound of any size fits in a
+    /// fixed array if it is small enough. Otherwise, after deletions the tree
+    /// may still be as high as the watermark allows.
+    std::array<link_type, FixedInsertPath ? alpha_traits::MaxHeight + 3 : 1> l_Fixed;
+    link_type* l_Parents = l_Fixed.data();
+    if (!FixedInsertPath)
     {
-        link_base_type l_VineTail;
-        link_base_type l_Remainder;
-        link_base_type l_Tmp;
+        std::size_t l_Size = static_cast<std::size_t>(HeightAlpha(std::max(m_MaxSize, m_Size + 1))) + 3;
+        if (m_InsertPath.size() < l_Size)
+            m_InsertPath.resize(l_Size);
+        l_Parents = m_InsertPath.data();
+    }
+    l_Parents[0] = nullptr; ///< No need to set the other values because we will overwrite them.
 
-        l_VineTail = p_Root;
-        l_Remainder = l_VineTail->Right;
-        p_Size = 0;
+    /// The parents above the start of the search, the l_Start first ones,
+    /// are only filled if a scapegoat is looked for.
+    std::size_t l_Start = 0;
+    int l_Height;
 
-        while (l_Remainder != nullptr)
+    link_type l_Rightmost = GetRightmost();
+    if (m_Impl.m_KeyComparator(l_Rightmost->Key, p_Key))
+    {
+        /// An append: the new node is the right child of the greatest one.
+        l_Start = m_RightmostDepth;
+        l_Parents[l_Start + 1] = l_Rightmost;
+        l_Height = static_cast<int>(l_Start) + 1;
+    }
+    else
+    {
+        link_type l_Root = GetRoot();
+        if (p_Hint)
         {
-            //If no leftward subtree, move rightward
-            if (l_Remainder->Left == nullptr)
-            {
-                l_VineTail = l_Remainder;
-                l_Remainder = l_Remainder->Right;
-                p_Size++;
-            }
-            //else eliminate the leftward subtree by rotations
-            else  // Rightward rotation
-            {
-                l_Tmp = l_Remainder->Left;
-                l_Remainder->Left = l_Tmp->Right;
-                l_Tmp->Right = l_Remainder;
-                l_Remainder = l_Tmp;
-                l_VineTail->Right = l_Tmp;
-            }
+            /// end() is a hint for keys near the greatest one.
+            if (p_Hint == GetHeader())
+                p_Hint = l_Rightmost;
+
+            l_Root = FingerStart(p_Hint, p_Key);
+            l_Start = Depth(l_Root);
         }
-    };
 
-    auto compression = [](link_base_type root, int count)
+        /// Basically insert the key as in any binary search tree.
+        l_Height = InsertKey(l_Root, p_Key, l_Parents + l_Start);
+
+        /// The key is already in the tree, InsertKey left its node above the start.
+        if (l_Height == -1)
+            return InsertCopy(l_Parents[l_Start]);
+
+        l_Height += static_cast<int>(l_Start);
+    }
+
+    /// The key is new, we can construct the node. If it throws, the tree is untouched.
+    link_type l_NewNode = BuildNode(l_Parents[l_Height], std::forward<Args>(p_Args)...);
+
+    ++m_Size;
+    m_MaxSize = std::max(m_MaxSize, m_Size);
+    GetStats().OnInsert(l_Height);
+
+    if (l_NewNode->Parent == l_Rightmost && l_Rightmost->Right == l_NewNode)
     {
-        link_base_type scanner = root;
+        m_Rightmost = l_NewNode;
+        m_RightmostDepth = l_Height;
+    }
 
-        for (int j = 0; j < count; j++)
-        {
-            //Leftward rotation
-            link_base_type child = scanner->Right;
-            scanner->Right = child->Right;
-            scanner = scanner->Right;
-            child->Right = scanner->Left;
-            scanner->Left = child;
-        }  // end for
-    };  // end compression
+    UpdateSizesUp(l_NewNode->Parent);
 
-    // Loop structure taken directly from Day's code
-    auto vine_to_tree = [&compression](link_base_type root, int size)
+    /// If the height is greater than the alpha height, we rebalance the tree.
+    if (static_cast<std::size_t>(l_Height) > HeightAlpha(m_Size))
     {
-        auto FullSize = [] ( int size )    // Full portion of a complete tree
+        /// The search started below the root, the parents above are filled now.
+        link_base_type l_Parent = l_Parents[l_Start + 1];
+        for (std::size_t i = l_Start; i > 0; --i)
         {
-            int Rtn = 1;
-            while (Rtn <= size)     // Drive one step PAST FULL
-                Rtn = Rtn + Rtn + 1;   // next pow(2,k)-1
-            return Rtn >> 1;
-        };
+            l_Parent = l_Parent->Parent;
+            l_Parents[i] = static_cast<link_type>(l_Parent);
+        }
+
+        /// We find the node that is making the unbalance and rebuild
+        /// the sub-tree.
+        std::size_t l_SubTreeSize = 1;
+        auto&& l_Result = FindScapeGoatNode(l_NewNode, l_Parents, l_Height, l_SubTreeSize);
+        auto l_ScapeGoatNode = l_Result.first;
+        auto l_ParentSG = l_Result.second;
+
+        if (l_NewNode == m_Rightmost)
+        {
+            /// The levels the subtree can use below the scapegoat without
+            /// going deeper than the alpha height.
+            std::size_t l_Depth = 0;
+            while (l_Parents[l_Depth + 1] != l_ScapeGoatNode)
+                ++l_Depth;
+            std::size_t l_Levels = static_cast<std::size_t>(HeightAlpha(m_Size)) + 1 - l_Depth;
+            l_ScapeGoatNode = RebuildForAppend(l_SubTreeSize, l_ScapeGoatNode, l_Levels, &l_NewNode);
+        }
+        else
+            l_ScapeGoatNode = RebuildTree(l_SubTreeSize, l_ScapeGoatNode, &l_NewNode);
+
+        /// We link back the new subtree to the current tree.
+        if (l_ParentSG)
+        {
+            if (m_Impl.m_KeyComparator(l_ScapeGoatNode->Key, l_ParentSG->Key))
+                l_ParentSG->Left = l_ScapeGoatNode;
+            else
+                l_ParentSG->Right = l_ScapeGoatNode;
+        }
+        else
+        {
+            /// The whole tree has been rebuilt, so we reset the watermark.
+            SetRoot(l_ScapeGoatNode);
+            m_MaxSize = m_Size;
+        }
+
+        RelayoutIfSparse(&l_NewNode);
+    }
+
+    /// CALLGRIND_STOP_INSTRUMENTATION;
+    return std::make_pair(l_NewNode, true);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::begin_batch()
+{
+    m_InBatch = true;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::end_batch()
+{
+    FlushBatch();
+    m_InBatch = false;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename InputIt>
+std::size_t
+SPG<T, Comp, Alloc, Options...>::insert_batch(InputIt p_First, InputIt p_Last)
+{
+    bool l_Nested = m_InBatch;
+    std::size_t l_Inserted = 0;
+
+    begin_batch();
+    for (; p_First != p_Last; ++p_First)
+        l_Inserted += InsertUnique(*p_First, *p_First).second;
+
+    if (!l_Nested)
+        end_batch();
+
+    return l_Inserted;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::merge(SPG&& p_Other)
+{
+    if (this == &p_Other || p_Other.empty())
+        return;
+
+    /// Nodes of another allocator can't be kept, the keys are copied.
+    if (!(GetNodeAllocator() == p_Other.GetNodeAllocator()))
+    {
+        Combine(p_Other, true, true, true);
+        p_Other.clear();
+        return;
+    }
+
+    if (empty())
+    {
+        StealNodes(p_Other);
+        return;
+    }
+
+    std::vector<link_type> l_Ours;
+    std::vector<link_type> l_Theirs;
+    l_Ours.reserve(m_Size);
+    l_Theirs.reserve(p_Other.m_Size);
+    Flatten(GetRoot(), l_Ours);
+    p_Other.Flatten(p_Other.GetRoot(), l_Theirs);
+
+    std::vector<link_type> l_Merged;
+    l_Merged.reserve(l_Ours.size() + l_Theirs.size());
+
+    auto l_Our = l_Ours.begin();
+    auto l_Their = l_Theirs.begin();
+    while (l_Our != l_Ours.end() && l_Their != l_Theirs.end())
+    {
+        if (m_Impl.m_KeyComparator((*l_Our)->Key, (*l_Their)->Key))
+            l_Merged.push_back(*l_Our++);
+        else if (m_Impl.m_KeyComparator((*l_Their)->Key, (*l_Our)->Key))
+            l_Merged.push_back(*l_Their++);
+        else
+        {
+            /// The key is in both trees, we keep ours with their copies.
+            count_traits::Set(*l_Our, count_traits::Get(*l_Our) + count_traits::Get(*l_Their));
+            DestroyNode(*l_Their++);
+            l_Merged.push_back(*l_Our++);
+        }
+    }
+
+    l_Merged.insert(l_Merged.end(), l_Our, l_Ours.end());
+    l_Merged.insert(l_Merged.end(), l_Their, l_Theirs.end());
+
+    p_Other.SetRoot(nullptr);
+    p_Other.m_Size = 0;
+    p_Other.m_MaxSize = 0;
+    p_Other.m_BatchNodes.clear();
+
+    /// Their blocks come with their nodes.
+    m_Relocated += p_Other.m_Relocated;
+    p_Other.m_Relocated = 0;
+
+    /// The whole tree is balanced, no pending node needs a check anymore.
+    m_BatchNodes.clear();
+
+    m_Size = l_Merged.size();
+    SetRoot(LinkBalanced(l_Merged.data(), m_Size));
+    m_MaxSize = m_Size;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::merge(SPG const& p_Other)
+{
+    Combine(p_Other, true, true, true);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::intersect_with(SPG const& p_Other)
+{
+    Combine(p_Other, false, true, false);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::subtract(SPG const& p_Other)
+{
+    Combine(p_Other, true, false, false);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::Combine(SPG const& p_Other, bool p_KeepOurs, bool p_KeepBoth, bool p_KeepTheirs)
+{
+    std::vector<link_type> l_Nodes;
+    l_Nodes.reserve(m_Size);
+    Flatten(GetRoot(), l_Nodes);
+
+    std::vector<link_type> l_Merged;
+    l_Merged.reserve(m_Size + (p_KeepTheirs ? p_Other.m_Size : 0));
+
+    /// Our dropped nodes are only destroyed once the new nodes are built,
+    /// so that the tree can be relinked as it was if a copy throws.
+    std::vector<link_type> l_Dropped;
+    std::vector<link_type> l_Created;
+
+    /// With spg_multiset, the new counts of the nodes in both trees, set at
+    /// the end as well: the union adds the copies, the intersection keeps
+    /// the fewest and the difference subtracts them.
+    std::vector<std::pair<link_type, std::size_t>> l_Counts;
+
+    auto l_Node = l_Nodes.begin();
+    auto l_Key = p_Other.cbegin();
+
+    auto l_Copy = [this, &l_Merged, &l_Created](const_iterator p_Key)
+    {
+        link_type l_New = CreateNode(*p_Key);
+        count_traits::Set(l_New, count_traits::Get(p_Key.m_Node));
+        l_Created.push_back(l_New);
+        l_Merged.push_back(l_New);
+    };
+
+    try
+    {
+        while (l_Node != l_Nodes.end() && l_Key != p_Other.cend())
+        {
+            if (m_Impl.m_KeyComparator((*l_Node)->Key, *l_Key))
+            {
+                (p_KeepOurs ? l_Merged : l_Dropped).push_back(*l_Node);
+                ++l_Node;
+            }
+            else if (m_Impl.m_KeyComparator(*l_Key, (*l_Node)->Key))
+            {
+                if (p_KeepTheirs)
+                    l_Copy(l_Key);
+                ++l_Key;
+            }
+            else
+            {
+                bool l_Keep = p_KeepBoth;
+                if (CountsCopies)
+                {
+                    std::size_t l_Ours = count_traits::Get(*l_Node);
+                    std::size_t l_Theirs = count_traits::Get(l_Key.m_Node);
+                    std::size_t l_Count = p_KeepTheirs ? l_Ours + l_Theirs :
+                                          p_KeepBoth ? std::min(l_Ours, l_Theirs) :
+                                          l_Ours > l_Theirs ? l_Ours - l_Theirs : 0;
+
+                    l_Keep = l_Count > 0;
+                    if (l_Keep)
+                        l_Counts.emplace_back(*l_Node, l_Count);
+                }
+
+                (l_Keep ? l_Merged : l_Dropped).push_back(*l_Node);
+                ++l_Node;
+                ++l_Key;
+            }
+        }
+
+        for (; l_Node != l_Nodes.end(); ++l_Node)
+            (p_KeepOurs ? l_Merged : l_Dropped).push_back(*l_Node);
+
+        for (; p_KeepTheirs && l_Key != p_Other.cend(); ++l_Key)
+            l_Copy(l_Key);
+    }
+    catch (...)
+    {
+        for (link_type l_New : l_Created)
+            DestroyNode(l_New);
+
+        SetRoot(LinkBalanced(l_Nodes.data(), l_Nodes.size()));
+        throw;
+    }
+
+    for (link_type l_Old : l_Dropped)
+        DestroyNode(l_Old);
+
+    for (auto const& l_Count : l_Counts)
+        count_traits::Set(l_Count.first, l_Count.second);
+
+    /// The whole tree is balanced, no pending node needs a check anymore.
+    m_BatchNodes.clear();
+
+    m_Size = l_Merged.size();
+    SetRoot(LinkBalanced(l_Merged.data(), m_Size));
+    m_MaxSize = m_Size;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+SPG<T, Comp, Alloc, Options...>
+SPG<T, Comp, Alloc, Options...>::split(value_type const& p_Key)
+{
+    SPG l_Right(m_AlphaRatio);
+    l_Right.GetNodeAllocator() = GetNodeAllocator();
+    l_Right.m_Impl.m_KeyComparator = m_Impl.m_KeyComparator;
+
+    if (m_InBatch)
+        FlushBatch();
+
+    /// We walk down the search path of p_Key. A node less than p_Key stays
+    /// with its left subtree and is hooked at the right of the last such node,
+    /// the other nodes go to the right tree the other way round.
+    link_base_type l_Node = GetRoot();
+    link_base_type l_LeftParent = GetHeader();
+    link_base_type l_RightParent = l_Right.GetHeader();
+    link_base_type* l_LeftLink = &m_Impl.m_Header.Left;
+    link_base_type* l_RightLink = &l_Right.m_Impl.m_Header.Left;
+    std::size_t l_RightSize = 0;
+
+    while (l_Node)
+    {
+        if (m_Impl.m_KeyComparator(GetKey(l_Node), p_Key))
+        {
+            *l_LeftLink = l_Node;
+            l_Node->Parent = l_LeftParent;
+            l_LeftParent = l_Node;
+            l_LeftLink = &l_Node->Right;
+            l_Node = l_Node->Right;
+        }
+        else
+        {
+            std::size_t l_SubtreeSize = size_traits::Get(l_Node->Right);
+            if (!StoresSize)
+                GetStats().OnSizeVisits(l_SubtreeSize);
+            l_RightSize += 1 + l_SubtreeSize;
+
+            *l_RightLink = l_Node;
+            l_Node->Parent = l_RightParent;
+            l_RightParent = l_Node;
+            l_RightLink = &l_Node->Left;
+            l_Node = l_Node->Left;
+        }
+    }
+
+    *l_LeftLink = nullptr;
+    *l_RightLink = nullptr;
+    m_Rightmost = nullptr;
+
+    /// Only the nodes of the path lost a subtree.
+    UpdateSizesUp(l_LeftParent);
+    l_Right.UpdateSizesUp(l_RightParent);
+
+    l_Right.m_Size = l_RightSize;
+    l_Right.m_MaxSize = m_MaxSize;
+    m_Size -= l_RightSize;
+
+    return l_Right;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::join(SPG&& p_Right)
+{
+    if (this == &p_Right || p_Right.empty())
+        return;
+
+    assert(empty() || m_Impl.m_KeyComparator(*crbegin(), *p_Right.cbegin()));
+
+    if (m_InBatch)
+        FlushBatch();
+    if (p_Right.m_InBatch)
+        p_Right.FlushBatch();
+
+    if (empty())
+    {
+        if (GetNodeAllocator() == p_Right.GetNodeAllocator())
+            StealNodes(p_Right);
+        else
+            merge(std::move(p_Right));
+        return;
+    }
+
+    /// Nodes of another allocator can't be kept, the keys are copied.
+    if (!(GetNodeAllocator() == p_Right.GetNodeAllocator()))
+    {
+        merge(std::move(p_Right));
+        return;
+    }
+
+    /// Only the nodes of the smaller tree get deeper.
+    if (m_Size >= p_Right.m_Size)
+    {
+        m_Relocated += p_Right.m_Relocated;
+        Graft(p_Right.GetRoot(), p_Right.m_Size, p_Right.m_MaxSize, true);
+
+        p_Right.SetRoot(nullptr);
+        p_Right.m_Size = 0;
+        p_Right.m_MaxSize = 0;
+        p_Right.m_Relocated = 0;
+    }
+    else
+    {
+        link_base_type l_Root = GetRoot();
+        std::size_t l_Size = m_Size;
+        std::size_t l_MaxSize = m_MaxSize;
+        std::size_t l_Relocated = m_Relocated;
+
+        StealNodes(p_Right);
+        m_Relocated += l_Relocated;
+        Graft(l_Root, l_Size, l_MaxSize, false);
+    }
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::Graft(link_base_type p_Root, std::size_t p_N, std::size_t p_MaxSize, bool p_AtRight)
+{
+    link_base_type l_Parent = GetRoot();
+    if (p_AtRight)
+    {
+        while (l_Parent->Right)
+            l_Parent = l_Parent->Right;
+        l_Parent->Right = p_Root;
+    }
+    else
+    {
+        while (l_Parent->Left)
+            l_Parent = l_Parent->Left;
+        l_Parent->Left = p_Root;
+    }
+
+    p_Root->Parent = l_Parent;
+    UpdateSizesUp(l_Parent);
+    m_Rightmost = nullptr;
+
+    m_Size += p_N;
+    m_MaxSize = std::max(m_MaxSize, m_Size);
+
+    /// The grafted tree is at most one level over its alpha height.
+    RestoreDepth(p_Root, static_cast<std::size_t>(HeightAlpha(p_MaxSize)) + 1);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename Key, typename... Args>
+std::pair<typename SPG<T, Comp, Alloc, Options...>::link_type, bool>
+SPG<T, Comp, Alloc, Options...>::InsertDeferred(Key const& p_Key, Args&&... p_Args)
+{
+    if (!GetRoot())
+        return std::make_pair(BuildRootNode(std::forward<Args>(p_Args)...), true);
+
+    link_type l_Parent = nullptr;
+    link_type l_Node = GetRoot();
+    std::size_t l_Depth = 0;
+
+    while (l_Node)
+    {
+        l_Parent = l_Node;
+        ++l_Depth;
+
+        if (m_Impl.m_KeyComparator(p_Key, l_Node->Key))
+            l_Node = static_cast<link_type>(l_Node->Left);
+        else if (m_Impl.m_KeyComparator(l_Node->Key, p_Key))
+            l_Node = static_cast<link_type>(l_Node->Right);
+        else
+            return InsertCopy(l_Node);
+    }
+
+    link_type l_NewNode = BuildNode(l_Parent, std::forward<Args>(p_Args)...);
+
+    ++m_Size;
+    m_MaxSize = std::max(m_MaxSize, m_Size);
+    GetStats().OnInsert(l_Depth);
+
+    if (l_Parent == m_Rightmost && l_Parent->Right == l_NewNode)
+    {
+        m_Rightmost = l_NewNode;
+        m_RightmostDepth = l_Depth;
+    }
+
+    UpdateSizesUp(l_Parent);
+    m_BatchNodes.push_back(PendingNode{l_NewNode, l_Depth, 0});
+
+    /// Until end_batch, the tree is kept as a scapegoat tree twice as high
+    /// (alpha' = sqrt(alpha)): the descents stay logarithmic on sorted bursts.
+    /// The bound only moves when the size crosses a threshold.
+    if (m_Size < m_BatchDepthFrom || m_Size >= m_BatchDepthUntil)
+        UpdateBatchDepth();
+
+    if (l_Depth > m_BatchDepth)
+    {
+        link_base_type l_Header = GetHeader();
+        link_base_type l_Root = l_NewNode;
+        std::size_t l_Size = 1;
+        std::size_t l_Height = 0;
+
+        while (l_Root->Parent != l_Header)
+        {
+            link_base_type l_Up = l_Root->Parent;
+            std::size_t l_SiblingSize = size_traits::Get(l_Up->Left == l_Root ? l_Up->Right : l_Up->Left);
+
+            GetStats().OnScapeGoatVisit();
+            if (!StoresSize)
+                GetStats().OnSizeVisits(l_SiblingSize);
+
+            l_Size += 1 + l_SiblingSize;
+            l_Root = l_Up;
+
+            if (++l_Height > 2 * HeightAlpha(l_Size) + 1)
+                break;
+        }
+
+        /// The rebuilt subtree may be higher than it was on some side, its
+        /// new root is checked by FlushBatch as well.
+        link_base_type l_Up = l_Root->Parent;
+        bool l_AtLeft = l_Up->Left == l_Root;
+        RebuildAt(l_Root, l_Size);
+        m_BatchNodes.push_back(PendingNode{static_cast<link_type>(l_AtLeft ? l_Up->Left : l_Up->Right),
+                                           l_Depth - l_Height, details::Log2(l_Size)});
+    }
+
+    return std::make_pair(l_NewNode, true);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::UpdateBatchDepth()
+{
+    /// floor(2 h(n) + 1), which grows once 2 h(n) reaches it. The float
+    /// threshold may be a few keys off, the bound is computed again then.
+    m_BatchDepth = static_cast<std::size_t>(2 * HeightAlpha(m_Size) + 1);
+    m_BatchDepthFrom = m_Size;
+    m_BatchDepthUntil = std::max(alpha_traits::ReachingDoubled(m_BatchDepth, m_Alpha), m_Size + 1);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+std::size_t
+SPG<T, Comp, Alloc, Options...>::Height(link_base_type p_Node)
+{
+    if (!p_Node || (!p_Node->Left && !p_Node->Right))
+        return 0;
+
+    return 1 + std::max(Height(p_Node->Left), Height(p_Node->Right));
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::RestoreDepth(link_base_type p_Node, std::size_t p_Below)
+{
+    link_base_type l_Header = GetHeader();
+    auto const l_Bound = HeightAlpha(m_Size);
+
+    /// The depth may have changed since the insertion, we count it again.
+    std::size_t l_Depth = Depth(p_Node);
+
+    if (l_Depth + p_Below <= l_Bound)
+        return;
+
+    /// A perfectly balanced subtree of l_Size nodes is floor(log2(l_Size)) high,
+    /// we climb until the rebuilt subtree fits under the bound. The whole tree
+    /// always does for alpha >= 0.5.
+    link_base_type l_Root = p_Node;
+    std::size_t l_Size = size_traits::Get(p_Node);
+    std::size_t l_Height = 0;
+    while ((l_Size >> l_Height) > 1)
+        ++l_Height;
+
+    if (!StoresSize)
+        GetStats().OnSizeVisits(l_Size);
+
+    while (l_Depth + l_Height > l_Bound && l_Root->Parent != l_Header)
+    {
+        link_base_type l_Parent = l_Root->Parent;
+        link_base_type l_Sibling = l_Parent->Left == l_Root ? l_Parent->Right : l_Parent->Left;
+        std::size_t l_SiblingSize = size_traits::Get(l_Sibling);
+
+        GetStats().OnScapeGoatVisit();
+        if (!StoresSize)
+            GetStats().OnSizeVisits(l_SiblingSize);
+
+        l_Size += 1 + l_SiblingSize;
+        while ((l_Size >> l_Height) > 1)
+            ++l_Height;
+
+        l_Root = l_Parent;
+        --l_Depth;
+    }
+
+    RebuildAt(l_Root, l_Size);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::RebuildAt(link_base_type p_Root, std::size_t p_N)
+{
+    link_base_type l_Parent = p_Root->Parent;
+    link_type l_NewRoot = RebuildTree(p_N, p_Root);
+
+    if (l_Parent == GetHeader())
+    {
+        /// The whole tree has been rebuilt, so we reset the watermark.
+        SetRoot(l_NewRoot);
+        m_MaxSize = m_Size;
+    }
+    else if (m_Impl.m_KeyComparator(l_NewRoot->Key, GetKey(l_Parent)))
+        l_Parent->Left = l_NewRoot;
+    else
+        l_Parent->Right = l_NewRoot;
+
+    RelayoutIfSparse(nullptr);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::FlushBatch()
+{
+    /// The deepest nodes first, their rebuilds usually cover the others.
+    std::sort(m_BatchNodes.begin(), m_BatchNodes.end(), [](PendingNode const& p_Lhs, PendingNode const& p_Rhs)
+    {
+        return p_Lhs.Depth + p_Lhs.Below > p_Rhs.Depth + p_Rhs.Below;
+    });
+
+    /// The rebuilds of the batch move nodes down as well as up, but those
+    /// of a recorded subtree stay under its recorded bound until a later
+    /// rebuild, itself recorded: past the first fitting bound, every node
+    /// fits. The rebuilds of the flush only bring subtrees under the bound.
+    auto const l_Bound = HeightAlpha(m_Size);
+    for (PendingNode const& l_Pending : m_BatchNodes)
+    {
+        if (l_Pending.Depth + l_Pending.Below <= l_Bound)
+            break;
+
+        /// The later rebuilds may have moved the node up or lowered its
+        /// subtree, the real height is only measured if the depth isn't enough.
+        if (Depth(l_Pending.Node) + l_Pending.Below > l_Bound)
+            RestoreDepth(l_Pending.Node, l_Pending.Below ? Height(l_Pending.Node) : 0);
+    }
+
+    m_BatchNodes.clear();
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename InputIt>
+void
+SPG<T, Comp, Alloc, Options...>::insert_range(InputIt p_First, InputIt p_Last)
+{
+    /// The merge of a sorted range keeps one copy per key.
+    if (CountsCopies)
+    {
+        for (; p_First != p_Last; ++p_First)
+            insert(*p_First);
+        return;
+    }
+
+    InsertRange(p_First, p_Last, typename std::iterator_traits<InputIt>::iterator_category());
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename RandomIt>
+void
+SPG<T, Comp, Alloc, Options...>::parallel_build(RandomIt p_First, RandomIt p_Last, std::size_t p_Threads)
+{
+    static_assert(std::is_nothrow_move_constructible<value_type>::value, "SPG::parallel_build moves the keys on other threads");
+    static_assert(!CountsCopies, "SPG::parallel_build keeps one copy per key, spg_multiset would lose the others");
+
+    /// The threads come from the shared pool, p_Threads only sets the
+    /// number of chunks.
+    details::ThreadPool& l_Pool = details::ThreadPool::Shared();
+    std::size_t l_Chunks = std::max<std::size_t>(p_Threads, 1);
+
+    std::vector<value_type> l_Keys(p_First, p_Last);
+
+    auto& l_Comparator = m_Impl.m_KeyComparator;
+    details::ParallelSort(l_Keys.begin(), l_Keys.end(), l_Comparator, l_Pool, l_Chunks);
+
+    /// Once sorted, two keys are equivalent if the first is not less than the second.
+    l_Keys.erase(std::unique(l_Keys.begin(), l_Keys.end(), [&l_Comparator](value_type const& p_Lhs, value_type const& p_Rhs)
+    {
+        return !l_Comparator(p_Lhs, p_Rhs);
+    }), l_Keys.end());
+
+    /// The allocator may not be thread safe.
+    std::vector<link_type> l_Nodes;
+    l_Nodes.reserve(l_Keys.size());
+    try
+    {
+        for (std::size_t i = 0; i < l_Keys.size(); ++i)
+            l_Nodes.push_back(AllocateNode());
+    }
+    catch (...)
+    {
+        for (link_type l_Node : l_Nodes)
+            DeallocateNode(l_Node);
+        throw;
+    }
+
+    clear();
+
+    std::size_t l_N = l_Nodes.size();
+    std::vector<std::function<void()>> l_Tasks;
+    for (std::size_t i = 0; i < l_Chunks; ++i)
+    {
+        l_Tasks.emplace_back([this, &l_Nodes, &l_Keys, l_First = l_N * i / l_Chunks, l_Last = l_N * (i + 1) / l_Chunks]
+        {
+            for (std::size_t j = l_First; j < l_Last; ++j)
+                NodeAllocTraits::construct(GetNodeAllocator(), &l_Nodes[j]->Key, std::move(l_Keys[j]));
+        });
+    }
+
+    /// A single chunk is built by the caller.
+    if (l_Chunks == 1)
+        l_Tasks.front()();
+    else
+        l_Pool.Run(l_Tasks);
+
+    m_Size = l_N;
+    SetRoot(LinkParallel(l_Nodes.data(), l_N, l_Chunks));
+    m_MaxSize = m_Size;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename ForwardIt>
+void
+SPG<T, Comp, Alloc, Options...>::InsertRange(ForwardIt p_First, ForwardIt p_Last, std::forward_iterator_tag)
+{
+    /// The main use: the keys are already sorted, no need to copy them.
+    if (IsStrictlySorted(p_First, p_Last))
+        InsertSorted(p_First, p_Last);
+    else
+        InsertRange(p_First, p_Last, std::input_iterator_tag());
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename InputIt>
+void
+SPG<T, Comp, Alloc, Options...>::InsertRange(InputIt p_First, InputIt p_Last, std::input_iterator_tag)
+{
+    std::vector<value_type> l_Keys(p_First, p_Last);
+
+    auto& l_Comparator = m_Impl.m_KeyComparator;
+    std::sort(l_Keys.begin(), l_Keys.end(), l_Comparator);
+
+    /// Once sorted, two keys are equivalent if the first is not less than the second.
+    auto l_End = std::unique(l_Keys.begin(), l_Keys.end(), [&l_Comparator](value_type const& p_Lhs, value_type const& p_Rhs)
+    {
+        return !l_Comparator(p_Lhs, p_Rhs);
+    });
+
+    InsertSorted(l_Keys.begin(), l_End);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename ForwardIt>
+void
+SPG<T, Comp, Alloc, Options...>::InsertSorted(ForwardIt p_First, ForwardIt p_Last)
+{
+    if (p_First == p_Last)
+        return;
+
+    /// The tree is only changed once every node is built: if a key
+    /// throws, it is left as it was.
+    if (!GetRoot())
+    {
+        std::size_t l_N = std::distance(p_First, p_Last);
+        link_type l_Root = BuildSorted(p_First, l_N);
+
+        m_Size = l_N;
+        SetRoot(l_Root);
+        m_MaxSize = m_Size;
+        return;
+    }
+
+    /// We flatten the tree and merge its nodes with the keys, new nodes
+    /// are only created for the keys which are not in the tree yet.
+    std::vector<link_type> l_Nodes;
+    l_Nodes.reserve(m_Size);
+    Flatten(GetRoot(), l_Nodes);
+
+    std::vector<link_type> l_Merged;
+    std::vector<link_type> l_Created;
+
+    try
+    {
+        /// Reserved for every key, the push_backs can't throw.
+        std::size_t l_N = std::distance(p_First, p_Last);
+        l_Merged.reserve(m_Size + l_N);
+        l_Created.reserve(l_N);
+
+        auto l_Node = l_Nodes.begin();
+        while (p_First != p_Last)
+        {
+            if (l_Node == l_Nodes.end() || m_Impl.m_KeyComparator(*p_First, (*l_Node)->Key))
+            {
+                l_Created.push_back(BuildSorted(p_First, 1));
+                l_Merged.push_back(l_Created.back());
+                continue;
+            }
+
+            /// The key is already in the tree.
+            if (!m_Impl.m_KeyComparator((*l_Node)->Key, *p_First))
+                ++p_First;
+
+            l_Merged.push_back(*l_Node++);
+        }
+
+        l_Merged.insert(l_Merged.end(), l_Node, l_Nodes.end());
+    }
+    catch (...)
+    {
+        /// The links of the tree have not been touched yet.
+        for (link_type l_New : l_Created)
+            DestroyNode(l_New);
+        throw;
+    }
+
+    m_Size = l_Merged.size();
+    SetRoot(LinkBalanced(l_Merged.data(), m_Size));
+    m_MaxSize = m_Size;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename InputIt>
+typename SPG<T, Comp, Alloc, Options...>::link_type
+SPG<T, Comp, Alloc, Options...>::BuildSorted(InputIt& p_First, std::size_t p_N)
+{
+    if (!p_N)
+        return nullptr;
+
+    /// The left subtree is built first to consume the keys in order.
+    std::size_t l_LeftSize = (p_N - 1) / 2;
+    link_type l_Left = BuildSorted(p_First, l_LeftSize);
+
+    /// If a key throws, the nodes built so far are destroyed.
+    link_type l_Node;
+    try
+    {
+        l_Node = CreateNode(*p_First);
+    }
+    catch (...)
+    {
+        DestroyRec(l_Left);
+        throw;
+    }
+
+    l_Node->Left = l_Left;
+    l_Node->Right = nullptr;
+    if (l_Left)
+        l_Left->Parent = l_Node;
+
+    try
+    {
+        ++p_First;
+        l_Node->Right = BuildSorted(p_First, p_N - 1 - l_LeftSize);
+    }
+    catch (...)
+    {
+        DestroyRec(l_Node);
+        throw;
+    }
+
+    if (l_Node->Right)
+        l_Node->Right->Parent = l_Node;
+
+    size_traits::Update(l_Node);
+    return l_Node;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::link_type
+SPG<T, Comp, Alloc, Options...>::LinkBalanced(link_type* p_Nodes, std::size_t p_N)
+{
+    if (!p_N)
+        return nullptr;
+
+    /// Same shape as BuildSorted.
+    std::size_t l_LeftSize = (p_N - 1) / 2;
+    link_type l_Node = p_Nodes[l_LeftSize];
+
+    l_Node->Left = LinkBalanced(p_Nodes, l_LeftSize);
+    l_Node->Right = LinkBalanced(p_Nodes + l_LeftSize + 1, p_N - 1 - l_LeftSize);
+
+    if (l_Node->Left)
+        l_Node->Left->Parent = l_Node;
+    if (l_Node->Right)
+        l_Node->Right->Parent = l_Node;
+
+    size_traits::Update(l_Node);
+    return l_Node;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::link_type
+SPG<T, Comp, Alloc, Options...>::LinkSkewed(link_type* p_Nodes, std::size_t p_N, std::size_t p_Levels)
+{
+    if (!p_N)
+        return nullptr;
+
+    /// The left part is as big as the levels allow, up to all but an
+    /// eighth of the nodes, and balanced. The right part is skewed the same
+    /// way, so the right spine is short and the greatest node shallow.
+    std::size_t l_LeftSize = p_N - 1 - (p_N - 1) / 8;
+    if (p_Levels - 1 < std::numeric_limits<std::size_t>::digits)
+        l_LeftSize = std::min(l_LeftSize, (std::size_t(1) << (p_Levels - 1)) - 1);
+    link_type l_Node = p_Nodes[l_LeftSize];
+
+    if (RebuildsInParallel && l_LeftSize >= spg_parallel_rebuild::Threshold)
+        l_Node->Left = LinkParallel(p_Nodes, l_LeftSize, details::ThreadPool::Shared().Concurrency());
+    else
+        l_Node->Left = LinkBalanced(p_Nodes, l_LeftSize);
+    l_Node->Right = LinkSkewed(p_Nodes + l_LeftSize + 1, p_N - 1 - l_LeftSize, p_Levels - 1);
+
+    if (l_Node->Left)
+        l_Node->Left->Parent = l_Node;
+    if (l_Node->Right)
+        l_Node->Right->Parent = l_Node;
+
+    size_traits::Update(l_Node);
+    return l_Node;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::Flatten(link_base_type p_Node, std::vector<link_type>& p_Nodes) const
+{
+    if (!p_Node)
+        return;
+
+    Flatten(p_Node->Left, p_Nodes);
+    p_Nodes.push_back(static_cast<link_type>(p_Node));
+    Flatten(p_Node->Right, p_Nodes);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+std::size_t
+SPG<T, Comp, Alloc, Options...>::erase(value_type const& p_Key)
+{
+    return EraseKey(p_Key);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename Key>
+std::size_t
+SPG<T, Comp, Alloc, Options...>::EraseKey(Key const& p_Key, bool p_OneCopy)
+{
+    /// The pending nodes may be erased, they are rebalanced first.
+    if (m_InBatch)
+        FlushBatch();
+
+    /// We keep the adress of the link pointing to the current node,
+    /// this way we can unlink it without looking at its parent.
+    link_base_type* l_Link = &m_Impl.m_Header.Left;
+    bool l_OnRightSpine = true;
+
+    while (*l_Link)
+    {
+        if (m_Impl.m_KeyComparator(p_Key, GetKey(*l_Link)))
+        {
+            l_Link = &(*l_Link)->Left;
+            l_OnRightSpine = false;
+        }
+        else if (m_Impl.m_KeyComparator(GetKey(*l_Link), p_Key))
+            l_Link = &(*l_Link)->Right;
+        else
+            break;
+    }
+
+    /// The key is not in the tree.
+    if (!*l_Link)
+        return 0;
+
+    /// The other copies keep the node.
+    std::size_t l_Copies = count_traits::Get(*l_Link);
+    if (p_OneCopy && l_Copies > 1)
+    {
+        count_traits::Set(*l_Link, l_Copies - 1);
+        return 1;
+    }
+
+    /// Erasing a node of the right spine moves the rightmost node up, if
+    /// it is not the rightmost node itself.
+    if (l_OnRightSpine)
+        m_Rightmost = nullptr;
+
+    link_base_type l_Node = *l_Link;
+    link_base_type l_Replacement;
+
+    /// The lowest node whose subtree lost a key.
+    link_base_type l_Lowest = l_Node->Parent;
+
+    if (!l_Node->Left)
+        l_Replacement = l_Node->Right;
+    else if (!l_Node->Right)
+        l_Replacement = l_Node->Left;
+    else
+    {
+        /// The node has two children, we replace it by its successor,
+        /// which is the minimum of the right subtree.
+        link_base_type* l_MinLink = &l_Node->Right;
+        while ((*l_MinLink)->Left)
+            l_MinLink = &(*l_MinLink)->Left;
+
+        l_Replacement = *l_MinLink;
+        l_Lowest = l_Replacement->Parent == l_Node ? l_Replacement : l_Replacement->Parent;
+        *l_MinLink = l_Replacement->Right;
+        if (l_Replacement->Right)
+            l_Replacement->Right->Parent = l_Replacement->Parent;
+
+        l_Replacement->Left = l_Node->Left;
+        l_Replacement->Left->Parent = l_Replacement;
+        l_Replacement->Right = l_Node->Right;
+        if (l_Replacement->Right)
+            l_Replacement->Right->Parent = l_Replacement;
+    }
+
+    *l_Link = l_Replacement;
+    if (l_Replacement)
+        l_Replacement->Parent = l_Node->Parent;
+
+    DestroyNode(static_cast<link_type>(l_Node));
+    UpdateSizesUp(l_Lowest);
+    --m_Size;
+
+    /// Once the tree got too small compared to its maximum size,
+    /// we rebuild it entirely (Galperin/Rivest deletion).
+    if (m_Size < m_AlphaRatio * m_MaxSize)
+    {
+        if (GetRoot())
+            SetRoot(RebuildTree(m_Size, GetRoot()));
+
+        m_MaxSize = m_Size;
+    }
+
+    return p_OneCopy ? 1 : l_Copies;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::print() const
+{
+    GetRoot()->template print<T>(0);
+    std::cout << std::endl;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::iterator
+SPG<T, Comp, Alloc, Options...>::nth(std::size_t p_K)
+{
+    return iterator(NthNode(p_K));
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::const_iterator
+SPG<T, Comp, Alloc, Options...>::nth(std::size_t p_K) const
+{
+    return const_iterator(NthNode(p_K));
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+std::size_t
+SPG<T, Comp, Alloc, Options...>::rank(value_type const& p_Key) const
+{
+    return CountLess(p_Key, false);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+std::size_t
+SPG<T, Comp, Alloc, Options...>::count_between(value_type const& p_Lo, value_type const& p_Hi) const
+{
+    if (m_Impl.m_KeyComparator(p_Hi, p_Lo))
+        return 0;
+
+    return CountLess(p_Hi, true) - CountLess(p_Lo, false);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::link_base_type
+SPG<T, Comp, Alloc, Options...>::NthNode(std::size_t p_K) const
+{
+    static_assert(StoresSize, "Order statistics need the spg_subtree_size option.");
+
+    link_base_type l_Node = GetRoot();
+
+    while (l_Node)
+    {
+        std::size_t l_LeftSize = size_traits::Get(l_Node->Left);
+
+        if (p_K < l_LeftSize)
+            l_Node = l_Node->Left;
+        else if (p_K == l_LeftSize)
+            return l_Node;
+        else
+        {
+            p_K -= l_LeftSize + 1;
+            l_Node = l_Node->Right;
+        }
+    }
+
+    return GetHeader();
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+std::size_t
+SPG<T, Comp, Alloc, Options...>::CountLess(value_type const& p_Key, bool p_Inclusive) const
+{
+    static_assert(StoresSize, "Order statistics need the spg_subtree_size option.");
+
+    std::size_t l_Count = 0;
+    link_base_type l_Node = GetRoot();
+
+    while (l_Node)
+    {
+        bool l_GoLeft = p_Inclusive ? m_Impl.m_KeyComparator(p_Key, GetKey(l_Node))
+                                    : !m_Impl.m_KeyComparator(GetKey(l_Node), p_Key);
+
+        if (l_GoLeft)
+            l_Node = l_Node->Left;
+        else
+        {
+            /// The node and its left subtree are counted.
+            l_Count += size_traits::Get(l_Node->Left) + 1;
+            l_Node = l_Node->Right;
+        }
+    }
+
+    return l_Count;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::LinkSubtree(link_base_type p_Node)
+{
+    if (p_Node->Left)
+    {
+        p_Node->Left->Parent = p_Node;
+        LinkSubtree(p_Node->Left);
+    }
+
+    if (p_Node->Right)
+    {
+        p_Node->Right->Parent = p_Node;
+        LinkSubtree(p_Node->Right);
+    }
+
+    size_traits::Update(p_Node);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+inline std::pair<typename SPG<T, Comp, Alloc, Options...>::link_type, typename SPG<T, Comp, Alloc, Options...>::link_type>
+SPG<T, Comp, Alloc, Options...>::FindScapeGoatNode(
+        link_type p_Node,
+        link_type* p_Parents,
+        std::size_t p_Ind,
+        std::size_t& p_TotalSize)
+{
+    assert(p_Node != nullptr);
+
+    link_type l_Parent = nullptr;
+    link_base_type l_Sibling;
+
+    std::size_t l_Height = 0;
+
+    /// We look for the deepest unbalanced ancestor.
+    while (l_Height <= HeightAlpha(p_TotalSize))
+    {
+        l_Parent = p_Parents[p_Ind--];
+        ++l_Height;
+        GetStats().OnScapeGoatVisit();
+
+        assert(l_Parent);
+
+        /// We only recalculate the sibling subtree size.
+        l_Sibling = m_Impl.m_KeyComparator(GetKey(p_Node), GetKey(l_Parent)) ? l_Parent->Right : l_Parent->Left;
+        std::size_t l_SiblingSize = size_traits::Get(l_Sibling);
+        p_TotalSize = 1 + p_TotalSize + l_SiblingSize;
+
+        if (!StoresSize)
+            GetStats().OnSizeVisits(l_SiblingSize);
+
+        p_Node = l_Parent;
+    }
+
+    return std::make_pair(l_Parent, p_Parents[p_Ind]);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename Key>
+inline int
+SPG<T, Comp, Alloc, Options...>::InsertKey(link_type p_Root, Key const& p_Key, link_type* p_Parents) const
+{
+    /// We begin to one, this way we won't have to check in FindScapeGoatNode
+    /// if the indice of the parent is greater than 0.
+    link_type* l_FirstParent = p_Parents++;
+
+    while (p_Root)
+    {
+        /// We save the parents.
+        *p_Parents++ = p_Root;
+
+        /// We look for a left/right place to put our new node.
+        if (m_Impl.m_KeyComparator(p_Key, p_Root->Key))
+            p_Root = (link_type)p_Root->Left;
+        else if (m_Impl.m_KeyComparator(p_Root->Key, p_Key))
+            p_Root = (link_type)p_Root->Right;
+        /// If the given key already exists, we return a negative height.
+        else
+        {
+            *l_FirstParent = p_Root;
+            return -1;
+        }
+    }
+
+    return ((std::ptrdiff_t)p_Parents - (std::ptrdiff_t)l_FirstParent) / sizeof (link_type) - 1;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename Key>
+typename SPG<T, Comp, Alloc, Options...>::link_type
+SPG<T, Comp, Alloc, Options...>::FingerStart(link_base_type p_Hint, Key const& p_Key) const
+{
+    link_base_type l_Header = GetHeader();
+    link_base_type l_Start = p_Hint;
+    bool l_Less = m_Impl.m_KeyComparator(p_Key, GetKey(p_Hint));
+
+    /// The subtree of a node is bounded by the ancestors it hangs to the
+    /// right of (lower bounds) and to the left of (upper bounds). The keys
+    /// less than the hint are under it, until a lower bound is less than
+    /// the key, and symmetrically.
+    for (link_base_type l_Node = p_Hint; l_Node->Parent != l_Header; l_Node = l_Node->Parent)
+    {
+        link_base_type l_Parent = l_Node->Parent;
+
+        if (l_Less && l_Parent->Right == l_Node)
+        {
+            if (m_Impl.m_KeyComparator(GetKey(l_Parent), p_Key))
+                break;
+            l_Start = l_Parent;
+        }
+        else if (!l_Less && l_Parent->Left == l_Node)
+        {
+            if (m_Impl.m_KeyComparator(p_Key, GetKey(l_Parent)))
+                break;
+            l_Start = l_Parent;
+        }
+    }
+
+    return static_cast<link_type>(l_Start);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::DestroyRec(link_base_type p_N)
+{
+    if (!p_N)
+        return;
+
+    DestroyRec(p_N->Left);
+    DestroyRec(p_N->Right);
+    DestroyNode(static_cast<link_type>(p_N));
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename Key>
+typename SPG<T, Comp, Alloc, Options...>::link_base_type
+SPG<T, Comp, Alloc, Options...>::InternalFind(Key const& p_Key) const
+{
+    link_base_type l_Node = GetRoot();
+
+    while (l_Node)
+    {
+        if (m_Impl.m_KeyComparator(p_Key, GetKey(l_Node)))
+            l_Node = l_Node->Left;
+        else if (m_Impl.m_KeyComparator(GetKey(l_Node), p_Key))
+            l_Node = l_Node->Right;
+        else
+            return l_Node;
+    }
+
+    return nullptr;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+template <typename Key>
+typename SPG<T, Comp, Alloc, Options...>::link_base_type
+SPG<T, Comp, Alloc, Options...>::InternalBound(Key const& p_Key, bool p_Strict) const
+{
+    link_base_type l_Bound = GetHeader();
+    link_base_type l_Node = GetRoot();
+
+    /// The bound is the last node where we went left.
+    while (l_Node)
+    {
+        bool l_GoLeft = p_Strict ? m_Impl.m_KeyComparator(p_Key, GetKey(l_Node))
+                                 : !m_Impl.m_KeyComparator(GetKey(l_Node), p_Key);
+
+        if (l_GoLeft)
+        {
+            l_Bound = l_Node;
+            l_Node = l_Node->Left;
+        }
+        else
+            l_Node = l_Node->Right;
+    }
+
+    return l_Bound;
+}
+
+/// Implementation is the Day/Stout/Warren algorithm for
+/// rebalancing trees.
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::link_type
+SPG<T, Comp, Alloc, Options...>::RebuildTree(std::size_t p_N, link_base_type p_SPN, spg_dsw_rebuild)
+{
+    // Tree to Vine algorithm: a "pseudo-root" is passed ---
+    // comparable with a dummy header for a linked list.
+    auto tree_to_vine = [](link_base_type p_Root, std::size_t& p_Size)
+    {
+        link_base_type l_VineTail;
+        link_base_type l_Remainder;
+        link_base_type l_Tmp;
+
+        l_VineTail = p_Root;
+        l_Remainder = l_VineTail->Right;
+        p_Size = 0;
+
+        while (l_Remainder != nullptr)
+        {
+            //If no leftward subtree, move rightward
+            if (l_Remainder->Left == nullptr)
+            {
+                l_VineTail = l_Remainder;
+                l_Remainder = l_Remainder->Right;
+                p_Size++;
+            }
+            //else eliminate the leftward subtree by rotations
+            else  // Rightward rotation
+            {
+                l_Tmp = l_Remainder->Left;
+                l_Remainder->Left = l_Tmp->Right;
+                l_Tmp->Right = l_Remainder;
+                l_Remainder = l_Tmp;
+                l_VineTail->Right = l_Tmp;
+            }
+        }
+    };
+
+    auto compression = [](link_base_type root, int count)
+    {
+        link_base_type scanner = root;
+
+        for (int j = 0; j < count; j++)
+        {
+            //Leftward rotation
+            link_base_type child = scanner->Right;
+            scanner->Right = child->Right;
+            scanner = scanner->Right;
+            child->Right = scanner->Left;
+            scanner->Left = child;
+        }  // end for
+    };  // end compression
+
+    // Loop structure taken directly from Day's code
+    auto vine_to_tree = [&compression](link_base_type root, int size)
+    {
+        auto FullSize = [] ( int size )    // Full portion of a complete tree
+        {
+            int Rtn = 1;
+            while (Rtn <= size)     // Drive one step PAST FULL
+                Rtn = Rtn + Rtn + 1;   // next pow(2,k)-1
+            return Rtn >> 1;
+        };
 
         int full_count = FullSize(size);
         compression(root, size - full_count);
@@ -329,9 +2075,549 @@ SPG<T, Comp, Alloc>::RebuildTree(std::size_t p_N, link_base_type p_SPN)
             compression(root, size >> 1);
     };
 
-    node_base_type l_PseudoRoot{nullptr, p_SPN};
+    link_base_type l_Parent = p_SPN->Parent;
+    node_base_type l_PseudoRoot{nullptr, p_SPN, nullptr};
 
     tree_to_vine(&l_PseudoRoot, p_N);
     vine_to_tree(&l_PseudoRoot, p_N);
-    return static_cast<link_type>(l_PseudoRoot.Right);
+
+    /// The rotations don't maintain the parents nor the sizes, we link them
+    /// back and hang the new subtree under the parent of the old one.
+    link_base_type l_Root = l_PseudoRoot.Right;
+    LinkSubtree(l_Root);
+    l_Root->Parent = l_Parent;
+
+    return static_cast<link_type>(l_Root);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::link_type
+SPG<T, Comp, Alloc, Options...>::RebuildTree(std::size_t p_N, link_base_type p_SPN, spg_buffer_rebuild)
+{
+    link_base_type l_Parent = p_SPN->Parent;
+
+    /// The buffer keeps its capacity, so only the biggest rebuild allocates.
+    m_RebuildBuffer.clear();
+    m_RebuildBuffer.reserve(p_N);
+    Flatten(p_SPN, m_RebuildBuffer);
+
+    link_type l_Root = LinkBalanced(m_RebuildBuffer.data(), m_RebuildBuffer.size());
+    l_Root->Parent = l_Parent;
+
+    return l_Root;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::link_type
+SPG<T, Comp, Alloc, Options...>::RebuildTree(std::size_t p_N, link_base_type p_SPN, spg_parallel_rebuild)
+{
+    if (p_N < spg_parallel_rebuild::Threshold || details::ThreadPool::Shared().Concurrency() == 1)
+        return RebuildTree(p_N, p_SPN, spg_buffer_rebuild());
+
+    link_base_type l_Parent = p_SPN->Parent;
+
+    m_RebuildBuffer.clear();
+    m_RebuildBuffer.reserve(p_N);
+    FlattenParallel(p_SPN, m_RebuildBuffer, details::ThreadPool::Shared());
+
+    link_type l_Root = LinkParallel(m_RebuildBuffer.data(), m_RebuildBuffer.size(), details::ThreadPool::Shared().Concurrency());
+    l_Root->Parent = l_Parent;
+
+    return l_Root;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::link_type
+SPG<T, Comp, Alloc, Options...>::RelocateTree(std::size_t p_N, link_base_type p_SPN, link_type* p_Follow)
+{
+    link_base_type l_Parent = p_SPN->Parent;
+
+    /// Everything which can throw comes first.
+    std::vector<std::size_t> l_Order;
+    link_type l_Memory;
+    try
+    {
+        std::size_t l_Height = 0;
+        while (p_N >> l_Height)
+            ++l_Height;
+
+        l_Order.reserve(p_N);
+        VebOrder(0, p_N, l_Height, l_Order);
+        m_RebuildBuffer.reserve(p_N);
+        l_Memory = NodeAllocTraits::allocate(GetNodeAllocator(), p_N + 1);
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+
+    m_RebuildBuffer.clear();
+    Flatten(p_SPN, m_RebuildBuffer);
+
+    auto l_Block = ::new (static_cast<void*>(l_Memory)) details::NodeBlock{ p_N, p_N };
+    link_type l_Slots = l_Memory + 1;
+
+    /// The slot k gets the key of the l_Order[k]-th node. The old node is
+    /// freed at once, its block with its last node.
+    for (std::size_t k = 0; k < p_N; ++k)
+    {
+        link_type& l_Node = m_RebuildBuffer[l_Order[k]];
+        link_type l_New = l_Slots + k;
+
+        NodeAllocTraits::construct(GetNodeAllocator(), &l_New->Key, std::move(l_Node->Key));
+        block_traits::Set(l_New, l_Block);
+        count_traits::Set(l_New, count_traits::Get(l_Node));
+
+        if (p_Follow && *p_Follow == l_Node)
+            *p_Follow = l_New;
+
+        DestroyNode(l_Node);
+        l_Node = l_New;
+    }
+
+    if (l_Parent == GetHeader())
+        m_Relocated = 0;
+    else
+        m_Relocated += p_N;
+
+    link_type l_Root = LinkBalanced(m_RebuildBuffer.data(), p_N);
+    l_Root->Parent = l_Parent;
+
+    return l_Root;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::link_type
+SPG<T, Comp, Alloc, Options...>::RelocateLinked(link_type p_Root, std::size_t p_N, link_type* p_Follow)
+{
+    link_base_type l_Parent = p_Root->Parent;
+
+    /// The buffer already holds the p_N nodes, only the block can throw.
+    link_type l_Memory;
+    try
+    {
+        l_Memory = NodeAllocTraits::allocate(GetNodeAllocator(), p_N + 1);
+    }
+    catch (...)
+    {
+        return p_Root;
+    }
+
+    m_RebuildBuffer.clear();
+    VebNodes(p_Root, Height(p_Root) + 1, m_RebuildBuffer);
+
+    auto l_Block = ::new (static_cast<void*>(l_Memory)) details::NodeBlock{ p_N, p_N };
+    link_type l_Slots = l_Memory + 1;
+
+    /// The slot k gets the key of the k-th node in van Emde Boas order. The
+    /// old nodes keep the address of their slot in Parent until the links
+    /// are copied.
+    for (std::size_t k = 0; k < p_N; ++k)
+    {
+        link_type l_Node = m_RebuildBuffer[k];
+        link_type l_New = l_Slots + k;
+
+        NodeAllocTraits::construct(GetNodeAllocator(), &l_New->Key, std::move(l_Node->Key));
+        block_traits::Set(l_New, l_Block);
+        count_traits::Set(l_New, count_traits::Get(l_Node));
+
+        if (p_Follow && *p_Follow == l_Node)
+            *p_Follow = l_New;
+
+        l_Node->Parent = l_New;
+    }
+
+    /// A parent comes before its children, whose sizes are set first.
+    for (std::size_t k = p_N; k-- > 0;)
+    {
+        link_type l_Node = m_RebuildBuffer[k];
+        link_type l_New = l_Slots + k;
+
+        l_New->Left = l_Node->Left ? l_Node->Left->Parent : nullptr;
+        l_New->Right = l_Node->Right ? l_Node->Right->Parent : nullptr;
+        if (l_New->Left)
+            l_New->Left->Parent = l_New;
+        if (l_New->Right)
+            l_New->Right->Parent = l_New;
+
+        size_traits::Update(l_New);
+    }
+
+    for (link_type l_Node : m_RebuildBuffer)
+        DestroyNode(l_Node);
+
+    if (l_Parent == GetHeader())
+        m_Relocated = 0;
+    else
+        m_Relocated += p_N;
+
+    l_Slots->Parent = l_Parent;
+    return l_Slots;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::VebNodes(link_base_type p_Node, std::size_t p_Height, std::vector<link_type>& p_Order)
+{
+    if (!p_Node || !p_Height)
+        return;
+
+    if (p_Height == 1)
+    {
+        p_Order.push_back(static_cast<link_type>(p_Node));
+        return;
+    }
+
+    std::size_t l_Top = p_Height / 2;
+    VebNodes(p_Node, l_Top, p_Order);
+    VebNodesBelow(p_Node, l_Top, p_Height - l_Top, p_Order);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::VebNodesBelow(link_base_type p_Node, std::size_t p_Depth, std::size_t p_Height,
+                                               std::vector<link_type>& p_Order)
+{
+    if (!p_Node)
+        return;
+
+    if (!p_Depth)
+    {
+        VebNodes(p_Node, p_Height, p_Order);
+        return;
+    }
+
+    VebNodesBelow(p_Node->Left, p_Depth - 1, p_Height, p_Order);
+    VebNodesBelow(p_Node->Right, p_Depth - 1, p_Height, p_Order);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::RelayoutIfSparse(link_type* p_Follow)
+{
+    if (!RelocatesNodes || m_Relocated <= m_Size + spg_veb_layout::MinNodes || !m_BatchNodes.empty())
+        return;
+
+    SetRoot(RebuildTree(m_Size, GetRoot(), p_Follow));
+    m_MaxSize = m_Size;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::VebOrder(std::size_t p_First, std::size_t p_N, std::size_t p_Height,
+                                          std::vector<std::size_t>& p_Order)
+{
+    if (!p_N || !p_Height)
+        return;
+
+    if (p_Height == 1)
+    {
+        /// Same split as LinkBalanced.
+        p_Order.push_back(p_First + (p_N - 1) / 2);
+        return;
+    }
+
+    std::size_t l_Top = p_Height / 2;
+    VebOrder(p_First, p_N, l_Top, p_Order);
+    VebBottoms(p_First, p_N, l_Top, p_Height - l_Top, p_Order);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::VebBottoms(std::size_t p_First, std::size_t p_N, std::size_t p_Depth, std::size_t p_Height,
+                                            std::vector<std::size_t>& p_Order)
+{
+    if (!p_N)
+        return;
+
+    if (!p_Depth)
+    {
+        VebOrder(p_First, p_N, p_Height, p_Order);
+        return;
+    }
+
+    std::size_t l_LeftSize = (p_N - 1) / 2;
+    VebBottoms(p_First, l_LeftSize, p_Depth - 1, p_Height, p_Order);
+    VebBottoms(p_First + l_LeftSize + 1, p_N - 1 - l_LeftSize, p_Depth - 1, p_Height, p_Order);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+std::size_t
+SPG<T, Comp, Alloc, Options...>::ParallelThreads(std::size_t p_Threads) const
+{
+    if (m_Size < spg_parallel_rebuild::Threshold || p_Threads < 2)
+        return 1;
+
+    return std::min(p_Threads, details::ThreadPool::Shared().Concurrency());
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+std::size_t
+SPG<T, Comp, Alloc, Options...>::ParallelLevels(std::size_t p_Threads)
+{
+    std::size_t l_Levels = 0;
+    while ((std::size_t(1) << l_Levels) < 4 * p_Threads)
+        ++l_Levels;
+    return l_Levels;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::SplitTop(link_base_type p_Node, std::size_t p_Levels,
+                                          std::vector<link_base_type>& p_Top,
+                                          std::vector<link_base_type>& p_Parts) const
+{
+    if (!p_Node)
+        return;
+
+    if (!p_Levels)
+    {
+        p_Top.push_back(nullptr);
+        p_Parts.push_back(p_Node);
+        return;
+    }
+
+    SplitTop(p_Node->Left, p_Levels - 1, p_Top, p_Parts);
+    p_Top.push_back(p_Node);
+    SplitTop(p_Node->Right, p_Levels - 1, p_Top, p_Parts);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+void
+SPG<T, Comp, Alloc, Options...>::FlattenParallel(link_base_type p_Node, std::vector<link_type>& p_Nodes,
+                                                 details::ThreadPool& p_Pool) const
+{
+    /// The sizes of the parts are not known, each one is flattened in its
+    /// own array.
+    std::vector<link_base_type> l_Top;
+    std::vector<link_base_type> l_Parts;
+    SplitTop(p_Node, ParallelLevels(p_Pool.Concurrency()), l_Top, l_Parts);
+
+    std::vector<std::vector<link_type>> l_Flattened(l_Parts.size());
+    std::vector<std::function<void()>> l_Tasks;
+    l_Tasks.reserve(l_Parts.size());
+    for (std::size_t i = 0; i < l_Parts.size(); ++i)
+        l_Tasks.emplace_back([this, &l_Parts, &l_Flattened, i] { Flatten(l_Parts[i], l_Flattened[i]); });
+
+    p_Pool.Run(l_Tasks);
+
+    std::size_t l_Part = 0;
+    for (link_base_type l_Node : l_Top)
+    {
+        if (l_Node)
+            p_Nodes.push_back(static_cast<link_type>(l_Node));
+        else
+        {
+            auto& l_Flat = l_Flattened[l_Part++];
+            p_Nodes.insert(p_Nodes.end(), l_Flat.begin(), l_Flat.end());
+        }
+    }
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::link_type
+SPG<T, Comp, Alloc, Options...>::LinkParallel(link_type* p_Nodes, std::size_t p_N, std::size_t p_Threads)
+{
+    if (p_N < spg_parallel_rebuild::Threshold || p_Threads < 2)
+        return LinkBalanced(p_Nodes, p_N);
+
+    /// The parts are linked first, the top levels read their sizes.
+    std::size_t l_Levels = ParallelLevels(p_Threads);
+    std::vector<std::function<void()>> l_Tasks;
+    LinkTop(p_Nodes, p_N, l_Levels, &l_Tasks);
+    details::ThreadPool::Shared().Run(l_Tasks);
+
+    return LinkTop(p_Nodes, p_N, l_Levels, nullptr);
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::link_type
+SPG<T, Comp, Alloc, Options...>::LinkTop(link_type* p_Nodes, std::size_t p_N, std::size_t p_Levels,
+                                         std::vector<std::function<void()>>* p_Tasks)
+{
+    if (!p_N)
+        return nullptr;
+
+    /// Same split as LinkBalanced, so the root of a part is its middle node.
+    std::size_t l_LeftSize = (p_N - 1) / 2;
+
+    if (p_N < spg_parallel_rebuild::Threshold || !p_Levels)
+    {
+        if (p_Tasks)
+            p_Tasks->emplace_back([this, p_Nodes, p_N] { LinkBalanced(p_Nodes, p_N); });
+        return p_Nodes[l_LeftSize];
+    }
+
+    link_type l_Left = LinkTop(p_Nodes, l_LeftSize, p_Levels - 1, p_Tasks);
+    link_type l_Right = LinkTop(p_Nodes + l_LeftSize + 1, p_N - 1 - l_LeftSize, p_Levels - 1, p_Tasks);
+    link_type l_Node = p_Nodes[l_LeftSize];
+
+    if (p_Tasks)
+        return l_Node;
+
+    l_Node->Left = l_Left;
+    l_Node->Right = l_Right;
+
+    if (l_Left)
+        l_Left->Parent = l_Node;
+    if (l_Right)
+        l_Right->Parent = l_Node;
+
+    size_traits::Update(l_Node);
+    return l_Node;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+typename SPG<T, Comp, Alloc, Options...>::link_type
+SPG<T, Comp, Alloc, Options...>::RebuildForAppend(std::size_t p_N, link_base_type p_SPN, std::size_t p_Levels,
+                                                  link_type* p_Follow)
+{
+    ++m_Rebuilds;
+    GetStats().OnRebuild(p_N);
+    m_Rightmost = nullptr;
+
+    link_base_type l_Parent = p_SPN->Parent;
+
+    m_RebuildBuffer.clear();
+    m_RebuildBuffer.reserve(p_N);
+    if (RebuildsInParallel && p_N >= spg_parallel_rebuild::Threshold)
+        FlattenParallel(p_SPN, m_RebuildBuffer, details::ThreadPool::Shared());
+    else
+        Flatten(p_SPN, m_RebuildBuffer);
+
+    /// Never deeper than a balanced subtree would be.
+    std::size_t l_Balanced = 0;
+    for (std::size_t l_N = p_N; l_N; l_N >>= 1)
+        ++l_Balanced;
+
+    link_type l_Root = LinkSkewed(m_RebuildBuffer.data(), p_N, std::max(p_Levels, l_Balanced));
+    l_Root->Parent = l_Parent;
+
+    /// The skewed shape is kept, only the nodes move.
+    if (RelocatesNodes && p_N >= spg_veb_layout::MinNodes && m_BatchNodes.empty())
+        l_Root = RelocateLinked(l_Root, p_N, p_Follow);
+
+    return l_Root;
+}
+
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...>
+join(SPG<T, Comp, Alloc, Options...>&& p_Left, SPG<T, Comp, Alloc, Options...>&& p_Right)
+{
+    p_Left.join(std::move(p_Right));
+    return std::move(p_Left);
+}
+
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...>
+set_union(SPG<T, Comp, Alloc, Options...> const& p_Lhs, SPG<T, Comp, Alloc, Options...> const& p_Rhs)
+{
+    /// merge copies the counts of the copies, a construction from the keys would not.
+    SPG<T, Comp, Alloc, Options...> l_Result(p_Lhs.alpha());
+    l_Result.merge(p_Lhs);
+    l_Result.merge(p_Rhs);
+    return l_Result;
+}
+
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...>
+set_union(SPG<T, Comp, Alloc, Options...>&& p_Lhs, SPG<T, Comp, Alloc, Options...> const& p_Rhs)
+{
+    p_Lhs.merge(p_Rhs);
+    return std::move(p_Lhs);
+}
+
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...>
+set_union(SPG<T, Comp, Alloc, Options...>&& p_Lhs, SPG<T, Comp, Alloc, Options...>&& p_Rhs)
+{
+    p_Lhs.merge(std::move(p_Rhs));
+    return std::move(p_Lhs);
+}
+
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...>
+set_intersection(SPG<T, Comp, Alloc, Options...> const& p_Lhs, SPG<T, Comp, Alloc, Options...> const& p_Rhs)
+{
+    SPG<T, Comp, Alloc, Options...> l_Result(p_Lhs.alpha());
+
+    /// Only the common keys are copied.
+    SPG<T, Comp, Alloc, Options...> const& l_Smaller = p_Lhs.size() < p_Rhs.size() ? p_Lhs : p_Rhs;
+    l_Result.merge(l_Smaller);
+    l_Result.intersect_with(&l_Smaller == &p_Lhs ? p_Rhs : p_Lhs);
+    return l_Result;
+}
+
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...>
+set_intersection(SPG<T, Comp, Alloc, Options...>&& p_Lhs, SPG<T, Comp, Alloc, Options...> const& p_Rhs)
+{
+    p_Lhs.intersect_with(p_Rhs);
+    return std::move(p_Lhs);
+}
+
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...>
+set_difference(SPG<T, Comp, Alloc, Options...> const& p_Lhs, SPG<T, Comp, Alloc, Options...> const& p_Rhs)
+{
+    SPG<T, Comp, Alloc, Options...> l_Result(p_Lhs.alpha());
+    l_Result.merge(p_Lhs);
+    l_Result.subtract(p_Rhs);
+    return l_Result;
+}
+
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...>
+set_difference(SPG<T, Comp, Alloc, Options...>&& p_Lhs, SPG<T, Comp, Alloc, Options...> const& p_Rhs)
+{
+    p_Lhs.subtract(p_Rhs);
+    return std::move(p_Lhs);
 }
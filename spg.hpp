@@ -1,16 +1,69 @@
 #pragma once
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <functional>
 #include <iostream>
 #include <cassert>
-#include <stack>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "frozen_spg.hpp"
+#include "spg_alpha.hpp"
+#include "spg_options.hpp"
+#include "spg_pool_allocator.hpp"
+#include "spg_stats.hpp"
+#include "spg_thread_pool.hpp"
+
+namespace details
+{
+    template <typename...>
+    struct MakeVoid
+    {
+        using type = void;
+    };
+
+    /// Says if the allocator releases its memory all at once when destroyed
+    /// (it then declares a bulk_release type and a use_count of its memory),
+    /// so nodes need no deallocation.
+    template <typename A, typename = void>
+    struct ReleasesInBulk : std::false_type
+    {
+    };
+
+    template <typename A>
+    struct ReleasesInBulk<A, typename MakeVoid<typename A::bulk_release>::type> : A::bulk_release
+    {
+    };
+
+    /// Says if p_Alloc frees our nodes when destroyed: another allocator
+    /// sharing its memory would keep them alive until it is destroyed.
+    template <typename A>
+    bool ReleasesAlone(A const& p_Alloc, std::true_type)
+    {
+        return p_Alloc.use_count() == 1;
+    }
+
+    template <typename A>
+    bool ReleasesAlone(A const&, std::false_type)
+    {
+        return false;
+    }
+}
 
 /// Basic node structure for the scapegoat tree.
 /// The advantage of this structure is that we only need
-/// the left and right children of the node.
+/// the left and right children of the node, the parent
+/// lets the iterators move without any stack.
 struct NodeBase
 {
     NodeBase*   Left;
     NodeBase*   Right;
+    NodeBase*   Parent;
 
     /// print the current subtree.
     /// @p_Depth is the number of tabs that
@@ -26,6 +79,160 @@ struct Node : public NodeBase
     T Key;
 };
 
+/// Node storing the size of its subtree, used with spg_subtree_size.
+template <typename T>
+struct SizedNode : public Node<T>
+{
+    std::size_t Size;
+};
+
+namespace details
+{
+    /// Header of a block of nodes allocated by a rebuild with spg_veb_layout,
+    /// it takes the first slot of the block.
+    struct NodeBlock
+    {
+        std::size_t Slots;  ///< Number of nodes after the header.
+        std::size_t Live;   ///< Nodes not freed yet, the block goes with the last one.
+    };
+}
+
+/// Node knowing the block it was allocated in, used with spg_veb_layout.
+template <typename Base>
+struct BlockNode : public Base
+{
+    details::NodeBlock* Block;  ///< Null for a node allocated alone.
+};
+
+/// Node holding the copies of its key, used with spg_multiset.
+template <typename Base>
+struct CountedNode : public Base
+{
+    std::size_t Count;  ///< Number of copies of the key, at least 1.
+};
+
+namespace details
+{
+    /// Returns the size of the subtree of p_Node, counting its nodes.
+    inline std::size_t Size(NodeBase const* p_Node);
+
+    /// Returns the node type matching the options of the tree.
+    template <typename T, typename... Options>
+    struct NodeOf
+    {
+        using sized_type = typename std::conditional<HasOption<spg_subtree_size, Options...>::value,
+                                                     SizedNode<T>,
+                                                     Node<T>>::type;
+
+        using counted_type = typename std::conditional<HasOption<spg_multiset, Options...>::value,
+                                                       CountedNode<sized_type>,
+                                                       sized_type>::type;
+
+        using type = typename std::conditional<HasOption<spg_veb_layout, Options...>::value,
+                                               BlockNode<counted_type>,
+                                               counted_type>::type;
+    };
+
+    /// Access to the copies of the key of a node, always 1 without spg_multiset.
+    template <typename NodeType, bool Stored>
+    struct NodeCountOf
+    {
+        static std::size_t Get(NodeBase const*)
+        {
+            return 1;
+        }
+
+        static void Set(NodeBase*, std::size_t)
+        {
+        }
+    };
+
+    template <typename NodeType>
+    struct NodeCountOf<NodeType, true>
+    {
+        static std::size_t Get(NodeBase const* p_Node)
+        {
+            return static_cast<NodeType const*>(p_Node)->Count;
+        }
+
+        static void Set(NodeBase* p_Node, std::size_t p_Count)
+        {
+            static_cast<NodeType*>(p_Node)->Count = p_Count;
+        }
+    };
+
+    /// Access to the block of a node, always null without spg_veb_layout.
+    template <typename NodeType, bool Stored>
+    struct NodeBlockOf
+    {
+        static NodeBlock* Get(NodeBase const*)
+        {
+            return nullptr;
+        }
+
+        static void Set(NodeBase*, NodeBlock*)
+        {
+        }
+    };
+
+    template <typename NodeType>
+    struct NodeBlockOf<NodeType, true>
+    {
+        static NodeBlock* Get(NodeBase const* p_Node)
+        {
+            return static_cast<NodeType const*>(p_Node)->Block;
+        }
+
+        static void Set(NodeBase* p_Node, NodeBlock* p_Block)
+        {
+            static_cast<NodeType*>(p_Node)->Block = p_Block;
+        }
+    };
+
+    /// Access to the subtree sizes, counted or stored in the nodes.
+    template <typename NodeType, bool Stored>
+    struct SubtreeSize
+    {
+        static std::size_t Get(NodeBase const* p_Node)
+        {
+            return Size(p_Node);
+        }
+
+        static void Update(NodeBase*)
+        {
+        }
+    };
+
+    template <typename NodeType>
+    struct SubtreeSize<NodeType, true>
+    {
+        static std::size_t Get(NodeBase const* p_Node)
+        {
+            return p_Node ? static_cast<NodeType const*>(p_Node)->Size : 0;
+        }
+
+        /// Recomputes the size of p_Node from its children.
+        static void Update(NodeBase* p_Node)
+        {
+            static_cast<NodeType*>(p_Node)->Size = Get(p_Node->Left) + Get(p_Node->Right) + 1;
+        }
+    };
+
+    /// Returns the node with the lowest key of the subtree of p_Node.
+    inline NodeBase* Leftmost(NodeBase* p_Node);
+
+    /// Returns the node with the greatest key of the subtree of p_Node.
+    inline NodeBase* Rightmost(NodeBase* p_Node);
+
+    /// Returns the in-order successor of p_Node.
+    /// The header (the node without parent, whose left child is the root)
+    /// comes after the last node and before the first one.
+    inline NodeBase* Increment(NodeBase* p_Node);
+
+    /// Returns the in-order predecessor of p_Node, the header included.
+    inline NodeBase* Decrement(NodeBase* p_Node);
+}
+
 template <typename T>
 class spg_reverse_iterator
 {
@@ -34,39 +241,27 @@ class spg_reverse_iterator
         using value_type = T;
         using iterator = spg_reverse_iterator<T>;
         using reference = value_type&;
-        using pointer = value_type&;
-        using link_type = Node<value_type>*;
+        using pointer = value_type*;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::bidirectional_iterator_tag;
+        using link_type = NodeBase*;
 
         link_type m_Node;
-        std::stack<link_type> m_Parents;
 
         spg_reverse_iterator()
-            : m_Node(nullptr),
-            m_Parents()
+            : m_Node(nullptr)
         {
 
         }
 
-        spg_reverse_iterator(link_type p_Node)
-            : m_Node(p_Node),
-            m_Parents()
-        {
-            if (m_Node)
-                go_right();
-        }
-
-        spg_reverse_iterator(self_type const& p_Itr)
+        explicit spg_reverse_iterator(link_type p_Node)
+            : m_Node(p_Node)
         {
-            if (this != &p_Itr)
-            {
-                m_Node = p_Itr.m_Node;
-                m_Parents = p_Itr.m_Parents;
-            }
         }
 
         reference operator*() const
         {
-            return m_Node->Key;
+            return static_cast<Node<value_type>*>(m_Node)->Key;
         }
 
         pointer operator->() const
@@ -76,27 +271,27 @@ class spg_reverse_iterator
 
         self_type& operator++()
         {
-            incr();
+            m_Node = details::Decrement(m_Node);
             return *this;
         }
 
         self_type operator++(int)
         {
             auto l_Tmp = *this;
-            incr();
+            m_Node = details::Decrement(m_Node);
             return l_Tmp;
         }
 
         self_type& operator--()
         {
-            decr();
+            m_Node = details::Increment(m_Node);
             return *this;
         }
 
         self_type operator--(int)
         {
             self_type l_Tmp = *this;
-            decr();
+            m_Node = details::Increment(m_Node);
             return l_Tmp;
         }
 
@@ -109,51 +304,6 @@ class spg_reverse_iterator
         {
             return !(operator==(p_Rhs));
         }
-
-    private:
-
-        void incr()
-        {
-            if (!m_Node)
-            {
-                m_Node = nullptr;
-                return;
-            }
-
-            m_Parents.pop();
-
-            if (m_Node->Left)
-            {
-                m_Node = (link_type)m_Node->Left;
-                go_right();
-            }
-            else if (!m_Parents.empty())
-                m_Node = m_Parents.top();
-            else
-                m_Node = nullptr;
-        }
-
-        // Iterates on the right side of the tree as much as possible.
-        void go_right()
-        {
-            while (m_Node->Right)
-            {
-                m_Parents.push(m_Node);
-                m_Node = (link_type)m_Node->Right;
-            }
-
-            m_Parents.push(m_Node);
-        }
-
-        void decr()
-        {
-            if (!m_Node)
-                return;
-
-            if (m_Node->Right)
-                m_Parents.push(m_Node->Right);
-            m_Node = (link_type)m_Node->Right;
-        }
 };
 
 template <typename T>
@@ -166,47 +316,31 @@ class spg_const_reverse_iterator
         using const_iterator = spg_const_reverse_iterator<T>;
         using reference = value_type const&;
         using pointer = value_type const*;
-        using link_type = Node<value_type> const*;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::bidirectional_iterator_tag;
+        using link_type = NodeBase const*;
 
         link_type m_Node;
-        std::stack<link_type> m_Parents;
 
         spg_const_reverse_iterator()
-            : m_Node(nullptr),
-            m_Parents()
+            : m_Node(nullptr)
         {
 
         }
 
-        spg_const_reverse_iterator(link_type p_Node)
-            : m_Node(p_Node),
-            m_Parents()
+        explicit spg_const_reverse_iterator(link_type p_Node)
+            : m_Node(p_Node)
         {
-            if (m_Node)
-                go_right();
-        }
-
-        spg_const_reverse_iterator(self_type const& p_Itr)
-        {
-            if (this != &p_Itr)
-            {
-                m_Node = p_Itr.m_Node;
-                m_Parents = p_Itr.m_Parents;
-            }
         }
 
         spg_const_reverse_iterator(iterator const& p_Itr)
+            : m_Node(p_Itr.m_Node)
         {
-            if (this != &p_Itr)
-            {
-                m_Node = p_Itr.m_Node;
-                m_Parents = p_Itr.m_Parents;
-            }
         }
 
         reference operator*() const
         {
-            return m_Node->Key;
+            return static_cast<Node<value_type> const*>(m_Node)->Key;
         }
 
         pointer operator->() const
@@ -216,27 +350,27 @@ class spg_const_reverse_iterator
 
         self_type& operator++()
         {
-            incr();
+            m_Node = details::Decrement(const_cast<NodeBase*>(m_Node));
             return *this;
         }
 
         self_type operator++(int)
         {
             auto l_Tmp = *this;
-            incr();
+            operator++();
             return l_Tmp;
         }
 
         self_type& operator--()
         {
-            decr();
+            m_Node = details::Increment(const_cast<NodeBase*>(m_Node));
             return *this;
         }
 
         self_type operator--(int)
         {
             self_type l_Tmp = *this;
-            decr();
+            operator--();
             return l_Tmp;
         }
 
@@ -249,51 +383,6 @@ class spg_const_reverse_iterator
         {
             return !(operator==(p_Rhs));
         }
-
-    private:
-
-        void incr()
-        {
-            if (!m_Node)
-            {
-                m_Node = nullptr;
-                return;
-            }
-
-            m_Parents.pop();
-
-            if (m_Node->Left)
-            {
-                m_Node = (link_type)m_Node->Left;
-                go_right();
-            }
-            else if (!m_Parents.empty())
-                m_Node = m_Parents.top();
-            else
-                m_Node = nullptr;
-        }
-
-        // Iterates on the right side of the tree as much as possible.
-        void go_right()
-        {
-            while (m_Node->Right)
-            {
-                m_Parents.push(m_Node);
-                m_Node = (link_type)m_Node->Right;
-            }
-
-            m_Parents.push(m_Node);
-        }
-
-        void decr()
-        {
-            if (!m_Node)
-                return;
-
-            if (m_Node->Right)
-                m_Parents.push(m_Node->Right);
-            m_Node = (link_type)m_Node->Right;
-        }
 };
 
 template <typename T>
@@ -304,39 +393,27 @@ class spg_iterator
         using value_type = T;
         using iterator = spg_iterator<T>;
         using reference = value_type&;
-        using pointer = value_type&;
-        using link_type = Node<value_type>*;
+        using pointer = value_type*;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::bidirectional_iterator_tag;
+        using link_type = NodeBase*;
 
         link_type m_Node;
-        std::stack<link_type> m_Parents;
 
         spg_iterator()
-            : m_Node(nullptr),
-            m_Parents()
+            : m_Node(nullptr)
         {
 
         }
 
-        spg_iterator(link_type p_Node)
-            : m_Node(p_Node),
-            m_Parents()
-        {
-            if (m_Node)
-                go_left();
-        }
-
-        spg_iterator(self_type const& p_Itr)
+        explicit spg_iterator(link_type p_Node)
+            : m_Node(p_Node)
         {
-            if (this != &p_Itr)
-            {
-                m_Node = p_Itr.m_Node;
-                m_Parents = p_Itr.m_Parents;
-            }
         }
 
         reference operator*() const
         {
-            return m_Node->Key;
+            return static_cast<Node<value_type>*>(m_Node)->Key;
         }
 
         pointer operator->() const
@@ -346,27 +423,27 @@ class spg_iterator
 
         self_type& operator++()
         {
-            incr();
+            m_Node = details::Increment(m_Node);
             return *this;
         }
 
         self_type operator++(int)
         {
             auto l_Tmp = *this;
-            incr();
+            m_Node = details::Increment(m_Node);
             return l_Tmp;
         }
 
         self_type& operator--()
         {
-            decr();
+            m_Node = details::Decrement(m_Node);
             return *this;
         }
 
         self_type operator--(int)
         {
             self_type l_Tmp = *this;
-            decr();
+            m_Node = details::Decrement(m_Node);
             return l_Tmp;
         }
 
@@ -379,51 +456,6 @@ class spg_iterator
         {
             return !(operator==(p_Rhs));
         }
-
-    private:
-
-        void incr()
-        {
-            if (!m_Node)
-            {
-                m_Node = nullptr;
-                return;
-            }
-
-            m_Parents.pop();
-
-            if (m_Node->Right)
-            {
-                m_Node = (link_type)m_Node->Right;
-                go_left();
-            }
-            else if (!m_Parents.empty())
-                m_Node = m_Parents.top();
-            else
-                m_Node = nullptr;
-        }
-
-        // Iterates on the left side of the tree as much as possible.
-        void go_left()
-        {
-            while (m_Node->Left)
-            {
-                m_Parents.push(m_Node);
-                m_Node = (link_type)m_Node->Left;
-            }
-
-            m_Parents.push(m_Node);
-        }
-
-        void decr()
-        {
-            if (!m_Node)
-                return;
-
-            if (m_Node->Left)
-                m_Parents.push(m_Node->Left);
-            m_Node = (link_type)m_Node->Left;
-        }
 };
 
 template <typename T>
@@ -435,48 +467,32 @@ class spg_const_iterator
         using iterator = spg_iterator<T>;
         using const_iterator = spg_const_iterator<T>;
         using reference = value_type const&;
-        using pointer = value_type const&;
-        using link_type = Node<value_type> const*;
+        using pointer = value_type const*;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::bidirectional_iterator_tag;
+        using link_type = NodeBase const*;
 
         link_type m_Node;
-        std::stack<link_type> m_Parents;
 
         spg_const_iterator()
-            : m_Node(nullptr),
-            m_Parents()
+            : m_Node(nullptr)
         {
 
         }
 
-        spg_const_iterator(link_type p_Node)
-            : m_Node(p_Node),
-            m_Parents()
+        explicit spg_const_iterator(link_type p_Node)
+            : m_Node(p_Node)
         {
-            if (m_Node)
-                go_left();
-        }
-
-        spg_const_iterator(self_type const& p_Itr)
-        {
-            if (this != &p_Itr)
-            {
-                m_Node = p_Itr.m_Node;
-                m_Parents = p_Itr.m_Parents;
-            }
         }
 
         spg_const_iterator(iterator const& p_Itr)
+            : m_Node(p_Itr.m_Node)
         {
-            if (this != &p_Itr)
-            {
-                m_Node = p_Itr.m_Node;
-                m_Parents = p_Itr.m_Parents;
-            }
         }
 
         reference operator*() const
         {
-            return m_Node->Key;
+            return static_cast<Node<value_type> const*>(m_Node)->Key;
         }
 
         pointer operator->() const
@@ -486,27 +502,27 @@ class spg_const_iterator
 
         self_type& operator++()
         {
-            incr();
+            m_Node = details::Increment(const_cast<NodeBase*>(m_Node));
             return *this;
         }
 
         self_type operator++(int)
         {
             auto l_Tmp = *this;
-            incr();
+            operator++();
             return l_Tmp;
         }
 
         self_type& operator--()
         {
-            decr();
+            m_Node = details::Decrement(const_cast<NodeBase*>(m_Node));
             return *this;
         }
 
         self_type operator--(int)
         {
             self_type l_Tmp = *this;
-            decr();
+            operator--();
             return l_Tmp;
         }
 
@@ -519,151 +535,589 @@ class spg_const_iterator
         {
             return !(operator==(p_Rhs));
         }
+};
 
-    private:
+/// Iterator on every copy of the keys of a spg_multiset tree: a key is
+/// visited as many times as its node counts it.
+/// @CountTraits : The details::NodeCountOf of the nodes.
+template <typename T, typename CountTraits>
+class spg_copy_iterator
+{
+    public:
+        using self_type = spg_copy_iterator<T, CountTraits>;
+        using value_type = T;
+        using reference = value_type const&;
+        using pointer = value_type const*;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::bidirectional_iterator_tag;
+        using link_type = NodeBase const*;
 
-        void incr()
+        link_type   m_Node;
+        std::size_t m_Copy;     ///< Index of the copy in the node, from 0.
+
+        spg_copy_iterator()
+            : m_Node(nullptr),
+            m_Copy(0)
         {
-            if (!m_Node)
-            {
-                m_Node = nullptr;
-                return;
-            }
 
-            m_Parents.pop();
+        }
+
+        explicit spg_copy_iterator(link_type p_Node, std::size_t p_Copy = 0)
+            : m_Node(p_Node),
+            m_Copy(p_Copy)
+        {
+        }
+
+        reference operator*() const
+        {
+            return static_cast<Node<value_type> const*>(m_Node)->Key;
+        }
 
-            if (m_Node->Right)
+        pointer operator->() const
+        {
+            return &(operator*());
+        }
+
+        self_type& operator++()
+        {
+            if (++m_Copy == CountTraits::Get(m_Node))
             {
-                m_Node = (link_type)m_Node->Right;
-                go_left();
+                m_Node = details::Increment(const_cast<NodeBase*>(m_Node));
+                m_Copy = 0;
             }
-            else if (!m_Parents.empty())
-                m_Node = m_Parents.top();
-            else
-                m_Node = nullptr;
+            return *this;
+        }
+
+        self_type operator++(int)
+        {
+            auto l_Tmp = *this;
+            operator++();
+            return l_Tmp;
         }
 
-        // Iterates on the left side of the tree as much as possible.
-        void go_left()
+        self_type& operator--()
         {
-            while (m_Node->Left)
+            if (m_Copy)
+                --m_Copy;
+            else
             {
-                m_Parents.push(m_Node);
-                m_Node = (link_type)m_Node->Left;
+                m_Node = details::Decrement(const_cast<NodeBase*>(m_Node));
+
+                /// The header, before the first key, holds no count.
+                m_Copy = m_Node->Parent ? CountTraits::Get(m_Node) - 1 : 0;
             }
+            return *this;
+        }
 
-            m_Parents.push(m_Node);
+        self_type operator--(int)
+        {
+            self_type l_Tmp = *this;
+            operator--();
+            return l_Tmp;
         }
 
-        void decr()
+        bool operator==(self_type const& p_Rhs) const
         {
-            if (!m_Node)
-                return;
+            return m_Node == p_Rhs.m_Node && m_Copy == p_Rhs.m_Copy;
+        }
 
-            if (m_Node->Left)
-                m_Parents.push(m_Node->Left);
-            m_Node = (link_type)m_Node->Left;
+        bool operator!=(self_type const& p_Rhs) const
+        {
+            return !(operator==(p_Rhs));
         }
 };
 
 /// ScapeGoat tree implementation from the paper ScapeGoat Tree
 /// of Igal Galperin and Ronald L. Rivest. The rebalancing method
 /// is the one of Day/Stout/Warren.
+/// @Options : see spg_options.hpp.
 template <typename T,
           typename Comparator = std::less<T>,
-          typename Alloc = std::allocator<T>>
+          typename Alloc = std::allocator<T>,
+          typename... Options>
 class SPG
 {
-    using NodeAllocator = typename Alloc::template rebind<Node<T>>::other;
-
     using node_base_type = NodeBase;
     using link_base_type = node_base_type*;
 
-    using node_type = Node<T>;
+    using node_type = typename details::NodeOf<T, Options...>::type;
     using link_type = node_type*;
 
-    using allocator_type = Alloc;
-    using value_type = T;
+    using NodeAllocator = typename std::allocator_traits<Alloc>::template rebind_alloc<node_type>;
+    using NodeAllocTraits = std::allocator_traits<NodeAllocator>;
+
+    /// True when the nodes store the size of their subtree.
+    static constexpr bool StoresSize = details::HasOption<spg_subtree_size, Options...>::value;
+    using size_traits = details::SubtreeSize<node_type, StoresSize>;
+
+    /// True when the tree keeps the spg_stats counters.
+    static constexpr bool CountsStats = details::HasOption<spg_stats, Options...>::value;
+    using stats_counter = details::StatsCounter<CountsStats>;
 
-    using iterator = spg_iterator<T>;
-    using const_iterator = spg_const_iterator<T>;
-    using reverse_iterator = spg_reverse_iterator<T>;
-    using const_reverse_iterator = spg_const_reverse_iterator<T>;
+    /// The height bounds, from the std::ratio option or from the alpha given at construction.
+    using alpha_traits = details::AlphaTraits<typename details::RatioOf<Options...>::type>;
+
+    /// True when the parents of an insertion fit in a fixed array on the
+    /// stack. An alpha close to 1 bounds the height by thousands of levels,
+    /// those trees use m_InsertPath as the runtime alphas do.
+    static constexpr bool FixedInsertPath = alpha_traits::IsStatic && alpha_traits::MaxHeight <= 128;
+
+    /// True when the rebuilds move the nodes in van Emde Boas order.
+    static constexpr bool RelocatesNodes = details::HasOption<spg_veb_layout, Options...>::value;
+    using block_traits = details::NodeBlockOf<node_type, RelocatesNodes>;
+
+    static_assert(!RelocatesNodes || std::is_nothrow_move_constructible<T>::value,
+                  "spg_veb_layout moves the keys in the middle of a rebuild");
+    static_assert(sizeof (details::NodeBlock) <= sizeof (node_type), "the header of a block takes a node slot");
+
+    /// True when the nodes count the copies of their key.
+    static constexpr bool CountsCopies = details::HasOption<spg_multiset, Options...>::value;
+    using count_traits = details::NodeCountOf<node_type, CountsCopies>;
+
+    /// True when the large rebuilds run on the shared thread pool.
+    static constexpr bool RebuildsInParallel = details::HasOption<spg_parallel_rebuild, Options...>::value;
+
+    /// The rebuild strategy, spg_dsw_rebuild unless spg_parallel_rebuild or spg_buffer_rebuild is given.
+    using rebuild_strategy = typename std::conditional<RebuildsInParallel,
+                                                       spg_parallel_rebuild,
+                                                       typename std::conditional<details::HasOption<spg_buffer_rebuild, Options...>::value,
+                                                                                 spg_buffer_rebuild,
+                                                                                 spg_dsw_rebuild>::type>::type;
 
     public:
+        using allocator_type = Alloc;
+        using value_type = T;
+        using key_compare = Comparator;
+
+        using iterator = spg_iterator<T>;
+        using const_iterator = spg_const_iterator<T>;
+        using reverse_iterator = spg_reverse_iterator<T>;
+        using const_reverse_iterator = spg_const_reverse_iterator<T>;
+        using copy_iterator = spg_copy_iterator<T, count_traits>;
+
         /// Constructs a space goat tree.
-        /// @p_Alpha : unbalance factor of the tree, MUST be in the interval [0.5, 1.0].
+        /// @p_Alpha : unbalance factor of the tree, MUST be in the interval [0.5, 1.0],
+        /// and MUST be the std::ratio option if there is one.
         SPG(float p_Alpha);
 
+        /// Constructs a space goat tree whose alpha is the std::ratio option.
+        SPG();
+
+        /// Constructs a perfectly balanced space goat tree from a range.
+        /// Linear when the range is sorted, it is sorted and deduped otherwise.
+        /// @p_First, p_Last : The range of keys.
+        /// @p_Alpha : unbalance factor of the tree, as for SPG(float).
+        template <typename InputIt>
+        SPG(InputIt p_First, InputIt p_Last, float p_Alpha);
+
+        /// The nodes are linked to the header of the tree, so the tree
+        /// can't be copied by value.
+        SPG(SPG const&) = delete;
+        SPG& operator=(SPG const&) = delete;
+
+        /// Moves the nodes of p_Other, its root is relinked to our header.
+        /// p_Other is left empty.
+        SPG(SPG&& p_Other);
+        SPG& operator=(SPG&& p_Other);
+
         /// We delete the pointers when we destroy our data structure.
         ~SPG();
 
-        /// Returns the size of the tree.
+        /// Destroys every key.
+        void clear();
+
+        /// Returns the alpha of the tree, the std::ratio option if there is one.
+        float alpha() const { return m_AlphaRatio; }
+
+        /// Returns the size of the tree, the number of distinct keys with spg_multiset.
         std::size_t size() const { return m_Size; };
 
         /// Returns true if the tree is empty.
         bool empty() const { return size() == 0; }
 
-        /// Returns the node with the given key in the tree.
+        /// Returns the number of subtree rebuilds since the construction.
+        std::size_t rebuild_count() const { return m_Rebuilds; }
+
+        /// Returns the iterator on the given key, end() if it is not in the tree.
+        /// @p_Key : The key we look for.
+        iterator find(value_type const& p_Key);
+        const_iterator find(value_type const& p_Key) const;
+
+        /// Returns true if the given key is in the tree.
         /// @p_Key : The key we look for.
-        link_type find(value_type const& p_Key);
+        bool contains(value_type const& p_Key) const;
+
+        /// Returns the number of copies of p_Key, at most 1 without spg_multiset.
+        std::size_t count(value_type const& p_Key) const
+        {
+            link_base_type l_Node = InternalFind(p_Key);
+            return l_Node ? count_traits::Get(l_Node) : 0;
+        }
+
+        /// Returns the iterator on the first key not less than p_Key. O(log n).
+        iterator lower_bound(value_type const& p_Key);
+        const_iterator lower_bound(value_type const& p_Key) const;
+
+        /// Returns the iterator on the first key greater than p_Key. O(log n).
+        iterator upper_bound(value_type const& p_Key);
+        const_iterator upper_bound(value_type const& p_Key) const;
+
+        /// Returns the range of the keys equivalent to p_Key (at most one).
+        std::pair<iterator, iterator> equal_range(value_type const& p_Key);
+        std::pair<const_iterator, const_iterator> equal_range(value_type const& p_Key) const;
+
+        /// The lookups above for any key type the comparator accepts, if it
+        /// declares is_transparent (as std::less<>). The key is compared as
+        /// is, no value_type is built: a set of std::string is searched with
+        /// a std::string_view or a char const* without allocating.
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        iterator find(K const& p_Key)
+        {
+            link_base_type l_Node = InternalFind(p_Key);
+            return l_Node ? iterator(l_Node) : end();
+        }
+
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        const_iterator find(K const& p_Key) const
+        {
+            link_base_type l_Node = InternalFind(p_Key);
+            return l_Node ? const_iterator(l_Node) : cend();
+        }
+
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        bool contains(K const& p_Key) const
+        {
+            return InternalFind(p_Key) != nullptr;
+        }
+
+        /// Counts every key equivalent to p_Key, as std::set does.
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        std::size_t count(K const& p_Key) const
+        {
+            std::size_t l_Count = 0;
+            for (auto l_It = lower_bound(p_Key), l_End = upper_bound(p_Key); l_It != l_End; ++l_It)
+                l_Count += count_traits::Get(l_It.m_Node);
+
+            return l_Count;
+        }
+
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        iterator lower_bound(K const& p_Key)
+        {
+            return iterator(InternalBound(p_Key, false));
+        }
+
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        const_iterator lower_bound(K const& p_Key) const
+        {
+            return const_iterator(InternalBound(p_Key, false));
+        }
+
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        iterator upper_bound(K const& p_Key)
+        {
+            return iterator(InternalBound(p_Key, true));
+        }
+
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        const_iterator upper_bound(K const& p_Key) const
+        {
+            return const_iterator(InternalBound(p_Key, true));
+        }
+
+        /// Several keys may be equivalent to a key of another type.
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        std::pair<iterator, iterator> equal_range(K const& p_Key)
+        {
+            return std::make_pair(lower_bound(p_Key), upper_bound(p_Key));
+        }
+
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        std::pair<const_iterator, const_iterator> equal_range(K const& p_Key) const
+        {
+            return std::make_pair(lower_bound(p_Key), upper_bound(p_Key));
+        }
+
+        /// Calls p_Function on every key in [p_Lo, p_Hi], in order.
+        /// Only the matching nodes are visited after one descent.
+        template <typename Function>
+        void for_each_in_range(value_type const& p_Lo, value_type const& p_Hi, Function p_Function) const;
+
+        /// Calls p_Function on every key, on up to p_Threads threads of the
+        /// shared pool: at most p_Threads subtrees a few levels below the root
+        /// are visited in parallel, each one in order, then the keys above
+        /// them. p_Function is shared by the threads and must be safe to call
+        /// concurrently. If p_Function throws, the first exception is rethrown
+        /// once every part is visited.
+        template <typename Function>
+        void parallel_for_each(Function p_Function, std::size_t p_Threads = std::thread::hardware_concurrency()) const;
+
+        /// Folds the keys on p_Threads threads. The subtrees visited in
+        /// parallel, and every key above them, are folded from p_Init with
+        /// p_Accumulate(R, key), then the results are folded in key order
+        /// with p_Reduce(R, R). p_Reduce must be associative and p_Init
+        /// neutral for it, as for a sum from 0. The threads are taken from
+        /// the shared pool as for parallel_for_each, and an exception thrown
+        /// by p_Accumulate is rethrown once every part is folded.
+        template <typename R, typename Accumulate, typename Reduce>
+        R parallel_reduce(R p_Init, Accumulate p_Accumulate, Reduce p_Reduce,
+                          std::size_t p_Threads = std::thread::hardware_concurrency()) const;
 
         /// Insert a new node in the tree with the corresponding given key.
         /// It will rebalance the tree if needed according to the unbalance factor.
+        /// With spg_multiset, a key already in the tree gets one more copy.
         /// @p_Key : The key to insert.
         /// Returns true if the key was inserted, false otherwise.
         bool insert(value_type const& p_Key);
+        bool insert(value_type&& p_Key);
+
+        /// Inserts p_Key, looking for its place from p_Hint: the descent
+        /// starts from the lowest ancestor of p_Hint whose subtree holds the
+        /// place (finger search), so a hint close to p_Key saves most of the
+        /// comparisons. end() is a good hint for increasing keys.
+        /// Returns the iterator on the equivalent key.
+        iterator insert(const_iterator p_Hint, value_type const& p_Key);
+        iterator insert(const_iterator p_Hint, value_type&& p_Key);
+
+        /// Constructs a key from p_Args and inserts it if it is not in the tree.
+        /// The key is built on the stack, a node is only allocated if it is new.
+        /// Returns the iterator on the equivalent key and true if it was inserted.
+        template <typename... Args>
+        std::pair<iterator, bool> emplace(Args&&... p_Args);
+
+        /// Insert the keys of a range, keys already in the tree are ignored.
+        /// The tree is merged with the sorted keys and relinked perfectly
+        /// balanced in linear time, the range is sorted first if needed.
+        /// @p_First, p_Last : The range of keys.
+        template <typename InputIt>
+        void insert_range(InputIt p_First, InputIt p_Last);
+
+        /// Replaces the keys by those of a range, perfectly balanced, on up
+        /// to p_Threads threads of the shared pool: the keys are copied,
+        /// sorted and deduped, then moved in their nodes and linked by
+        /// independent subtrees, in p_Threads chunks. The nodes are allocated
+        /// by the calling thread only.
+        /// @p_First, p_Last : The range of keys.
+        template <typename RandomIt>
+        void parallel_build(RandomIt p_First, RandomIt p_Last, std::size_t p_Threads = std::thread::hardware_concurrency());
+
+        /// Starts a batch: the insertions skip the scapegoat search until
+        /// end_batch(), which rebuilds only the subtrees left too deep.
+        /// Meanwhile the tree is kept under twice the alpha height, so that
+        /// sorted bursts don't degrade the descents.
+        void begin_batch();
+
+        /// Ends the batch and restores the alpha height in one pass.
+        void end_batch();
+
+        /// Inserts the keys of a range in one batch.
+        /// @p_First, p_Last : The range of keys.
+        /// Returns the number of keys inserted.
+        template <typename InputIt>
+        std::size_t insert_batch(InputIt p_First, InputIt p_Last);
+
+        ////////////////////////
+        ///   Set algebra, linear
+        ///   merges of the keys.
+        ////////////////////////
+
+        /// Moves the keys of p_Other in the tree, p_Other is left empty. Its nodes
+        /// are relinked when the allocators are equal, its duplicates destroyed.
+        /// O(n + m), the tree is relinked perfectly balanced.
+        void merge(SPG&& p_Other);
+
+        /// Inserts the keys of p_Other. O(n + m).
+        void merge(SPG const& p_Other);
+
+        /// Erases the keys which are not in p_Other. O(n + m).
+        void intersect_with(SPG const& p_Other);
+
+        /// Erases the keys which are in p_Other. O(n + m).
+        void subtract(SPG const& p_Other);
+
+        ////////////////////////
+        ///  Partitioning.
+        ////////////////////////
+
+        /// Moves the keys not less than p_Key to a new tree, which is returned.
+        /// Both trees keep the maximum size of the tree: their height is
+        /// unchanged and they get rebuilt lazily as they shrink.
+        /// O(log n) with spg_subtree_size, the returned keys are counted otherwise.
+        /// The returned tree shares our allocator, with spg_pool_allocator
+        /// both trees must then be used from the same thread.
+        SPG split(value_type const& p_Key);
+
+        /// Appends the keys of p_Right, which MUST all be greater than ours.
+        /// p_Right is left empty. The smaller tree is hung under the extreme
+        /// node of the bigger one in O(log n); if it ends up too deep, the
+        /// smallest subtree above it which fits is rebuilt.
+        void join(SPG&& p_Right);
 
         /// Erases the elements which value is p_Key.
+        /// The whole tree is rebuilt once its size drops under alpha * max size.
         /// @p_Key : The key to erase.
-        /// Returns the number of elements erased.
+        /// Returns the number of elements erased, every copy of p_Key with spg_multiset.
         std::size_t erase(value_type const& p_Key);
 
+        /// erase for any key type the comparator accepts, if it declares
+        /// is_transparent. Erases every key equivalent to p_Key, as
+        /// std::set does: each descent takes one of them.
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        std::size_t erase(K const& p_Key)
+        {
+            std::size_t l_Erased = 0;
+            while (std::size_t l_Copies = EraseKey(p_Key))
+                l_Erased += l_Copies;
+
+            return l_Erased;
+        }
+
+        /// Erases one copy of p_Key, its node only goes with the last copy.
+        /// Returns the number of copies erased, 0 or 1.
+        std::size_t erase_one(value_type const& p_Key)
+        {
+            return EraseKey(p_Key, true);
+        }
+
+        /// Erases every copy of p_Key, as erase does.
+        /// Returns the number of copies erased.
+        std::size_t erase_all(value_type const& p_Key)
+        {
+            return EraseKey(p_Key);
+        }
+
         /// print the tree on the cout.
         void print() const;
 
+        /// Returns an immutable snapshot of the keys, laid out for fast lookups.
+        FrozenSPG<value_type, Comparator> freeze() const
+        {
+            return FrozenSPG<value_type, Comparator>(cbegin(), m_Size, m_Impl.m_KeyComparator);
+        }
+
+        ////////////////////////
+        ///    Snapshots,
+        ///  trivially copyable
+        ///     keys only.
+        ////////////////////////
+
+        /// save and load are defined in spg_snapshot.hpp.
+
+        /// Writes the keys in order to p_Path, after a versioned header.
+        /// The file is written next to p_Path and renamed over it once
+        /// complete, a failed save leaves the previous snapshot in place.
+        /// Returns false if the file could not be written.
+        bool save(char const* p_Path) const;
+
+        /// Replaces the keys by those of a snapshot made by save(). The file
+        /// is mapped and the tree built perfectly balanced in one pass.
+        /// Returns false, leaving the tree untouched, if p_Path can't be read
+        /// or is not a snapshot of sorted keys of this type. If an allocation
+        /// throws, the tree is untouched as well.
+        bool load(char const* p_Path);
+
+        ////////////////////////
+        ///  Instrumentation,
+        ///  spg_stats only.
+        ////////////////////////
+
+        /// Returns a snapshot of the counters.
+        spg_statistics stats() const
+        {
+            static_assert(CountsStats, "SPG::stats needs the spg_stats option");
+            return m_Impl.m_Stats;
+        }
+
+        /// Sets every counter back to zero.
+        void reset_stats()
+        {
+            static_assert(CountsStats, "SPG::reset_stats needs the spg_stats option");
+            m_Impl.m_Stats = spg_statistics();
+        }
+
+        ////////////////////////
+        ///  Order statistics,
+        ///  spg_subtree_size only.
+        ////////////////////////
+
+        /// Returns the iterator on the p_K-th smallest key (from 0), end() if
+        /// there are not that many keys. O(log n).
+        iterator nth(std::size_t p_K);
+        const_iterator nth(std::size_t p_K) const;
+
+        /// Returns the number of keys strictly less than p_Key. O(log n).
+        std::size_t rank(value_type const& p_Key) const;
+
+        /// Returns the number of keys in [p_Lo, p_Hi]. O(log n).
+        std::size_t count_between(value_type const& p_Lo, value_type const& p_Hi) const;
+
         ////////////////////////
         ///     Iterators.
         ////////////////////////
 
+        /// The iterators only hold a node, the end is the header of the tree.
+
         iterator begin()
         {
-            return iterator((link_type)m_Impl.m_Root);
+            return iterator(details::Leftmost(&m_Impl.m_Header));
+        }
+
+        const_iterator begin() const
+        {
+            return cbegin();
         }
 
         reverse_iterator rbegin()
         {
-            return reverse_iterator((link_type)m_Impl.m_Root);
+            return reverse_iterator(details::Decrement(&m_Impl.m_Header));
         }
 
         const_iterator cbegin() const
         {
-            return const_iterator((link_type)m_Impl.m_Root);
+            return const_iterator(details::Leftmost(GetHeader()));
         }
 
         const_reverse_iterator crbegin() const
         {
-            return const_reverse_iterator((link_type)m_Impl.m_Root);
+            return const_reverse_iterator(details::Decrement(GetHeader()));
         }
 
         iterator end()
         {
-            return iterator(nullptr);
+            return iterator(&m_Impl.m_Header);
+        }
+
+        const_iterator end() const
+        {
+            return cend();
         }
 
         reverse_iterator rend()
         {
-            return reverse_iterator(nullptr);
+            return reverse_iterator(&m_Impl.m_Header);
         }
 
         const_iterator cend() const
         {
-            return const_iterator(nullptr);
+            return const_iterator(&m_Impl.m_Header);
         }
 
         const_reverse_iterator crend() const
         {
-            return const_reverse_iterator(nullptr);
+            return const_reverse_iterator(&m_Impl.m_Header);
+        }
+
+        /// The iterators above visit each key once, the copy iterators visit
+        /// each copy of the keys of spg_multiset.
+
+        copy_iterator copies_begin() const
+        {
+            return copy_iterator(details::Leftmost(GetHeader()));
+        }
+
+        copy_iterator copies_end() const
+        {
+            return copy_iterator(&m_Impl.m_Header);
         }
 
     protected:
@@ -693,31 +1147,39 @@ class SPG
         /// Allocates one node and returns the adress of the new memory space.
         inline link_type AllocateNode()
         {
-            return m_Impl.NodeAllocator::allocate(1);
+            link_type l_Node = NodeAllocTraits::allocate(GetNodeAllocator(), 1);
+            block_traits::Set(l_Node, nullptr);
+            count_traits::Set(l_Node, 1);
+            return l_Node;
         }
 
         /// Deallocate one node from the given adress node.
         /// @p_Node : The adress of the node memory to deallocate.
         inline void DeallocateNode(link_type p_Node)
         {
-            m_Impl.NodeAllocator::deallocate(p_Node, 1);
+            details::NodeBlock* l_Block = block_traits::Get(p_Node);
+            if (!l_Block)
+                NodeAllocTraits::deallocate(GetNodeAllocator(), p_Node, 1);
+            else if (!--l_Block->Live)
+                NodeAllocTraits::deallocate(GetNodeAllocator(), reinterpret_cast<link_type>(l_Block), l_Block->Slots + 1);
         }
 
         /// Creates a node, allocates and constructs the value in it.
-        /// @p_Val : The value of the node.
+        /// @p_Args : The arguments of the value constructor.
         /// Returns the pointer of the new node.
-        inline link_type CreateNode(value_type const& p_Val)
+        template <typename... Args>
+        inline link_type CreateNode(Args&&... p_Args)
         {
             auto l_Tmp = AllocateNode();
 
             try
             {
-                GetNodeAllocator().construct(&l_Tmp->Key, p_Val);
+                NodeAllocTraits::construct(GetNodeAllocator(), &l_Tmp->Key, std::forward<Args>(p_Args)...);
             }
             catch (...)
             {
                 DeallocateNode(l_Tmp);
-                /// We should throw the exception here.
+                throw;
             }
 
             return l_Tmp;
@@ -727,30 +1189,136 @@ class SPG
         /// @p_Node : The adress of the node to destroy.
         void DestroyNode(link_type p_Node)
         {
-            GetAllocator().destroy(&p_Node->Key);
+            NodeAllocTraits::destroy(GetNodeAllocator(), &p_Node->Key);
             DeallocateNode(p_Node);
         }
 
+        ////////////////////////
+        /// Key generic core,
+        /// shared with SPGMap.
+        ////////////////////////
+
+        /// Inserts a node constructed from p_Args if no node is equivalent to p_Key.
+        /// The node is only constructed once p_Key is known to be new, p_Key is
+        /// not used after that so it may be moved from by the construction.
+        /// Returns the node equivalent to p_Key and true if it was inserted.
+        template <typename Key, typename... Args>
+        std::pair<link_type, bool> InsertUnique(Key const& p_Key, Args&&... p_Args)
+        {
+            return InsertNear(nullptr, p_Key, std::forward<Args>(p_Args)...);
+        }
+
+        /// InsertUnique starting the search from p_Hint, or from the root if it is null.
+        /// Keys greater than the greatest one are appended without any descent.
+        /// With spg_multiset, an equivalent node gets one more copy and the
+        /// insertion succeeds.
+        template <typename Key, typename... Args>
+        std::pair<link_type, bool> InsertNear(link_base_type p_Hint, Key const& p_Key, Args&&... p_Args);
+
+        /// Erases the node equivalent to p_Key.
+        /// @p_OneCopy : With spg_multiset, only takes one copy off the node,
+        /// which is erased with its last copy.
+        /// Returns the number of copies erased.
+        template <typename Key>
+        std::size_t EraseKey(Key const& p_Key, bool p_OneCopy = false);
+
+        /// Returns the node equivalent to p_Key, null if there is none.
+        /// @p_Key : The key we look for.
+        template <typename Key>
+        link_base_type InternalFind(Key const& p_Key) const;
+
+        /// Returns the node with the first key not less than p_Key
+        /// (greater than p_Key if p_Strict is set), the header if there is none.
+        template <typename Key>
+        link_base_type InternalBound(Key const& p_Key, bool p_Strict) const;
+
         ////////////////////////
         ////////////////////////
 
         /// Implementation class of the ScapeGoat tree.
         /// Corresponds to the allocator also.
-        struct SPG_Impl : public NodeAllocator
+        struct SPG_Impl : public NodeAllocator, public stats_counter
         {
-            link_base_type m_Root; ///< Root of the tree.
+            node_base_type m_Header; ///< Its left child is the root of the tree, it has no parent.
             Comparator m_KeyComparator;
 
             SPG_Impl(NodeAllocator const& p_Allocator = NodeAllocator(),
                      Comparator const& p_Comparator = Comparator())
                 : NodeAllocator(p_Allocator),
-                m_Root(nullptr),
+                stats_counter(),
+                m_Header{nullptr, nullptr, nullptr},
                 m_KeyComparator(p_Comparator)
             {
             }
         };
 
     private:
+        /// Returns the header of the tree.
+        inline link_base_type GetHeader() const
+        {
+            return const_cast<link_base_type>(&m_Impl.m_Header);
+        }
+
+        /// Returns the root of the tree.
+        inline link_type GetRoot() const
+        {
+            return static_cast<link_type>(m_Impl.m_Header.Left);
+        }
+
+        /// Replaces the root of the tree and links it to the header.
+        /// @p_Root : The new root, may be null.
+        inline void SetRoot(link_base_type p_Root)
+        {
+            m_Rightmost = nullptr;
+            m_Impl.m_Header.Left = p_Root;
+            if (p_Root)
+                p_Root->Parent = &m_Impl.m_Header;
+        }
+
+        /// Returns the greatest node of a non empty tree and sets m_RightmostDepth.
+        /// The node is kept by the appends and forgotten by the operations
+        /// which may move it, it is then found again from the root.
+        inline link_type GetRightmost()
+        {
+            if (!m_Rightmost)
+            {
+                link_base_type l_Node = GetRoot();
+                m_RightmostDepth = 0;
+                for (; l_Node->Right; l_Node = l_Node->Right)
+                    ++m_RightmostDepth;
+
+                m_Rightmost = static_cast<link_type>(l_Node);
+            }
+
+            return m_Rightmost;
+        }
+
+        /// Returns the depth of p_Node, 0 for the root.
+        inline std::size_t Depth(link_base_type p_Node) const
+        {
+            std::size_t l_Depth = 0;
+            for (; p_Node->Parent != GetHeader(); p_Node = p_Node->Parent)
+                ++l_Depth;
+            return l_Depth;
+        }
+
+        /// Returns the counters of the tree, empty without spg_stats.
+        inline stats_counter& GetStats()
+        {
+            return m_Impl;
+        }
+
+        /// Handles an insertion whose key is already in p_Node: one more copy
+        /// with spg_multiset, a failure otherwise.
+        inline std::pair<link_type, bool> InsertCopy(link_type p_Node)
+        {
+            if (!CountsCopies)
+                return std::make_pair(p_Node, false);
+
+            count_traits::Set(p_Node, count_traits::Get(p_Node) + 1);
+            return std::make_pair(p_Node, true);
+        }
+
         /// Returns the key of a NodeBase.
         /// @p_NodeBase : The node.
         inline value_type const& GetKey(link_base_type p_NodeBase) const
@@ -765,46 +1333,49 @@ class SPG
         /// @p_Ind : The pointer to the top of the stacked parents.
         /// @p_TotalSize : The size of the subtree under the scapegoat node.
         /// Returns the space goat node if found, the root otherwise, and its parent.
-        inline std::pair<link_type, link_type> FindScapeGoatNode(link_type p_Node, link_type* p_Parents, std::size_t p_Ind, std::size_t& p_TotalSize) const;
+        inline std::pair<link_type, link_type> FindScapeGoatNode(link_type p_Node, link_type* p_Parents, std::size_t p_Ind, std::size_t& p_TotalSize);
 
         /// Insert the given key in the tree.
         /// @p_Root : The root of the tree to insert into.
         /// @p_Key : The given key to insert.
         /// @p_Parents : The stacked parents for more ocess.
-        /// @p_NewNode : The new node that will be allocated and created in the method.
-        /// Returns a pair containing the height of the new node and its pointer.
-        inline int InsertKey(link_type p_Root, value_type const& p_Key, link_type* p_Parents) const;
+        /// Returns the height of the new node, -1 if the key is already in the
+        /// tree, its node is then stored in p_Parents[0].
+        template <typename Key>
+        inline int InsertKey(link_type p_Root, Key const& p_Key, link_type* p_Parents) const;
+
+        /// Returns the lowest node among p_Hint and its ancestors whose
+        /// subtree holds the place of p_Key.
+        template <typename Key>
+        link_type FingerStart(link_base_type p_Hint, Key const& p_Key) const;
 
-        /// Recursively destroy the whole tree.
+        /// Recursively destroy the whole subtree, p_N included.
         /// @p_N : The root of the subtree to destroy.
         void DestroyRec(link_base_type p_N);
 
         /// Calculate the alpha height of the tree based on the size given.
         /// @p_N : The size of the tree.
         /// Returns the alpha height value.
-        inline float HeightAlpha(std::size_t p_N) const
+        inline typename alpha_traits::height_type HeightAlpha(std::size_t p_N) const
         {
-            return std::log(p_N) / m_Alpha;
+            return alpha_traits::Height(p_N, m_Alpha);
         }
 
-        /// Returns the node with the given key in the tree.
-        /// @p_Node : The node to begin with.
-        /// @p_Key : The key we look for.
-        link_type InternalFind(link_type p_Node, int p_Key);
-
         /// Creates a node and returns it.
-        /// @p_Key : The key of the new node.
         /// @p_Parent : The parent of the new node.
-        inline link_type BuildNode(value_type const& p_Key,
-                                   link_type p_Parent)
+        /// @p_Args : The arguments of the key constructor.
+        template <typename... Args>
+        inline link_type BuildNode(link_type p_Parent, Args&&... p_Args)
         {
             /// Build our new node.
-            auto l_NewNode = CreateNode(p_Key);
+            auto l_NewNode = CreateNode(std::forward<Args>(p_Args)...);
             l_NewNode->Left = nullptr;
             l_NewNode->Right = nullptr;
+            l_NewNode->Parent = p_Parent;
+            size_traits::Update(l_NewNode);
 
             /// We link ourself with the parent.
-            if (m_Impl.m_KeyComparator(p_Key, p_Parent->Key))
+            if (m_Impl.m_KeyComparator(l_NewNode->Key, p_Parent->Key))
                 p_Parent->Left = l_NewNode;
             else
                 p_Parent->Right = l_NewNode;
@@ -813,21 +1384,318 @@ class SPG
         }
 
         /// Creates the root.
-        /// @p_Key : The key of the root.
-        void BuildRootNode(value_type const& p_Key)
-        {
-            m_Impl.m_Root = CreateNode(p_Key);
-            m_Impl.m_Root->Left = nullptr;
-            m_Impl.m_Root->Right = nullptr;
+        /// @p_Args : The arguments of the key constructor.
+        /// Returns the root.
+        template <typename... Args>
+        link_type BuildRootNode(Args&&... p_Args)
+        {
+            link_type l_Root = CreateNode(std::forward<Args>(p_Args)...);
+            l_Root->Left = nullptr;
+            l_Root->Right = nullptr;
+            size_traits::Update(l_Root);
+            SetRoot(l_Root);
             ++m_Size;
+            m_MaxSize = std::max(m_MaxSize, m_Size);
+            GetStats().OnInsert(0);
+            return l_Root;
+        }
+
+        /// Returns the node with the p_K-th smallest key, the header if there is none.
+        link_base_type NthNode(std::size_t p_K) const;
+
+        /// Returns the number of keys less than p_Key, or not greater
+        /// than p_Key if p_Inclusive is set.
+        std::size_t CountLess(value_type const& p_Key, bool p_Inclusive) const;
+
+        /// Links back the parents of a relinked subtree and recomputes its sizes.
+        /// @p_Node : The root of the subtree.
+        void LinkSubtree(link_base_type p_Node);
+
+        /// Recomputes the sizes from p_Node up to the root.
+        inline void UpdateSizesUp(link_base_type p_Node)
+        {
+            if (!StoresSize)
+                return;
+
+            for (; p_Node != &m_Impl.m_Header; p_Node = p_Node->Parent)
+                size_traits::Update(p_Node);
+        }
+
+        /// Says if the range is sorted without duplicates.
+        template <typename ForwardIt>
+        bool IsStrictlySorted(ForwardIt p_First, ForwardIt p_Last) const
+        {
+            return std::adjacent_find(p_First, p_Last, [this](value_type const& p_Lhs, value_type const& p_Rhs)
+            {
+                return !m_Impl.m_KeyComparator(p_Lhs, p_Rhs);
+            }) == p_Last;
+        }
+
+        /// Calls p_Function on the keys of a subtree, in order.
+        template <typename Function>
+        void ForEachIn(link_base_type p_Node, Function& p_Function) const
+        {
+            for (; p_Node; p_Node = p_Node->Right)
+            {
+                ForEachIn(p_Node->Left, p_Function);
+                p_Function(GetKey(p_Node));
+            }
+        }
+
+        /// Merges the tree with the keys of p_Other in one pass and relinks it.
+        /// The flags say which keys stay: those only in the tree, those in
+        /// both (our nodes are kept) and those only in p_Other (copied).
+        void Combine(SPG const& p_Other, bool p_KeepOurs, bool p_KeepBoth, bool p_KeepTheirs);
+
+        /// Takes the nodes of p_Other, which is left empty.
+        void StealNodes(SPG& p_Other);
+
+        /// InsertUnique during a batch: a plain descent, no parents are stacked.
+        template <typename Key, typename... Args>
+        std::pair<link_type, bool> InsertDeferred(Key const& p_Key, Args&&... p_Args);
+
+        /// Computes m_BatchDepth again for the size of the tree.
+        void UpdateBatchDepth();
+
+        /// Returns the height of the subtree of p_Node, 0 for a leaf.
+        static std::size_t Height(link_base_type p_Node);
+
+        /// Rebuilds the smallest subtree above p_Node which brings it back
+        /// under the alpha height, if it is too deep.
+        /// @p_Below : The height of the subtree of p_Node, if it isn't rebuilt.
+        void RestoreDepth(link_base_type p_Node, std::size_t p_Below = 0);
+
+        /// Hangs the tree of p_Root under our leftmost or rightmost node.
+        /// @p_N : The size of the hung tree.
+        /// @p_MaxSize : Its maximum size, which bounds its height.
+        /// @p_AtRight : True if its keys are greater than ours.
+        void Graft(link_base_type p_Root, std::size_t p_N, std::size_t p_MaxSize, bool p_AtRight);
+
+        /// Rebuilds the subtree of p_Root and links it back in its place.
+        /// @p_Root : The root of the subtree.
+        /// @p_N : The size of the subtree.
+        void RebuildAt(link_base_type p_Root, std::size_t p_N);
+
+        /// Restores the alpha height of the nodes inserted since the last flush
+        /// and of the subtrees rebuilt meanwhile.
+        void FlushBatch();
+
+        /// insert_range for forward iterators, sorted ranges are used in place.
+        template <typename ForwardIt>
+        void InsertRange(ForwardIt p_First, ForwardIt p_Last, std::forward_iterator_tag);
+
+        /// insert_range for input iterators, the keys are copied and sorted.
+        template <typename InputIt>
+        void InsertRange(InputIt p_First, InputIt p_Last, std::input_iterator_tag);
+
+        /// Merges a sorted range without duplicates into the tree.
+        /// @p_First, p_Last : The sorted range of keys.
+        template <typename ForwardIt>
+        void InsertSorted(ForwardIt p_First, ForwardIt p_Last);
+
+        /// Builds a perfectly balanced subtree from a sorted range, in order.
+        /// @p_First : The first key, moved forward past the consumed keys.
+        /// @p_N : The number of keys to take.
+        /// Returns the root of the new subtree.
+        template <typename InputIt>
+        link_type BuildSorted(InputIt& p_First, std::size_t p_N);
+
+        /// Links the given nodes as a perfectly balanced subtree.
+        /// @p_Nodes : The nodes, in order.
+        /// @p_N : The number of nodes.
+        /// Returns the root of the subtree.
+        link_type LinkBalanced(link_type* p_Nodes, std::size_t p_N);
+
+        /// Links the given nodes with most of them in a balanced left subtree
+        /// and a short right spine, so that appends have room before the next
+        /// rebuild.
+        /// @p_Nodes : The nodes, in order.
+        /// @p_N : The number of nodes.
+        /// @p_Levels : The number of levels the subtree may use, at least the
+        /// ones of a balanced subtree.
+        /// Returns the root of the subtree.
+        link_type LinkSkewed(link_type* p_Nodes, std::size_t p_N, std::size_t p_Levels);
+
+        /// Rebuilds the subtree into one new block of nodes in van Emde Boas
+        /// order, and frees the old nodes. The tree is left untouched if the
+        /// block can't be allocated.
+        /// @p_Follow : If not null, a node of the subtree whose pointer
+        /// is updated when it moves.
+        /// Returns the new root of the subtree, null if nothing was done.
+        link_type RelocateTree(std::size_t p_N, link_base_type p_SPN, link_type* p_Follow);
+
+        /// Moves the nodes of a subtree linked in any shape into one new block
+        /// in van Emde Boas order, keeping the shape, and frees the old nodes.
+        /// The subtree is left where it is if the block can't be allocated.
+        /// @p_Root : The root of the subtree, of p_N nodes.
+        /// @p_Follow : As for RelocateTree.
+        /// Returns the root of the subtree, linked to the parent of the old one.
+        link_type RelocateLinked(link_type p_Root, std::size_t p_N, link_type* p_Follow);
+
+        /// Relocates the whole tree once the rebuilds moved more nodes than
+        /// it holds since the last time, so that the blocks left partly used
+        /// by these moves never hold more slots than the tree has nodes.
+        /// @p_Follow : As for RelocateTree.
+        void RelayoutIfSparse(link_type* p_Follow);
+
+        /// Appends the nodes of the p_Height top levels of the subtree of
+        /// p_Node in van Emde Boas order, whatever its shape.
+        static void VebNodes(link_base_type p_Node, std::size_t p_Height, std::vector<link_type>& p_Order);
+
+        /// Appends, for each node p_Depth levels below p_Node, the nodes of
+        /// the p_Height top levels of its subtree in van Emde Boas order.
+        static void VebNodesBelow(link_base_type p_Node, std::size_t p_Depth, std::size_t p_Height, std::vector<link_type>& p_Order);
+
+        /// Appends the positions in the sorted nodes of the nodes of the
+        /// p_Height top levels of the LinkBalanced subtree of the range
+        /// [p_First, p_First + p_N), in van Emde Boas order: the top half of
+        /// the levels, then each subtree below it.
+        static void VebOrder(std::size_t p_First, std::size_t p_N, std::size_t p_Height, std::vector<std::size_t>& p_Order);
+
+        /// Calls VebOrder on the subtrees p_Depth levels below the root of
+        /// the range, from left to right.
+        static void VebBottoms(std::size_t p_First, std::size_t p_N, std::size_t p_Depth, std::size_t p_Height,
+                               std::vector<std::size_t>& p_Order);
+
+        /// Appends the nodes of a subtree, in order.
+        /// @p_Node : The root of the subtree.
+        /// @p_Nodes : The array to fill.
+        void Flatten(link_base_type p_Node, std::vector<link_type>& p_Nodes) const;
+
+        /// Rebuilds the subtree with the Day/Stout/Warren algorithm.
+        link_type RebuildTree(std::size_t p_N, link_base_type p_SPN, spg_dsw_rebuild);
+
+        /// Rebuilds the subtree by flattening it in m_RebuildBuffer.
+        link_type RebuildTree(std::size_t p_N, link_base_type p_SPN, spg_buffer_rebuild);
+
+        /// Rebuilds the subtree through m_RebuildBuffer, by parts on the
+        /// shared thread pool past spg_parallel_rebuild::Threshold nodes.
+        link_type RebuildTree(std::size_t p_N, link_base_type p_SPN, spg_parallel_rebuild);
+
+        /// Flatten for big subtrees: the subtrees a few levels below p_Node
+        /// are flattened on p_Pool, then put together in order.
+        void FlattenParallel(link_base_type p_Node, std::vector<link_type>& p_Nodes, details::ThreadPool& p_Pool) const;
+
+        /// LinkBalanced for big subtrees: the parts of at least
+        /// spg_parallel_rebuild::Threshold nodes, a few per thread of
+        /// p_Threads, are linked on the shared pool.
+        link_type LinkParallel(link_type* p_Nodes, std::size_t p_N, std::size_t p_Threads);
+
+        /// Walks the top levels of LinkBalanced down to the parts linked in
+        /// parallel. The root of a part is known before it is linked.
+        /// @p_Levels : The number of levels left to split.
+        /// @p_Tasks : Gets a task per part if not null, otherwise the top
+        /// levels are linked to the roots of the parts.
+        link_type LinkTop(link_type* p_Nodes, std::size_t p_N, std::size_t p_Levels,
+                          std::vector<std::function<void()>>* p_Tasks);
+
+        /// Lists the nodes of the p_Levels top levels of a subtree in order
+        /// in p_Top, with a null in place of each subtree below them, and
+        /// these subtrees in p_Parts.
+        void SplitTop(link_base_type p_Node, std::size_t p_Levels,
+                      std::vector<link_base_type>& p_Top,
+                      std::vector<link_base_type>& p_Parts) const;
+
+        /// The number of levels to split for a few parts per thread.
+        static std::size_t ParallelLevels(std::size_t p_Threads);
+
+        /// The threads of the shared pool a parallel visit asked for p_Threads
+        /// uses, 1 when the tree is too small to be worth them.
+        std::size_t ParallelThreads(std::size_t p_Threads) const;
+
+        /// Rebuilds the subtree of a scapegoat found by an append with
+        /// LinkSkewed, through m_RebuildBuffer whatever the rebuild strategy.
+        /// Sorted or nearly sorted insertions would otherwise rebuild the
+        /// right spine again after a few appends.
+        /// @p_Levels : The number of levels below the parent of the scapegoat
+        /// that keep the nodes within the alpha height.
+        /// @p_Follow : As for RebuildTree, the nodes move with spg_veb_layout.
+        link_type RebuildForAppend(std::size_t p_N, link_base_type p_SPN, std::size_t p_Levels, link_type* p_Follow);
+
+        /// Rebuilds a perfectly balanced subtree with the rebuild strategy of the tree.
+        /// @p_N : The size of the subtree.
+        /// @p_SPN : The root of the subtree, the scapegoat node.
+        /// Returns the new root of the subtree, linked to the parent of the old one.
+        /// @p_Follow : With spg_veb_layout, a node of the subtree whose pointer
+        /// is updated if it moves.
+        link_type RebuildTree(std::size_t p_N, link_base_type p_SPN, link_type* p_Follow = nullptr)
+        {
+            ++m_Rebuilds;
+            GetStats().OnRebuild(p_N);
+
+            /// The subtree may hold the rightmost node, whose depth changes.
+            m_Rightmost = nullptr;
+
+            /// The nodes of a batch are only known by their address.
+            if (RelocatesNodes && p_N >= spg_veb_layout::MinNodes && m_BatchNodes.empty())
+            {
+                if (link_type l_Root = RelocateTree(p_N, p_SPN, p_Follow))
+                    return l_Root;
+            }
+
+            return RebuildTree(p_N, p_SPN, rebuild_strategy());
         }
 
     public:
-        link_type RebuildTree(std::size_t, link_base_type);
+        float       m_Alpha;        ///< Alpha factor of the tree, says how much it can be unbalanced.
+        SPG_Impl    m_Impl;         ///< The implementation and allocator of the ScapeGoat tree.
+        std::size_t m_Size;         ///< Size of the tree.
+
+    private:
+        float       m_AlphaRatio;   ///< Alpha of the tree, used by the deletion watermark.
+        std::size_t m_MaxSize;      ///< Maximum size reached since the last full rebuild.
+        std::size_t m_Rebuilds;     ///< Number of subtree rebuilds.
+        bool        m_InBatch;      ///< True between begin_batch and end_batch.
+
+        link_type   m_Rightmost;        ///< Greatest node, null until GetRightmost looks for it again.
+        std::size_t m_RightmostDepth;   ///< Depth of m_Rightmost, 0 for the root.
+
+        /// A node FlushBatch has to check: inserted in the batch, or the root of
+        /// a subtree rebuilt in the batch, whose rebuilds move nodes down too.
+        /// Only a later rebuild moves the subtree of the node, and that one
+        /// is recorded as well.
+        struct PendingNode
+        {
+            link_type   Node;
+            std::size_t Depth;  ///< Its depth when it was recorded.
+            std::size_t Below;  ///< Height of its subtree when it was recorded.
+        };
+
+        std::vector<PendingNode> m_BatchNodes;  ///< Nodes to check at the end of the batch.
+        std::size_t m_BatchDepth;       ///< Depth above which an insertion of a batch rebuilds.
+        std::size_t m_BatchDepthFrom;   ///< m_BatchDepth holds for the sizes in [m_BatchDepthFrom, m_BatchDepthUntil).
+        std::size_t m_BatchDepthUntil;
 
-        float       m_Alpha;    ///< Alpha factor of the tree, says how much it can be unbalanced.
-        SPG_Impl    m_Impl;     ///< The implementation and allocator of the ScapeGoat tree.
-        std::size_t m_Size;     ///< Size of the tree.
+        std::vector<link_type> m_RebuildBuffer; ///< Scratch array of spg_buffer_rebuild, kept between rebuilds.
+
+        std::size_t m_Relocated;    ///< Nodes moved by spg_veb_layout since the whole tree was.
+
+        std::vector<link_type> m_InsertPath;    ///< Parents of an insertion, unless FixedInsertPath.
 };
 
+/// Returns the keys in p_Lhs or p_Rhs, in a tree with the alpha of p_Lhs.
+/// The rvalue versions work in place in p_Lhs and reuse its nodes.
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...> set_union(SPG<T, Comp, Alloc, Options...> const& p_Lhs, SPG<T, Comp, Alloc, Options...> const& p_Rhs);
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...> set_union(SPG<T, Comp, Alloc, Options...>&& p_Lhs, SPG<T, Comp, Alloc, Options...> const& p_Rhs);
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...> set_union(SPG<T, Comp, Alloc, Options...>&& p_Lhs, SPG<T, Comp, Alloc, Options...>&& p_Rhs);
+
+/// Returns the keys of p_Left followed by those of p_Right, see SPG::join.
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...> join(SPG<T, Comp, Alloc, Options...>&& p_Left, SPG<T, Comp, Alloc, Options...>&& p_Right);
+
+/// Returns the keys in p_Lhs and p_Rhs.
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...> set_intersection(SPG<T, Comp, Alloc, Options...> const& p_Lhs, SPG<T, Comp, Alloc, Options...> const& p_Rhs);
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...> set_intersection(SPG<T, Comp, Alloc, Options...>&& p_Lhs, SPG<T, Comp, Alloc, Options...> const& p_Rhs);
+
+/// Returns the keys in p_Lhs which are not in p_Rhs.
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...> set_difference(SPG<T, Comp, Alloc, Options...> const& p_Lhs, SPG<T, Comp, Alloc, Options...> const& p_Rhs);
+template <typename T, typename Comp, typename Alloc, typename... Options>
+SPG<T, Comp, Alloc, Options...> set_difference(SPG<T, Comp, Alloc, Options...>&& p_Lhs, SPG<T, Comp, Alloc, Options...> const& p_Rhs);
+
 #include "sgt.hxx"
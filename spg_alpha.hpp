@@ -0,0 +1,196 @@
+#pragma once
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <ratio>
+#include <type_traits>
+
+/// The alpha of a ScapeGoat tree may be given at compile time as a
+/// std::ratio among its options: SPG<int, std::less<int>, Alloc, std::ratio<3, 5>>.
+/// The height bounds then come from integer tables, the insertions do no
+/// floating point operation and their parents fit in a fixed array.
+
+namespace details
+{
+    /// Says if T is a std::ratio.
+    template <typename T>
+    struct IsRatio : std::false_type
+    {
+    };
+
+    template <std::intmax_t Num, std::intmax_t Den>
+    struct IsRatio<std::ratio<Num, Den>> : std::true_type
+    {
+    };
+
+    /// The first std::ratio of Options, void if there is none.
+    template <typename... Options>
+    struct RatioOf
+    {
+        using type = void;
+    };
+
+    template <typename First, typename... Options>
+    struct RatioOf<First, Options...>
+    {
+        using type = typename std::conditional<IsRatio<First>::value,
+                                               First,
+                                               typename RatioOf<Options...>::type>::type;
+    };
+
+    /// Returns floor(log2(p_N)), p_N > 0.
+    inline std::size_t Log2(std::size_t p_N)
+    {
+#if defined(__GNUC__)
+        return std::numeric_limits<unsigned long long>::digits - 1 - __builtin_clzll(p_N);
+#else
+        std::size_t l_Log = 0;
+        while (p_N >>= 1)
+            ++l_Log;
+        return l_Log;
+#endif
+    }
+
+    /// Height bounds of a tree whose alpha is given to the constructor:
+    /// log(n) / -log(alpha), in floating point.
+    template <typename Ratio>
+    struct AlphaTraits
+    {
+        using height_type = float;
+
+        static constexpr bool IsStatic = false;
+
+        /// No bound is known before the construction.
+        static constexpr std::size_t MaxHeight = 0;
+
+        /// The alpha of the tree, the one given to the constructor.
+        static float Alpha(float p_Alpha)
+        {
+            return p_Alpha;
+        }
+
+        /// @p_LogInverse : -log(alpha).
+        static height_type Height(std::size_t p_N, float p_LogInverse)
+        {
+            return std::log(p_N) / p_LogInverse;
+        }
+
+        /// About the least n such that 2 h(n) >= p_Doubled, (1 / alpha)^(p_Doubled / 2).
+        /// The batches of insertions allow twice the height.
+        static std::size_t ReachingDoubled(std::size_t p_Doubled, float p_LogInverse)
+        {
+            double l_N = std::ceil(std::exp(static_cast<double>(p_Doubled) * p_LogInverse / 2));
+            return l_N < static_cast<double>(std::numeric_limits<std::size_t>::max())
+                 ? static_cast<std::size_t>(l_N)
+                 : std::numeric_limits<std::size_t>::max();
+        }
+    };
+
+    /// Height bounds of a compile-time alpha, h(n) = floor(log(n) / -log(alpha)):
+    /// the greatest h such that n >= (1 / alpha)^h. The thresholds ceil((1 / alpha)^h)
+    /// are tabulated for every h fitting a std::size_t, and h(2^k) for every k,
+    /// from which h(n) is at most a few steps away.
+    template <std::intmax_t Num, std::intmax_t Den>
+    struct AlphaTraits<std::ratio<Num, Den>>
+    {
+        using ratio = std::ratio<Num, Den>;
+        static_assert(2 * ratio::num >= ratio::den && ratio::num < ratio::den, "alpha must be in [0.5, 1)");
+
+        using height_type = std::size_t;
+
+        static constexpr bool IsStatic = true;
+
+        /// The alpha of the tree, the one given to a constructor must be the ratio.
+        static float Alpha(float p_Alpha)
+        {
+            float l_Alpha = static_cast<float>(ratio::num) / ratio::den;
+            assert(std::fabs(p_Alpha - l_Alpha) <= 1e-6f && "the alpha given to the constructor is not the std::ratio option");
+            static_cast<void>(p_Alpha);
+            return l_Alpha;
+        }
+
+        /// ceil(p_Value), p_Value below the greatest std::size_t.
+        static constexpr std::size_t Ceil(long double p_Value)
+        {
+            std::size_t l_Floor = static_cast<std::size_t>(p_Value);
+            return static_cast<long double>(l_Floor) < p_Value ? l_Floor + 1 : l_Floor;
+        }
+
+        /// The greatest h such that (1 / alpha)^h fits a std::size_t.
+        static constexpr std::size_t ComputeMaxHeight()
+        {
+            long double l_Inverse = static_cast<long double>(ratio::den) / ratio::num;
+            long double l_Limit = static_cast<long double>(std::numeric_limits<std::size_t>::max());
+            long double l_Power = 1;
+            std::size_t l_Height = 0;
+            while (l_Power * l_Inverse < l_Limit)
+            {
+                l_Power *= l_Inverse;
+                ++l_Height;
+            }
+            return l_Height;
+        }
+
+        /// The height bound of any tree, the parents of an insertion fit in
+        /// MaxHeight + 3 slots.
+        static constexpr std::size_t MaxHeight = ComputeMaxHeight();
+
+        using thresholds_type = std::array<std::size_t, MaxHeight + 1>;
+
+        static constexpr thresholds_type ComputeThresholds()
+        {
+            thresholds_type l_Thresholds{};
+            long double l_Inverse = static_cast<long double>(ratio::den) / ratio::num;
+            long double l_Power = 1;
+            for (std::size_t h = 0; h <= MaxHeight; ++h)
+            {
+                l_Thresholds[h] = Ceil(l_Power);
+                l_Power *= l_Inverse;
+            }
+            return l_Thresholds;
+        }
+
+        /// Thresholds[h] = ceil((1 / alpha)^h), the least n of height bound h.
+        static constexpr thresholds_type Thresholds = ComputeThresholds();
+
+        using bases_type = std::array<std::size_t, std::numeric_limits<std::size_t>::digits>;
+
+        static constexpr bases_type ComputeBases()
+        {
+            bases_type l_Bases{};
+            std::size_t h = 0;
+            for (std::size_t k = 0; k < l_Bases.size(); ++k)
+            {
+                std::size_t l_N = std::size_t(1) << k;
+                while (h < MaxHeight && l_N >= Thresholds[h + 1])
+                    ++h;
+                l_Bases[k] = h;
+            }
+            return l_Bases;
+        }
+
+        /// Bases[k] = h(2^k).
+        static constexpr bases_type Bases = ComputeBases();
+
+        static height_type Height(std::size_t p_N, float)
+        {
+            if (!p_N)
+                return 0;
+
+            std::size_t h = Bases[Log2(p_N)];
+            while (h < MaxHeight && p_N >= Thresholds[h + 1])
+                ++h;
+            return h;
+        }
+
+        /// The least n such that 2 h(n) >= p_Doubled.
+        static std::size_t ReachingDoubled(std::size_t p_Doubled, float)
+        {
+            std::size_t l_Height = (p_Doubled + 1) / 2;
+            return l_Height <= MaxHeight ? Thresholds[l_Height] : std::numeric_limits<std::size_t>::max();
+        }
+    };
+}
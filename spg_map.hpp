@@ -0,0 +1,317 @@
+#pragma once
+#include <functional>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+#include "spg.hpp"
+
+namespace details
+{
+    /// Orders the pairs of a map by their key. A pair can also be compared
+    /// with a bare key, so that the tree looks keys up without building pairs.
+    template <typename Key, typename Value, typename Comparator>
+    struct MapCompare
+    {
+        using value_type = std::pair<Key const, Value>;
+
+        MapCompare(Comparator const& p_Comparator = Comparator())
+            : m_Comparator(p_Comparator)
+        {
+        }
+
+        bool operator()(value_type const& p_Lhs, value_type const& p_Rhs) const
+        {
+            return m_Comparator(p_Lhs.first, p_Rhs.first);
+        }
+
+        bool operator()(Key const& p_Lhs, value_type const& p_Rhs) const
+        {
+            return m_Comparator(p_Lhs, p_Rhs.first);
+        }
+
+        bool operator()(value_type const& p_Lhs, Key const& p_Rhs) const
+        {
+            return m_Comparator(p_Lhs.first, p_Rhs);
+        }
+
+        /// Other key types, only used with a transparent Comparator.
+        template <typename K>
+        bool operator()(K const& p_Lhs, value_type const& p_Rhs) const
+        {
+            return m_Comparator(p_Lhs, p_Rhs.first);
+        }
+
+        template <typename K>
+        bool operator()(value_type const& p_Lhs, K const& p_Rhs) const
+        {
+            return m_Comparator(p_Lhs.first, p_Rhs);
+        }
+
+        Comparator m_Comparator;
+    };
+}
+
+/// Ordered map on the ScapeGoat tree, the nodes store a std::pair<Key const, Value>.
+/// The values are constructed in their node, and only once the key is known
+/// to be new: a failed insertion neither allocates nor builds a value.
+template <typename Key,
+          typename Value,
+          typename Comparator = std::less<Key>,
+          typename Alloc = std::allocator<std::pair<Key const, Value>>,
+          typename... Options>
+class SPGMap
+    : private SPG<std::pair<Key const, Value>, details::MapCompare<Key, Value, Comparator>, Alloc, Options...>
+{
+    using base_type = SPG<std::pair<Key const, Value>, details::MapCompare<Key, Value, Comparator>, Alloc, Options...>;
+
+    public:
+        using key_type = Key;
+        using mapped_type = Value;
+        using value_type = std::pair<Key const, Value>;
+        using key_compare = Comparator;
+        using allocator_type = Alloc;
+
+        using iterator = typename base_type::iterator;
+        using const_iterator = typename base_type::const_iterator;
+        using reverse_iterator = typename base_type::reverse_iterator;
+        using const_reverse_iterator = typename base_type::const_reverse_iterator;
+
+        /// Constructs an empty map.
+        /// @p_Alpha : unbalance factor of the tree, MUST be in the interval [0.5, 1.0].
+        SPGMap(float p_Alpha)
+            : base_type(p_Alpha)
+        {
+        }
+
+        using base_type::size;
+        using base_type::empty;
+        using base_type::rebuild_count;
+        using base_type::stats;
+        using base_type::reset_stats;
+        using base_type::nth;
+
+        using base_type::begin;
+        using base_type::end;
+        using base_type::rbegin;
+        using base_type::rend;
+        using base_type::cbegin;
+        using base_type::cend;
+        using base_type::crbegin;
+        using base_type::crend;
+
+        /// Returns the iterator on the pair of p_Key, end() if it is not in the map.
+        iterator find(key_type const& p_Key)
+        {
+            auto l_Node = this->InternalFind(p_Key);
+            return l_Node ? iterator(l_Node) : end();
+        }
+
+        const_iterator find(key_type const& p_Key) const
+        {
+            auto l_Node = this->InternalFind(p_Key);
+            return l_Node ? const_iterator(l_Node) : cend();
+        }
+
+        /// Returns true if p_Key is in the map.
+        bool contains(key_type const& p_Key) const
+        {
+            return this->InternalFind(p_Key) != nullptr;
+        }
+
+        /// Returns the iterator on the first pair whose key is not less than p_Key.
+        iterator lower_bound(key_type const& p_Key)
+        {
+            return iterator(this->InternalBound(p_Key, false));
+        }
+
+        const_iterator lower_bound(key_type const& p_Key) const
+        {
+            return const_iterator(this->InternalBound(p_Key, false));
+        }
+
+        /// Returns the iterator on the first pair whose key is greater than p_Key.
+        iterator upper_bound(key_type const& p_Key)
+        {
+            return iterator(this->InternalBound(p_Key, true));
+        }
+
+        const_iterator upper_bound(key_type const& p_Key) const
+        {
+            return const_iterator(this->InternalBound(p_Key, true));
+        }
+
+        /// The lookups above for any key type Comparator accepts, if it
+        /// declares is_transparent: no key_type is built.
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        iterator find(K const& p_Key)
+        {
+            auto l_Node = this->InternalFind(p_Key);
+            return l_Node ? iterator(l_Node) : end();
+        }
+
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        const_iterator find(K const& p_Key) const
+        {
+            auto l_Node = this->InternalFind(p_Key);
+            return l_Node ? const_iterator(l_Node) : cend();
+        }
+
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        bool contains(K const& p_Key) const
+        {
+            return this->InternalFind(p_Key) != nullptr;
+        }
+
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        iterator lower_bound(K const& p_Key)
+        {
+            return iterator(this->InternalBound(p_Key, false));
+        }
+
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        const_iterator lower_bound(K const& p_Key) const
+        {
+            return const_iterator(this->InternalBound(p_Key, false));
+        }
+
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        iterator upper_bound(K const& p_Key)
+        {
+            return iterator(this->InternalBound(p_Key, true));
+        }
+
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        const_iterator upper_bound(K const& p_Key) const
+        {
+            return const_iterator(this->InternalBound(p_Key, true));
+        }
+
+        /// Several keys may be equivalent to a key of another type.
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        std::pair<iterator, iterator> equal_range(K const& p_Key)
+        {
+            return std::make_pair(lower_bound(p_Key), upper_bound(p_Key));
+        }
+
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        std::pair<const_iterator, const_iterator> equal_range(K const& p_Key) const
+        {
+            return std::make_pair(lower_bound(p_Key), upper_bound(p_Key));
+        }
+
+        /// Returns the value of p_Key, throws std::out_of_range if it is not in the map.
+        mapped_type& at(key_type const& p_Key)
+        {
+            auto l_Node = this->InternalFind(p_Key);
+            if (!l_Node)
+                throw std::out_of_range("SPGMap::at");
+            return iterator(l_Node)->second;
+        }
+
+        mapped_type const& at(key_type const& p_Key) const
+        {
+            auto l_Node = this->InternalFind(p_Key);
+            if (!l_Node)
+                throw std::out_of_range("SPGMap::at");
+            return const_iterator(l_Node)->second;
+        }
+
+        /// Returns the value of p_Key, value-initialized first if it is not in the map.
+        mapped_type& operator[](key_type const& p_Key)
+        {
+            return try_emplace(p_Key).first->second;
+        }
+
+        mapped_type& operator[](key_type&& p_Key)
+        {
+            return try_emplace(std::move(p_Key)).first->second;
+        }
+
+        /// Inserts p_Value if its key is not in the map.
+        /// Returns the iterator on the pair of the key and true if it was inserted.
+        std::pair<iterator, bool> insert(value_type const& p_Value)
+        {
+            return Wrap(this->InsertUnique(p_Value.first, p_Value));
+        }
+
+        std::pair<iterator, bool> insert(value_type&& p_Value)
+        {
+            return Wrap(this->InsertUnique(p_Value.first, std::move(p_Value)));
+        }
+
+        /// Constructs a pair from p_Args and inserts it if its key is not in the map.
+        /// The pair is built before the lookup, try_emplace avoids it.
+        template <typename... Args>
+        std::pair<iterator, bool> emplace(Args&&... p_Args)
+        {
+            value_type l_Value(std::forward<Args>(p_Args)...);
+            return Wrap(this->InsertUnique(l_Value.first, std::move(l_Value)));
+        }
+
+        /// Inserts p_Key with a value constructed in place from p_Args if p_Key
+        /// is not in the map, nothing is constructed otherwise.
+        template <typename... Args>
+        std::pair<iterator, bool> try_emplace(key_type const& p_Key, Args&&... p_Args)
+        {
+            return Wrap(this->InsertUnique(p_Key,
+                                           std::piecewise_construct,
+                                           std::forward_as_tuple(p_Key),
+                                           std::forward_as_tuple(std::forward<Args>(p_Args)...)));
+        }
+
+        template <typename... Args>
+        std::pair<iterator, bool> try_emplace(key_type&& p_Key, Args&&... p_Args)
+        {
+            return Wrap(this->InsertUnique(p_Key,
+                                           std::piecewise_construct,
+                                           std::forward_as_tuple(std::move(p_Key)),
+                                           std::forward_as_tuple(std::forward<Args>(p_Args)...)));
+        }
+
+        /// Inserts p_Key with p_Value, or assigns p_Value if p_Key is in the map.
+        /// Returns the iterator on the pair of the key and true if it was inserted.
+        template <typename M>
+        std::pair<iterator, bool> insert_or_assign(key_type const& p_Key, M&& p_Value)
+        {
+            /// try_emplace leaves p_Value untouched when the key is already there.
+            auto l_Result = try_emplace(p_Key, std::forward<M>(p_Value));
+            if (!l_Result.second)
+                l_Result.first->second = std::forward<M>(p_Value);
+            return l_Result;
+        }
+
+        template <typename M>
+        std::pair<iterator, bool> insert_or_assign(key_type&& p_Key, M&& p_Value)
+        {
+            /// try_emplace leaves p_Value untouched when the key is already there.
+            auto l_Result = try_emplace(std::move(p_Key), std::forward<M>(p_Value));
+            if (!l_Result.second)
+                l_Result.first->second = std::forward<M>(p_Value);
+            return l_Result;
+        }
+
+        /// Erases the pair of p_Key, returns the number of pairs erased.
+        std::size_t erase(key_type const& p_Key)
+        {
+            return this->EraseKey(p_Key);
+        }
+
+        /// Erases every pair whose key is equivalent to p_Key, as std::map does.
+        template <typename K, typename C = Comparator, typename = typename C::is_transparent>
+        std::size_t erase(K const& p_Key)
+        {
+            std::size_t l_Erased = 0;
+            while (std::size_t l_Pairs = this->EraseKey(p_Key))
+                l_Erased += l_Pairs;
+
+            return l_Erased;
+        }
+
+    private:
+        template <typename Link>
+        static std::pair<iterator, bool> Wrap(std::pair<Link, bool> const& p_Result)
+        {
+            return std::make_pair(iterator(p_Result.first), p_Result.second);
+        }
+};
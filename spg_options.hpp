@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <type_traits>
+
+/// Options of the ScapeGoat tree, given after the allocator in any order:
+/// SPG<T, Comparator, Alloc, Options...>.
+
+/// Every node stores the size of its subtree. It makes the scapegoat search
+/// O(height) and enables the order statistics (nth, rank, count_between).
+struct spg_subtree_size
+{
+};
+
+/// RebuildTree uses the Day/Stout/Warren algorithm: the scapegoat subtree
+/// is turned into a vine and compressed by rotations. This is the default.
+struct spg_dsw_rebuild
+{
+};
+
+/// RebuildTree flattens the scapegoat subtree into a reusable array of
+/// nodes and relinks it perfectly balanced in one pass.
+struct spg_buffer_rebuild
+{
+};
+
+/// RebuildTree flattens the scapegoat subtree as spg_buffer_rebuild does,
+/// but the subtrees of at least Threshold nodes are flattened and linked by
+/// parts on the shared thread pool. The resulting shape is the one of the
+/// sequential rebuild. Mostly useful for the rebuilds near the root, which
+/// relink a large part of the tree.
+struct spg_parallel_rebuild
+{
+    static constexpr std::size_t Threshold = std::size_t(1) << 16;
+};
+
+/// The rebuilds of at least MinNodes nodes also move the keys of the
+/// subtree into one new block of nodes, laid out in van Emde Boas order,
+/// and free the old nodes: the regions of the tree which get rebuilt end
+/// up contiguous. The nodes store the block they belong to, which is freed
+/// with its last node. A rebuild then invalidates the iterators and the
+/// references to the moved keys, and the keys must be nothrow move
+/// constructible.
+struct spg_veb_layout
+{
+    static constexpr std::size_t MinNodes = 64;
+};
+
+/// The tree is a multiset: inserting a key already in the tree adds a copy
+/// to the count of its node instead of failing, no node is allocated. The
+/// shape, size() and the order statistics only depend on the distinct
+/// keys, count() gives the copies of a key and the copy iterators visit
+/// every copy. erase() takes every copy of a key, erase_one() a single one.
+/// merge adds the copies of both trees, intersect_with keeps the fewest
+/// and subtract takes those of the other tree off.
+struct spg_multiset
+{
+};
+
+/// The tree counts its insertions, rebuilds and the nodes they visit,
+/// read with stats(). Without it the counters compile to nothing.
+struct spg_stats
+{
+};
+
+namespace details
+{
+    /// Says if Option is one of Options.
+    template <typename Option, typename... Options>
+    struct HasOption : std::false_type
+    {
+    };
+
+    template <typename Option, typename First, typename... Options>
+    struct HasOption<Option, First, Options...>
+        : std::conditional<std::is_same<Option, First>::value,
+                           std::true_type,
+                           HasOption<Option, Options...>>::type
+    {
+    };
+}
@@ -0,0 +1,204 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace details
+{
+    /// Fixed size object pool. Objects are carved out of large contiguous
+    /// slabs and recycled through an intrusive free list, the slabs are
+    /// only given back to the system when the pool is destroyed.
+    template <typename T, std::size_t NodesPerSlab>
+    class SlabPool
+    {
+        /// A free slot stores the next free slot in place of the object.
+        union Slot
+        {
+            Slot* Next;
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+        };
+
+        public:
+            SlabPool()
+                : m_FreeList(nullptr),
+                m_Current(nullptr),
+                m_End(nullptr)
+            {
+            }
+
+            SlabPool(SlabPool const&) = delete;
+            SlabPool& operator=(SlabPool const&) = delete;
+
+            /// Releases every slab at once, O(#slabs).
+            ~SlabPool()
+            {
+                for (Slot* l_Slab : m_Slabs)
+                    ::operator delete(l_Slab);
+            }
+
+            /// Returns the memory of one object, the free list is used first.
+            T* allocate()
+            {
+                if (m_FreeList)
+                {
+                    Slot* l_Slot = m_FreeList;
+                    m_FreeList = l_Slot->Next;
+                    return reinterpret_cast<T*>(l_Slot);
+                }
+
+                if (m_Current == m_End)
+                    NewSlab();
+
+                return reinterpret_cast<T*>(m_Current++);
+            }
+
+            /// Gives back the memory of one object to the free list.
+            /// @p_Ptr : The adress of the object memory.
+            void deallocate(T* p_Ptr)
+            {
+                Slot* l_Slot = reinterpret_cast<Slot*>(p_Ptr);
+                l_Slot->Next = m_FreeList;
+                m_FreeList = l_Slot;
+            }
+
+        private:
+            void NewSlab()
+            {
+                m_Slabs.reserve(m_Slabs.size() + 1);
+                m_Current = static_cast<Slot*>(::operator new(NodesPerSlab * sizeof (Slot)));
+                m_End = m_Current + NodesPerSlab;
+                m_Slabs.push_back(m_Current);
+            }
+
+            Slot*               m_FreeList; ///< Head of the recycled slots.
+            Slot*               m_Current;  ///< Next never used slot of the last slab.
+            Slot*               m_End;      ///< End of the last slab.
+            std::vector<Slot*>  m_Slabs;    ///< Every slab allocated so far.
+    };
+
+    /// The pools of an allocator and of its rebound copies, one per type
+    /// of pool, created on the first use of the type.
+    class SlabPools
+    {
+        public:
+            SlabPools() = default;
+            SlabPools(SlabPools const&) = delete;
+            SlabPools& operator=(SlabPools const&) = delete;
+
+            /// Returns the pool of type Pool, created if needed.
+            template <typename Pool>
+            Pool& Get()
+            {
+                for (auto const& l_Pool : m_Pools)
+                    if (l_Pool.first == &Tag<Pool>)
+                        return *static_cast<Pool*>(l_Pool.second.get());
+
+                m_Pools.reserve(m_Pools.size() + 1);
+                std::shared_ptr<Pool> l_Pool = std::make_shared<Pool>();
+                m_Pools.emplace_back(&Tag<Pool>, l_Pool);
+                return *l_Pool;
+            }
+
+        private:
+            /// One address per type of pool, its key in m_Pools.
+            template <typename Pool>
+            static constexpr char Tag = 0;
+
+            std::vector<std::pair<char const*, std::shared_ptr<void>>> m_Pools;
+    };
+}
+
+/// Allocator handing out single objects from a slab pool.
+/// It is meant to be given as the Alloc parameter of SPG, which rebinds it
+/// to Node<T>: one key then costs no malloc, the nodes are packed in large
+/// contiguous slabs and the whole tree memory is released in O(#slabs).
+/// Every allocator is constructed with its own pools, which its copies and
+/// its rebound copies share and compare equal through: a rebound allocator
+/// takes the pool of its type among them, so that A(B(a)) == a. The slabs
+/// are allocated on demand, an empty pool costs one small allocation.
+/// The pool has no lock: trees sharing it (SPG::split gives its right part
+/// the pool of the tree) must be used from the same thread.
+template <typename T, std::size_t NodesPerSlab = 4096>
+class spg_pool_allocator
+{
+    using pool_type = details::SlabPool<T, NodesPerSlab>;
+
+    public:
+        using value_type = T;
+        using pointer = T*;
+        using const_pointer = T const*;
+        using size_type = std::size_t;
+        using difference_type = std::ptrdiff_t;
+
+        /// The memory is released by the pool, not per object.
+        using bulk_release = std::true_type;
+
+        template <typename U>
+        struct rebind
+        {
+            using other = spg_pool_allocator<U, NodesPerSlab>;
+        };
+
+        spg_pool_allocator()
+            : m_Pools(std::make_shared<details::SlabPools>()),
+            m_Pool(&m_Pools->Get<pool_type>())
+        {
+        }
+
+        spg_pool_allocator(spg_pool_allocator const&) noexcept = default;
+
+        /// The objects of another type are not of the size of its slots,
+        /// they get their own pool.
+        template <typename U>
+        spg_pool_allocator(spg_pool_allocator<U, NodesPerSlab> const& p_Other)
+            : m_Pools(p_Other.m_Pools),
+            m_Pool(&m_Pools->Get<pool_type>())
+        {
+        }
+
+        /// Allocates p_N objects, only single objects come from the pool.
+        T* allocate(std::size_t p_N)
+        {
+            if (p_N != 1)
+                return static_cast<T*>(::operator new(p_N * sizeof (T)));
+
+            return m_Pool->allocate();
+        }
+
+        /// Deallocates p_N objects previously allocated by this pool.
+        void deallocate(T* p_Ptr, std::size_t p_N)
+        {
+            if (p_N != 1)
+                ::operator delete(p_Ptr);
+            else
+                m_Pool->deallocate(p_Ptr);
+        }
+
+        /// Returns the number of allocators sharing our pools, of any type.
+        long use_count() const noexcept
+        {
+            return m_Pools.use_count();
+        }
+
+        template <typename U>
+        bool operator==(spg_pool_allocator<U, NodesPerSlab> const& p_Rhs) const
+        {
+            return m_Pools == p_Rhs.m_Pools;
+        }
+
+        template <typename U>
+        bool operator!=(spg_pool_allocator<U, NodesPerSlab> const& p_Rhs) const
+        {
+            return !(operator==(p_Rhs));
+        }
+
+    private:
+        template <typename U, std::size_t N>
+        friend class spg_pool_allocator;
+
+        std::shared_ptr<details::SlabPools> m_Pools;    ///< Shared between the copies and the rebound copies.
+        pool_type*                          m_Pool;     ///< Our pool among m_Pools.
+};
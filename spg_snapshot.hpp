@@ -0,0 +1,222 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "spg.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SPG_SNAPSHOT_MMAP 1
+#endif
+
+/// Definitions of SPG::save and SPG::load, to include where they are used:
+/// spg.hpp only declares them, so that the other users of SPG don't get the
+/// system headers of the file mapping.
+
+namespace details
+{
+    /// Header of the files written by SPG::save, the keys follow in order.
+    /// It is 32 bytes long, so that keys aligned up to 32 stay aligned in a
+    /// mapped file.
+    struct SnapshotHeader
+    {
+        static const std::uint32_t CurrentVersion = 1;
+        static const std::uint32_t NativeOrder = 0x01020304;
+
+        char            Magic[8];   ///< "SPGSNAP" and a null.
+        std::uint32_t   Version;
+        std::uint32_t   ByteOrder;  ///< NativeOrder as written, the keys are not swapped.
+        std::uint32_t   KeySize;
+        std::uint32_t   KeyAlign;
+        std::uint64_t   Count;      ///< Number of keys.
+
+        /// Returns the header of p_Count keys of p_Size bytes aligned on p_Align.
+        static SnapshotHeader Make(std::size_t p_Size, std::size_t p_Align, std::size_t p_Count)
+        {
+            SnapshotHeader l_Header;
+            std::memcpy(l_Header.Magic, "SPGSNAP", sizeof (l_Header.Magic));
+            l_Header.Version = CurrentVersion;
+            l_Header.ByteOrder = NativeOrder;
+            l_Header.KeySize = static_cast<std::uint32_t>(p_Size);
+            l_Header.KeyAlign = static_cast<std::uint32_t>(p_Align);
+            l_Header.Count = p_Count;
+            return l_Header;
+        }
+
+        /// Says if a file of p_FileSize bytes starting with this header
+        /// holds keys of p_Size bytes aligned on p_Align.
+        bool Matches(std::size_t p_Size, std::size_t p_Align, std::size_t p_FileSize) const
+        {
+            return !std::memcmp(Magic, "SPGSNAP", sizeof (Magic)) &&
+                   Version == CurrentVersion &&
+                   ByteOrder == NativeOrder &&
+                   KeySize == p_Size &&
+                   KeyAlign == p_Align &&
+                   Count <= (p_FileSize - sizeof (SnapshotHeader)) / p_Size &&
+                   Count * p_Size == p_FileSize - sizeof (SnapshotHeader);
+        }
+    };
+
+    static_assert(sizeof (SnapshotHeader) == 32, "the snapshot header must be 32 bytes long");
+
+    /// Read only view of a whole file. It is mapped where mmap exists,
+    /// and read in memory otherwise.
+    class MappedFile
+    {
+        public:
+            explicit MappedFile(char const* p_Path)
+                : m_Data(nullptr),
+                m_Size(0)
+            {
+#if defined(SPG_SNAPSHOT_MMAP)
+                int l_Fd = ::open(p_Path, O_RDONLY);
+                if (l_Fd < 0)
+                    return;
+
+                struct stat l_Stat;
+                if (::fstat(l_Fd, &l_Stat) == 0 && l_Stat.st_size > 0)
+                {
+                    void* l_Data = ::mmap(nullptr, l_Stat.st_size, PROT_READ, MAP_PRIVATE, l_Fd, 0);
+                    if (l_Data != MAP_FAILED)
+                    {
+                        /// The keys are read once, in order.
+                        ::madvise(l_Data, l_Stat.st_size, MADV_SEQUENTIAL);
+                        m_Data = static_cast<char const*>(l_Data);
+                        m_Size = static_cast<std::size_t>(l_Stat.st_size);
+                    }
+                }
+
+                ::close(l_Fd);
+#else
+                std::FILE* l_File = std::fopen(p_Path, "rb");
+                if (!l_File)
+                    return;
+
+                char l_Chunk[1 << 16];
+                std::size_t l_Read;
+                while ((l_Read = std::fread(l_Chunk, 1, sizeof (l_Chunk), l_File)) > 0)
+                    m_Buffer.insert(m_Buffer.end(), l_Chunk, l_Chunk + l_Read);
+
+                if (!std::ferror(l_File) && !m_Buffer.empty())
+                {
+                    m_Data = m_Buffer.data();
+                    m_Size = m_Buffer.size();
+                }
+
+                std::fclose(l_File);
+#endif
+            }
+
+            MappedFile(MappedFile const&) = delete;
+            MappedFile& operator=(MappedFile const&) = delete;
+
+            ~MappedFile()
+            {
+#if defined(SPG_SNAPSHOT_MMAP)
+                if (m_Data)
+                    ::munmap(const_cast<char*>(m_Data), m_Size);
+#endif
+            }
+
+            /// Returns the content, nullptr if the file could not be read.
+            char const* Data() const { return m_Data; }
+
+            std::size_t Size() const { return m_Size; }
+
+        private:
+            char const*         m_Data;
+            std::size_t         m_Size;
+#if !defined(SPG_SNAPSHOT_MMAP)
+            std::vector<char>   m_Buffer;
+#endif
+    };
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+bool
+SPG<T, Comp, Alloc, Options...>::save(char const* p_Path) const
+{
+    static_assert(std::is_trivially_copyable<value_type>::value, "SPG::save needs trivially copyable keys");
+    static_assert(!CountsCopies, "the snapshots hold one copy per key, spg_multiset would lose the others");
+
+    std::string l_TmpPath = std::string(p_Path) + ".tmp";
+    std::FILE* l_File = std::fopen(l_TmpPath.c_str(), "wb");
+    if (!l_File)
+        return false;
+
+    details::SnapshotHeader l_Header = details::SnapshotHeader::Make(sizeof (value_type), alignof (value_type), m_Size);
+    bool l_Ok = std::fwrite(&l_Header, sizeof (l_Header), 1, l_File) == 1;
+
+    /// The keys are copied by chunks, one fwrite per key is much slower.
+    std::vector<value_type> l_Chunk;
+    l_Chunk.reserve(std::min<std::size_t>(m_Size, 4096));
+
+    for (auto l_It = cbegin(); l_Ok && l_It != cend();)
+    {
+        l_Chunk.clear();
+        for (; l_It != cend() && l_Chunk.size() < l_Chunk.capacity(); ++l_It)
+            l_Chunk.push_back(*l_It);
+
+        l_Ok = std::fwrite(l_Chunk.data(), sizeof (value_type), l_Chunk.size(), l_File) == l_Chunk.size();
+    }
+
+    l_Ok = std::fclose(l_File) == 0 && l_Ok;
+    if (l_Ok)
+        l_Ok = std::rename(l_TmpPath.c_str(), p_Path) == 0;
+
+    if (!l_Ok)
+        std::remove(l_TmpPath.c_str());
+
+    return l_Ok;
+}
+
+template <typename T,
+          typename Comp,
+          typename Alloc,
+          typename... Options>
+bool
+SPG<T, Comp, Alloc, Options...>::load(char const* p_Path)
+{
+    static_assert(std::is_trivially_copyable<value_type>::value, "SPG::load needs trivially copyable keys");
+    static_assert(alignof (value_type) <= sizeof (details::SnapshotHeader), "the keys would not be aligned in the snapshot");
+
+    details::MappedFile l_File(p_Path);
+    if (!l_File.Data() || l_File.Size() < sizeof (details::SnapshotHeader))
+        return false;
+
+    details::SnapshotHeader l_Header;
+    std::memcpy(&l_Header, l_File.Data(), sizeof (l_Header));
+    if (!l_Header.Matches(sizeof (value_type), alignof (value_type), l_File.Size()))
+        return false;
+
+    value_type const* l_First = reinterpret_cast<value_type const*>(l_File.Data() + sizeof (l_Header));
+    std::size_t l_Count = static_cast<std::size_t>(l_Header.Count);
+
+    /// A file saved with another comparator would break the tree.
+    if (!IsStrictlySorted(l_First, l_First + l_Count))
+        return false;
+
+    /// The new tree is built aside, ours is only replaced once it is
+    /// complete: if an allocation fails, it is left as it was.
+    link_type l_Root = BuildSorted(l_First, l_Count);
+
+    clear();
+    m_Size = l_Count;
+    SetRoot(l_Root);
+    m_MaxSize = m_Size;
+
+    return true;
+}
+
+#undef SPG_SNAPSHOT_MMAP
@@ -0,0 +1,74 @@
+#pragma once
+#include <array>
+#include <cstddef>
+
+/// Counters of a ScapeGoat tree built with the spg_stats option.
+struct spg_statistics
+{
+    std::size_t Inserts = 0;            ///< Successful calls to insert(), insert_range is not counted.
+    std::size_t Rebuilds = 0;           ///< Calls to RebuildTree.
+    std::size_t RelinkedNodes = 0;      ///< Nodes relinked by RebuildTree.
+    std::size_t ScapeGoatVisits = 0;    ///< Ancestors climbed by FindScapeGoatNode.
+    std::size_t SizeVisits = 0;         ///< Nodes counted by details::Size (none with spg_subtree_size).
+    std::size_t MaxInsertDepth = 0;     ///< Deepest node created by an insertion.
+    std::size_t TotalInsertDepth = 0;   ///< Sum of the depths of the inserted nodes.
+
+    /// RebuildSizes[i] is the number of rebuilt subtrees of size in [2^i, 2^(i + 1)).
+    std::array<std::size_t, 64> RebuildSizes{};
+
+    /// Returns the average depth of the inserted nodes.
+    double average_insert_depth() const
+    {
+        return Inserts ? static_cast<double>(TotalInsertDepth) / Inserts : 0.0;
+    }
+};
+
+namespace details
+{
+    /// Counters updated by the tree, they do nothing without spg_stats.
+    template <bool Enabled>
+    struct StatsCounter
+    {
+        void OnInsert(std::size_t) {}
+        void OnRebuild(std::size_t) {}
+        void OnScapeGoatVisit() {}
+        void OnSizeVisits(std::size_t) {}
+    };
+
+    template <>
+    struct StatsCounter<true>
+    {
+        /// @p_Depth : The depth of the new node, 0 for the root.
+        void OnInsert(std::size_t p_Depth)
+        {
+            ++m_Stats.Inserts;
+            m_Stats.TotalInsertDepth += p_Depth;
+            if (p_Depth > m_Stats.MaxInsertDepth)
+                m_Stats.MaxInsertDepth = p_Depth;
+        }
+
+        /// @p_N : The size of the rebuilt subtree.
+        void OnRebuild(std::size_t p_N)
+        {
+            ++m_Stats.Rebuilds;
+            m_Stats.RelinkedNodes += p_N;
+
+            std::size_t l_Bucket = 0;
+            while (p_N >>= 1)
+                ++l_Bucket;
+            ++m_Stats.RebuildSizes[l_Bucket];
+        }
+
+        void OnScapeGoatVisit()
+        {
+            ++m_Stats.ScapeGoatVisits;
+        }
+
+        void OnSizeVisits(std::size_t p_N)
+        {
+            m_Stats.SizeVisits += p_N;
+        }
+
+        spg_statistics m_Stats;
+    };
+}
@@ -0,0 +1,190 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace details
+{
+    /// Fixed set of worker threads running batches of independent tasks,
+    /// used by the spg_parallel_rebuild option. The tasks of a batch must not
+    /// wait on other tasks.
+    class ThreadPool
+    {
+        public:
+            /// @p_Workers : The number of threads, the caller of Run works too.
+            explicit ThreadPool(std::size_t p_Workers)
+                : m_Stop(false)
+            {
+                for (std::size_t i = 0; i < p_Workers; ++i)
+                    m_Workers.emplace_back([this] { Work(); });
+            }
+
+            ThreadPool(ThreadPool const&) = delete;
+            ThreadPool& operator=(ThreadPool const&) = delete;
+
+            ~ThreadPool()
+            {
+                {
+                    std::lock_guard<std::mutex> l_Lock(m_Mutex);
+                    m_Stop = true;
+                }
+
+                m_Wake.notify_all();
+                for (auto& l_Worker : m_Workers)
+                    l_Worker.join();
+            }
+
+            /// Returns the pool shared by every tree, one worker per core but
+            /// the one of the caller: none on a single core.
+            static ThreadPool& Shared()
+            {
+                static ThreadPool s_Pool(std::max<unsigned>(std::thread::hardware_concurrency(), 1) - 1);
+                return s_Pool;
+            }
+
+            /// Returns the number of threads running a batch, the caller included.
+            std::size_t Concurrency() const
+            {
+                return m_Workers.size() + 1;
+            }
+
+            /// Runs every task and returns once they are all done. The calling
+            /// thread takes tasks from the queue as well instead of sleeping.
+            /// If tasks throw, the first exception is rethrown once every task
+            /// of the batch is done: none of them is left pointing to p_Tasks.
+            void Run(std::vector<std::function<void()>>& p_Tasks)
+            {
+                Batch l_Batch;
+                l_Batch.Pending = p_Tasks.size();
+
+                {
+                    std::lock_guard<std::mutex> l_Lock(m_Mutex);
+                    for (auto& l_Task : p_Tasks)
+                        m_Queue.push_back(Job{ &l_Task, &l_Batch });
+                }
+
+                m_Wake.notify_all();
+
+                std::unique_lock<std::mutex> l_Lock(m_Mutex);
+                while (l_Batch.Pending)
+                {
+                    /// The queue may hold the tasks of other trees, helping
+                    /// them also makes room for ours.
+                    if (!m_Queue.empty())
+                    {
+                        Job l_Job = m_Queue.front();
+                        m_Queue.pop_front();
+                        l_Lock.unlock();
+                        Execute(l_Job);
+                        l_Lock.lock();
+                    }
+                    else
+                        l_Batch.Done.wait(l_Lock);
+                }
+
+                if (l_Batch.Error)
+                    std::rethrow_exception(l_Batch.Error);
+            }
+
+        private:
+            struct Batch
+            {
+                std::size_t             Pending;    ///< Tasks not finished yet, guarded by m_Mutex.
+                std::condition_variable Done;       ///< Notified when Pending drops to 0.
+                std::exception_ptr      Error;      ///< First exception thrown by a task, guarded by m_Mutex.
+            };
+
+            struct Job
+            {
+                std::function<void()>*  Task;
+                Batch*                  Owner;
+            };
+
+            void Work()
+            {
+                std::unique_lock<std::mutex> l_Lock(m_Mutex);
+                for (;;)
+                {
+                    m_Wake.wait(l_Lock, [this] { return m_Stop || !m_Queue.empty(); });
+                    if (m_Queue.empty())
+                        return;
+
+                    Job l_Job = m_Queue.front();
+                    m_Queue.pop_front();
+                    l_Lock.unlock();
+                    Execute(l_Job);
+                    l_Lock.lock();
+                }
+            }
+
+            /// Runs a job without holding m_Mutex. A job counts as done even
+            /// if it throws, its exception is kept for the caller of Run.
+            void Execute(Job const& p_Job)
+            {
+                std::exception_ptr l_Error;
+                try
+                {
+                    (*p_Job.Task)();
+                }
+                catch (...)
+                {
+                    l_Error = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> l_Lock(m_Mutex);
+                if (l_Error && !p_Job.Owner->Error)
+                    p_Job.Owner->Error = l_Error;
+                if (--p_Job.Owner->Pending == 0)
+                    p_Job.Owner->Done.notify_one();
+            }
+
+            std::mutex                  m_Mutex;
+            std::condition_variable     m_Wake;     ///< Wakes the workers up when jobs are queued or on stop.
+            std::deque<Job>             m_Queue;
+            std::vector<std::thread>    m_Workers;
+            bool                        m_Stop;
+    };
+
+    /// Sorts a range on p_Pool: each of p_Chunks chunks is sorted, then
+    /// the chunks are merged two by two.
+    template <typename RandomIt, typename Compare>
+    void ParallelSort(RandomIt p_First, RandomIt p_Last, Compare const& p_Compare, ThreadPool& p_Pool, std::size_t p_Chunks)
+    {
+        std::size_t l_N = static_cast<std::size_t>(p_Last - p_First);
+        std::size_t l_Chunks = p_Chunks;
+        if (l_Chunks <= 1 || l_N < 2 * l_Chunks)
+        {
+            std::sort(p_First, p_Last, p_Compare);
+            return;
+        }
+
+        std::vector<RandomIt> l_Bounds;
+        for (std::size_t i = 0; i <= l_Chunks; ++i)
+            l_Bounds.push_back(p_First + l_N * i / l_Chunks);
+
+        std::vector<std::function<void()>> l_Tasks;
+        for (std::size_t i = 0; i < l_Chunks; ++i)
+            l_Tasks.emplace_back([&l_Bounds, &p_Compare, i] { std::sort(l_Bounds[i], l_Bounds[i + 1], p_Compare); });
+        p_Pool.Run(l_Tasks);
+
+        for (std::size_t l_Width = 1; l_Width < l_Chunks; l_Width *= 2)
+        {
+            l_Tasks.clear();
+            for (std::size_t i = 0; i + l_Width < l_Chunks; i += 2 * l_Width)
+            {
+                std::size_t l_End = std::min(i + 2 * l_Width, l_Chunks);
+                l_Tasks.emplace_back([&l_Bounds, &p_Compare, i, l_Width, l_End]
+                {
+                    std::inplace_merge(l_Bounds[i], l_Bounds[i + l_Width], l_Bounds[l_End], p_Compare);
+                });
+            }
+            p_Pool.Run(l_Tasks);
+        }
+    }
+}
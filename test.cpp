@@ -1,61 +1,628 @@
 #include "spg.hpp"
+#include "compact_spg.hpp"
+#include <algorithm>
 #include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <ratio>
 #include <set>
+#include <sstream>
+#include <string>
 #include <vector>
-#include <random>
-#include <algorithm>
 
-int main(void)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/// Benchmark of SPG, its options and CompactSPG against std::set.
+///
+/// Every (workload, key type, size, container) runs in its own forked
+/// process, so that the peak RSS reported by getrusage is its own. A run
+/// is one warmup repetition followed by --reps timed repetitions on a new
+/// container each time. The operations are timed by batches, the
+/// percentiles are those of the ns/op of the batches. The std::ratio
+/// variant has its alpha fixed at 0.7 and runs once per size.
+///
+/// The correctness checks of the containers are in check.cpp.
+///
+/// Build and run, the checks first:
+///   g++ -std=c++17 -O1 -g -fsanitize=address,undefined -pthread -I. check.cpp -o check
+///   ./check
+///   g++ -std=c++17 -O1 -g -mavx2 -fsanitize=address,undefined -pthread -I. check.cpp -o check_avx2
+///   ./check_avx2
+///   g++ -std=c++17 -O2 -DNDEBUG -pthread -I. test.cpp -o test
+///   ./test --sizes 10000
+///
+/// Usage: test [--format csv|json] [--sizes 10000,100000] [--reps 5]
+///             [--alphas 0.55,0.6,0.7,0.8,0.9] [--keys int,int64,string]
+///             [--workloads sorted,reverse,shuffled,zipf,mixed,range]
+///             [--containers spg,spg_pool,spg_buffer,spg_parallel,spg_veb,
+///                           spg_ratio,compact_spg,std::set]
+///             [--seed 42]
+
+namespace
 {
-    // Random vector.
-    std::size_t l_Size = 1000000;
+    /// Operations per timed batch, range scans are timed one by one.
+    std::size_t const   c_BatchSize = 64;
+
+    /// Number of keys visited by a range scan.
+    std::uint64_t const c_RangeSpan = 100;
+
+    enum class OpKind : char
+    {
+        Insert,
+        Find,
+        Erase,
+        Range
+    };
+
+    /// An operation on key indices, turned into keys before the run.
+    struct Op
+    {
+        OpKind          Kind;
+        std::uint64_t   Lo;
+        std::uint64_t   Hi;
+    };
+
+    /// Keys inserted before the timing, then the timed operations.
+    struct Workload
+    {
+        std::vector<std::uint64_t>  Prefill;
+        std::vector<Op>             Ops;
+    };
+
+    struct Config
+    {
+        std::string                 Format = "csv";
+        std::vector<std::size_t>    Sizes = {10000, 100000, 1000000};
+        std::vector<float>          Alphas = {0.55f, 0.6f, 0.7f, 0.8f, 0.9f};
+        std::vector<std::string>    Keys = {"int", "int64", "string"};
+        std::vector<std::string>    Workloads = {"sorted", "reverse", "shuffled", "zipf", "mixed", "range"};
+        std::vector<std::string>    Containers = {"spg", "spg_pool", "spg_buffer", "spg_parallel", "spg_veb",
+                                                  "spg_ratio", "compact_spg", "std::set"};
+        std::size_t                 Reps = 5;
+        std::uint64_t               Seed = 42;
+    };
+
+    /// Key types, built from an index so that the order of the indices is kept.
+    template <typename Key>
+    struct KeyOf;
+
+    template <>
+    struct KeyOf<int>
+    {
+        static int Make(std::uint64_t p_Index) { return static_cast<int>(p_Index); }
+    };
+
+    template <>
+    struct KeyOf<std::int64_t>
+    {
+        /// Spread over the 64 bits, still ordered.
+        static std::int64_t Make(std::uint64_t p_Index) { return static_cast<std::int64_t>(p_Index << 20) + 12345; }
+    };
+
+    template <>
+    struct KeyOf<std::string>
+    {
+        /// 20 characters, out of the small string buffer.
+        static std::string Make(std::uint64_t p_Index)
+        {
+            char l_Buffer[32];
+            std::snprintf(l_Buffer, sizeof (l_Buffer), "key:%016" PRIu64, p_Index);
+            return l_Buffer;
+        }
+    };
+
+    /// Zipf distribution over [0, p_N) with exponent p_S, sampled by inversion of the cdf.
+    class Zipf
+    {
+        public:
+            Zipf(std::size_t p_N, double p_S)
+                : m_Cdf(p_N)
+            {
+                double l_Sum = 0;
+                for (std::size_t i = 0; i < p_N; ++i)
+                {
+                    l_Sum += 1.0 / std::pow(static_cast<double>(i + 1), p_S);
+                    m_Cdf[i] = l_Sum;
+                }
+                for (double& l_Value : m_Cdf)
+                    l_Value /= l_Sum;
+            }
+
+            template <typename Generator>
+            std::uint64_t operator()(Generator& p_Generator)
+            {
+                double l_U = std::uniform_real_distribution<double>(0, 1)(p_Generator);
+                return std::lower_bound(m_Cdf.begin(), m_Cdf.end() - 1, l_U) - m_Cdf.begin();
+            }
+
+        private:
+            std::vector<double> m_Cdf;
+    };
+
+    /// Builds the operations of a workload on p_N keys.
+    Workload MakeWorkload(std::string const& p_Name, std::size_t p_N, std::uint64_t p_Seed)
+    {
+        std::mt19937_64 l_Generator(p_Seed);
+        Workload l_Workload;
+
+        std::vector<std::uint64_t> l_Indices(p_N);
+        for (std::size_t i = 0; i < p_N; ++i)
+            l_Indices[i] = i;
+
+        if (p_Name == "sorted" || p_Name == "reverse" || p_Name == "shuffled")
+        {
+            if (p_Name == "reverse")
+                std::reverse(l_Indices.begin(), l_Indices.end());
+            else if (p_Name == "shuffled")
+                std::shuffle(l_Indices.begin(), l_Indices.end(), l_Generator);
+
+            for (std::uint64_t l_Index : l_Indices)
+                l_Workload.Ops.push_back({OpKind::Insert, l_Index, l_Index});
+        }
+        else if (p_Name == "zipf")
+        {
+            /// Skewed lookups: the hot keys are scattered over the tree.
+            std::shuffle(l_Indices.begin(), l_Indices.end(), l_Generator);
+            l_Workload.Prefill = l_Indices;
+
+            Zipf l_Zipf(p_N, 0.99);
+            for (std::size_t i = 0; i < p_N; ++i)
+            {
+                std::uint64_t l_Index = l_Indices[l_Zipf(l_Generator)];
+                l_Workload.Ops.push_back({OpKind::Find, l_Index, l_Index});
+            }
+        }
+        else if (p_Name == "mixed")
+        {
+            /// Half of a key space twice the size is in the tree, then
+            /// 50% finds, 25% inserts and 25% erases on the whole space.
+            std::vector<std::uint64_t> l_Space(2 * p_N);
+            for (std::size_t i = 0; i < l_Space.size(); ++i)
+                l_Space[i] = i;
+            std::shuffle(l_Space.begin(), l_Space.end(), l_Generator);
+            l_Workload.Prefill.assign(l_Space.begin(), l_Space.begin() + p_N);
+
+            std::uniform_int_distribution<std::uint64_t> l_Keys(0, 2 * p_N - 1);
+            for (std::size_t i = 0; i < p_N; ++i)
+            {
+                std::uint64_t l_Index = l_Keys(l_Generator);
+                std::uint64_t l_Dice = l_Generator() & 3;
+                OpKind l_Kind = l_Dice < 2 ? OpKind::Find : l_Dice == 2 ? OpKind::Insert : OpKind::Erase;
+                l_Workload.Ops.push_back({l_Kind, l_Index, l_Index});
+            }
+        }
+        else if (p_Name == "range")
+        {
+            std::shuffle(l_Indices.begin(), l_Indices.end(), l_Generator);
+            l_Workload.Prefill = l_Indices;
+
+            std::uniform_int_distribution<std::uint64_t> l_Keys(0, p_N - 1);
+            for (std::size_t i = 0; i < std::max<std::size_t>(p_N / c_RangeSpan, 1); ++i)
+            {
+                std::uint64_t l_Lo = l_Keys(l_Generator);
+                l_Workload.Ops.push_back({OpKind::Range, l_Lo, l_Lo + c_RangeSpan - 1});
+            }
+        }
+        else
+        {
+            std::fprintf(stderr, "unknown workload %s\n", p_Name.c_str());
+            std::exit(1);
+        }
+
+        return l_Workload;
+    }
+
+    /// Container adapters.
+    template <typename Container>
+    struct Bench;
+
+    template <typename Key, typename... Args>
+    struct Bench<SPG<Key, Args...>>
+    {
+        using container_type = SPG<Key, Args...>;
+
+        static std::unique_ptr<container_type> Make(float p_Alpha) { return std::unique_ptr<container_type>(new container_type(p_Alpha)); }
+        static long Rebuilds(container_type const& p_Container) { return static_cast<long>(p_Container.rebuild_count()); }
+
+        template <typename Function>
+        static void Range(container_type const& p_Container, Key const& p_Lo, Key const& p_Hi, Function p_Function)
+        {
+            p_Container.for_each_in_range(p_Lo, p_Hi, p_Function);
+        }
+    };
+
+    template <typename Key>
+    struct Bench<CompactSPG<Key>>
+    {
+        using container_type = CompactSPG<Key>;
+
+        static std::unique_ptr<container_type> Make(float p_Alpha) { return std::unique_ptr<container_type>(new container_type(p_Alpha)); }
+        static long Rebuilds(container_type const& p_Container) { return static_cast<long>(p_Container.rebuild_count()); }
+
+        template <typename Function>
+        static void Range(container_type const& p_Container, Key const& p_Lo, Key const& p_Hi, Function p_Function)
+        {
+            p_Container.for_each_in_range(p_Lo, p_Hi, p_Function);
+        }
+    };
+
+    template <typename Key>
+    struct Bench<std::set<Key>>
+    {
+        using container_type = std::set<Key>;
 
-    std::vector<int> v;
-    v.reserve(l_Size);
+        static std::unique_ptr<container_type> Make(float) { return std::unique_ptr<container_type>(new container_type()); }
+        static long Rebuilds(container_type const&) { return -1; }
 
-    for (int i = 0; i < l_Size; i++)
-        v.push_back(i);
+        template <typename Function>
+        static void Range(container_type const& p_Container, Key const& p_Lo, Key const& p_Hi, Function p_Function)
+        {
+            for (auto l_It = p_Container.lower_bound(p_Lo); l_It != p_Container.end() && !(p_Hi < *l_It); ++l_It)
+                p_Function(*l_It);
+        }
+    };
 
-    std::random_device rd;
-    std::mt19937 g(rd());
+    struct Result
+    {
+        double      Mean;
+        double      P50;
+        double      P90;
+        double      P99;
+        double      Max;
+        long        Rebuilds;   ///< Rebuilds of the timed part of the last repetition, -1 if it does not apply.
+        long        PeakRss;    ///< Peak resident set of the run, in KiB.
+        long        BaseRss;    ///< Resident set before the first container is built, in KiB.
+        std::size_t Checksum;   ///< Keeps the lookups from being optimized out.
+    };
 
-    std::shuffle(v.begin(), v.end(), g);
+    long PeakRssKiB()
+    {
+        struct rusage l_Usage;
+        getrusage(RUSAGE_SELF, &l_Usage);
+        return l_Usage.ru_maxrss;
+    }
 
-    /// SPG.
+    double Percentile(std::vector<double> const& p_Sorted, double p_Rank)
+    {
+        if (p_Sorted.empty())
+            return 0;
+        std::size_t l_Index = static_cast<std::size_t>(p_Rank * (p_Sorted.size() - 1) + 0.5);
+        return p_Sorted[l_Index];
+    }
 
-    auto l_clock1 = std::clock();
-    SPG<int> s{0.59f};
-    for (int e : v)
-        s.insert(e);
+    template <typename Container, typename Key>
+    Result Run(Workload const& p_Workload, float p_Alpha, std::size_t p_Reps)
+    {
+        using bench = Bench<Container>;
+        using clock = std::chrono::steady_clock;
 
-    //s.print();
+        std::vector<Key> l_Prefill;
+        l_Prefill.reserve(p_Workload.Prefill.size());
+        for (std::uint64_t l_Index : p_Workload.Prefill)
+            l_Prefill.push_back(KeyOf<Key>::Make(l_Index));
 
-    auto sum = 0;
-    for (auto i : s)
-        sum += i;
-        //std::cout << i << std::endl;
+        std::vector<Key> l_Lo;
+        std::vector<Key> l_Hi;
+        l_Lo.reserve(p_Workload.Ops.size());
+        for (Op const& l_Op : p_Workload.Ops)
+        {
+            l_Lo.push_back(KeyOf<Key>::Make(l_Op.Lo));
+            if (l_Op.Kind == OpKind::Range)
+                l_Hi.push_back(KeyOf<Key>::Make(l_Op.Hi));
+        }
 
-    auto l_clock2 = std::clock();
-    std::cout << l_clock2 - l_clock1 << std::endl;
+        Result l_Result;
+        l_Result.BaseRss = PeakRssKiB();
+        l_Result.Checksum = 0;
 
-    l_clock1 = std::clock();
+        std::size_t l_Batch = p_Workload.Ops.empty() || p_Workload.Ops[0].Kind != OpKind::Range ? c_BatchSize : 1;
+        std::vector<double> l_Samples;
 
-    /// SET.
-    std::set<int> s2;
-    for (int e : v)
-        s2.insert(e);
+        /// The repetition 0 is the warmup.
+        for (std::size_t l_Rep = 0; l_Rep <= p_Reps; ++l_Rep)
+        {
+            std::unique_ptr<Container> l_Container = bench::Make(p_Alpha);
+            for (Key const& l_Key : l_Prefill)
+                l_Container->insert(l_Key);
 
-    sum = 0;
-    for (auto i = s2.cbegin(); i != s2.cend(); ++i)
-        sum += *i;
+            long l_Rebuilds = bench::Rebuilds(*l_Container);
+            std::size_t l_Range = 0;
 
-    l_clock2 = std::clock();
+            for (std::size_t l_First = 0; l_First < p_Workload.Ops.size(); l_First += l_Batch)
+            {
+                std::size_t l_Last = std::min(l_First + l_Batch, p_Workload.Ops.size());
+                auto l_Start = clock::now();
+
+                for (std::size_t i = l_First; i < l_Last; ++i)
+                {
+                    switch (p_Workload.Ops[i].Kind)
+                    {
+                        case OpKind::Insert:
+                            l_Container->insert(l_Lo[i]);
+                            break;
+                        case OpKind::Find:
+                            l_Result.Checksum += l_Container->find(l_Lo[i]) != l_Container->end();
+                            break;
+                        case OpKind::Erase:
+                            l_Result.Checksum += l_Container->erase(l_Lo[i]);
+                            break;
+                        case OpKind::Range:
+                            bench::Range(*l_Container, l_Lo[i], l_Hi[l_Range++], [&l_Result](Key const&) { ++l_Result.Checksum; });
+                            break;
+                    }
+                }
+
+                auto l_End = clock::now();
+                if (l_Rep > 0)
+                    l_Samples.push_back(std::chrono::duration<double, std::nano>(l_End - l_Start).count() / (l_Last - l_First));
+            }
+
+            if (l_Rebuilds >= 0)
+                l_Rebuilds = bench::Rebuilds(*l_Container) - l_Rebuilds;
+            l_Result.Rebuilds = l_Rebuilds;
+        }
+
+        double l_Sum = 0;
+        for (double l_Sample : l_Samples)
+            l_Sum += l_Sample;
+        std::sort(l_Samples.begin(), l_Samples.end());
+
+        l_Result.Mean = l_Samples.empty() ? 0 : l_Sum / l_Samples.size();
+        l_Result.P50 = Percentile(l_Samples, 0.50);
+        l_Result.P90 = Percentile(l_Samples, 0.90);
+        l_Result.P99 = Percentile(l_Samples, 0.99);
+        l_Result.Max = l_Samples.empty() ? 0 : l_Samples.back();
+        l_Result.PeakRss = PeakRssKiB();
+
+        return l_Result;
+    }
+
+    /// Formats one result as a CSV line or a JSON object.
+    std::string Format(Config const& p_Config, char const* p_Container, float p_Alpha,
+                       std::string const& p_Key, std::string const& p_Workload,
+                       std::size_t p_Size, std::size_t p_Ops, Result const& p_Result)
+    {
+        char l_Alpha[16] = "";
+        if (p_Alpha > 0)
+            std::snprintf(l_Alpha, sizeof (l_Alpha), "%.3f", p_Alpha);
+
+        char l_Rebuilds[32] = "";
+        if (p_Result.Rebuilds >= 0)
+            std::snprintf(l_Rebuilds, sizeof (l_Rebuilds), "%ld", p_Result.Rebuilds);
+
+        char l_Line[1024];
+        if (p_Config.Format == "json")
+            std::snprintf(l_Line, sizeof (l_Line),
+                          "{\"container\": \"%s\", \"alpha\": %s, \"key\": \"%s\", \"workload\": \"%s\", "
+                          "\"size\": %zu, \"ops\": %zu, \"reps\": %zu, \"mean_ns\": %.2f, \"p50_ns\": %.2f, "
+                          "\"p90_ns\": %.2f, \"p99_ns\": %.2f, \"max_ns\": %.2f, \"rebuilds\": %s, "
+                          "\"peak_rss_kib\": %ld, \"base_rss_kib\": %ld, \"checksum\": %zu}",
+                          p_Container, *l_Alpha ? l_Alpha : "null", p_Key.c_str(), p_Workload.c_str(),
+                          p_Size, p_Ops, p_Config.Reps, p_Result.Mean, p_Result.P50,
+                          p_Result.P90, p_Result.P99, p_Result.Max, *l_Rebuilds ? l_Rebuilds : "null",
+                          p_Result.PeakRss, p_Result.BaseRss, p_Result.Checksum);
+        else
+            std::snprintf(l_Line, sizeof (l_Line),
+                          "%s,%s,%s,%s,%zu,%zu,%zu,%.2f,%.2f,%.2f,%.2f,%.2f,%s,%ld,%ld,%zu",
+                          p_Container, l_Alpha, p_Key.c_str(), p_Workload.c_str(),
+                          p_Size, p_Ops, p_Config.Reps, p_Result.Mean, p_Result.P50,
+                          p_Result.P90, p_Result.P99, p_Result.Max, l_Rebuilds,
+                          p_Result.PeakRss, p_Result.BaseRss, p_Result.Checksum);
+
+        return l_Line;
+    }
+
+    /// Runs one configuration in a child process and returns its formatted result.
+    template <typename Container, typename Key>
+    std::string RunIsolated(Config const& p_Config, char const* p_Container, std::string const& p_Key,
+                            std::string const& p_Workload, std::size_t p_Size, float p_Alpha)
+    {
+        int l_Pipe[2];
+        if (pipe(l_Pipe) != 0)
+        {
+            std::perror("pipe");
+            std::exit(1);
+        }
+
+        pid_t l_Pid = fork();
+        if (l_Pid < 0)
+        {
+            std::perror("fork");
+            std::exit(1);
+        }
+
+        if (l_Pid == 0)
+        {
+            close(l_Pipe[0]);
+
+            Workload l_Workload = MakeWorkload(p_Workload, p_Size, p_Config.Seed);
+            Result l_Result = Run<Container, Key>(l_Workload, p_Alpha, p_Config.Reps);
+            std::string l_Line = Format(p_Config, p_Container, p_Alpha, p_Key, p_Workload,
+                                        p_Size, l_Workload.Ops.size(), l_Result);
+
+            ssize_t l_Written = write(l_Pipe[1], l_Line.data(), l_Line.size());
+            _exit(l_Written == static_cast<ssize_t>(l_Line.size()) ? 0 : 1);
+        }
+
+        close(l_Pipe[1]);
+
+        std::string l_Line;
+        char l_Buffer[1024];
+        ssize_t l_Read;
+        while ((l_Read = read(l_Pipe[0], l_Buffer, sizeof (l_Buffer))) > 0)
+            l_Line.append(l_Buffer, l_Read);
+        close(l_Pipe[0]);
+
+        int l_Status;
+        waitpid(l_Pid, &l_Status, 0);
+        if (!WIFEXITED(l_Status) || WEXITSTATUS(l_Status) != 0)
+        {
+            std::fprintf(stderr, "run %s/%s/%s/%zu failed\n", p_Container, p_Key.c_str(), p_Workload.c_str(), p_Size);
+            std::exit(1);
+        }
+
+        return l_Line;
+    }
+
+    /// Runs every container on one key type.
+    template <typename Key>
+    void RunKey(Config const& p_Config, std::string const& p_Key, bool& p_First)
+    {
+        using Less = std::less<Key>;
+        using Alloc = std::allocator<Key>;
+
+        auto l_Emit = [&p_Config, &p_First](std::string const& p_Line)
+        {
+            if (p_Config.Format == "json")
+                std::printf("%s\n  %s", p_First ? "" : ",", p_Line.c_str());
+            else
+                std::printf("%s\n", p_Line.c_str());
+            std::fflush(stdout);
+            p_First = false;
+        };
+
+        auto l_Wanted = [&p_Config](char const* p_Container)
+        {
+            return std::find(p_Config.Containers.begin(), p_Config.Containers.end(), p_Container) != p_Config.Containers.end();
+        };
+
+        for (std::string const& l_Workload : p_Config.Workloads)
+        {
+            for (std::size_t l_Size : p_Config.Sizes)
+            {
+                for (float l_Alpha : p_Config.Alphas)
+                {
+                    if (l_Wanted("spg"))
+                        l_Emit(RunIsolated<SPG<Key>, Key>(p_Config, "spg", p_Key, l_Workload, l_Size, l_Alpha));
+                    if (l_Wanted("spg_pool"))
+                        l_Emit(RunIsolated<SPG<Key, Less, spg_pool_allocator<Key>>, Key>(p_Config, "spg_pool", p_Key,
+                                                                                         l_Workload, l_Size, l_Alpha));
+                    if (l_Wanted("spg_buffer"))
+                        l_Emit(RunIsolated<SPG<Key, Less, Alloc, spg_buffer_rebuild>, Key>(p_Config, "spg_buffer", p_Key,
+                                                                                           l_Workload, l_Size, l_Alpha));
+                    if (l_Wanted("spg_parallel"))
+                        l_Emit(RunIsolated<SPG<Key, Less, Alloc, spg_parallel_rebuild>, Key>(p_Config, "spg_parallel", p_Key,
+                                                                                             l_Workload, l_Size, l_Alpha));
+                    if (l_Wanted("spg_veb"))
+                        l_Emit(RunIsolated<SPG<Key, Less, Alloc, spg_veb_layout>, Key>(p_Config, "spg_veb", p_Key,
+                                                                                       l_Workload, l_Size, l_Alpha));
+                    if (l_Wanted("compact_spg"))
+                        l_Emit(RunIsolated<CompactSPG<Key>, Key>(p_Config, "compact_spg", p_Key, l_Workload, l_Size, l_Alpha));
+                }
+
+                if (l_Wanted("spg_ratio"))
+                    l_Emit(RunIsolated<SPG<Key, Less, Alloc, std::ratio<7, 10>>, Key>(p_Config, "spg_ratio", p_Key,
+                                                                                      l_Workload, l_Size, 0.7f));
+                if (l_Wanted("std::set"))
+                    l_Emit(RunIsolated<std::set<Key>, Key>(p_Config, "std::set", p_Key, l_Workload, l_Size, 0));
+            }
+        }
+    }
+
+    std::vector<std::string> SplitList(char const* p_List)
+    {
+        std::vector<std::string> l_Items;
+        std::stringstream l_Stream(p_List);
+        std::string l_Item;
+        while (std::getline(l_Stream, l_Item, ','))
+            if (!l_Item.empty())
+                l_Items.push_back(l_Item);
+        return l_Items;
+    }
+
+    Config ParseArgs(int p_Argc, char** p_Argv)
+    {
+        Config l_Config;
+
+        for (int i = 1; i < p_Argc; ++i)
+        {
+            std::string l_Arg = p_Argv[i];
+            if (i + 1 >= p_Argc)
+            {
+                std::fprintf(stderr, "missing value for %s\n", l_Arg.c_str());
+                std::exit(1);
+            }
+
+            char const* l_Value = p_Argv[++i];
+
+            if (l_Arg == "--format")
+                l_Config.Format = l_Value;
+            else if (l_Arg == "--reps")
+                l_Config.Reps = std::strtoul(l_Value, nullptr, 10);
+            else if (l_Arg == "--seed")
+                l_Config.Seed = std::strtoull(l_Value, nullptr, 10);
+            else if (l_Arg == "--keys")
+                l_Config.Keys = SplitList(l_Value);
+            else if (l_Arg == "--workloads")
+                l_Config.Workloads = SplitList(l_Value);
+            else if (l_Arg == "--containers")
+                l_Config.Containers = SplitList(l_Value);
+            else if (l_Arg == "--sizes")
+            {
+                l_Config.Sizes.clear();
+                for (std::string const& l_Item : SplitList(l_Value))
+                    l_Config.Sizes.push_back(std::strtoul(l_Item.c_str(), nullptr, 10));
+            }
+            else if (l_Arg == "--alphas")
+            {
+                l_Config.Alphas.clear();
+                for (std::string const& l_Item : SplitList(l_Value))
+                    l_Config.Alphas.push_back(std::strtof(l_Item.c_str(), nullptr));
+            }
+            else
+            {
+                std::fprintf(stderr, "unknown option %s\n", l_Arg.c_str());
+                std::exit(1);
+            }
+        }
+
+        if (l_Config.Format != "csv" && l_Config.Format != "json")
+        {
+            std::fprintf(stderr, "unknown format %s\n", l_Config.Format.c_str());
+            std::exit(1);
+        }
+
+        return l_Config;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Config l_Config = ParseArgs(argc, argv);
 
-    /// CALLGRIND_DUMP_STATS;
+    if (l_Config.Format == "json")
+        std::printf("[");
+    else
+        std::printf("container,alpha,key,workload,size,ops,reps,mean_ns,p50_ns,p90_ns,p99_ns,max_ns,"
+                    "rebuilds,peak_rss_kib,base_rss_kib,checksum\n");
+    std::fflush(stdout);
 
-    std::cout << l_clock2 - l_clock1 << std::endl;
+    bool l_First = true;
+    for (std::string const& l_Key : l_Config.Keys)
+    {
+        if (l_Key == "int")
+            RunKey<int>(l_Config, l_Key, l_First);
+        else if (l_Key == "int64")
+            RunKey<std::int64_t>(l_Config, l_Key, l_First);
+        else if (l_Key == "string")
+            RunKey<std::string>(l_Config, l_Key, l_First);
+        else
+        {
+            std::fprintf(stderr, "unknown key type %s\n", l_Key.c_str());
+            return 1;
+        }
+    }
 
-    s2.clear();
+    if (l_Config.Format == "json")
+        std::printf("\n]\n");
 
     return 0;
 }